@@ -50,13 +50,42 @@
 #define HMAC_OK 0 ///< Return value: HMAC OK!
 
 #define AE_ENC_OK 0 ///< Return value: Authenticated Encryption OK!
+#define AE_DEC_OK 0 ///< Return value: Authenticated Decryption OK!
+
+#define THREAD_ERROR 4 ///< Error/Return value: the worker threads could not be started
+#define INVALID_TAG 5 ///< Error/Return value: the authentication tag does not match, the data was not decrypted
+#define FILE_ERROR 6 ///< Error/Return value: a file could not be opened, resized or mapped, see bksq_file()
+#define OUT_OF_MEMORY 7 ///< Error/Return value: a buffer could not be allocated
+#define BACKEND_UNAVAILABLE 8 ///< Error/Return value: the backend is unknown, not supported by the CPU or failed its self-test, see bksq_backend_select()
+#define OUTPUT_FILE_ERROR 9 ///< Error/Return value: the output file could not be opened, resized, mapped or written, see bksq_file()
+#define SAME_FILE 10 ///< Error/Return value: input and output are the same file, nothing was touched, see bksq_file()
 
 // Macros and Constants
 
 
 #define BLOCKSIZE 96 ///< fix the BLOCKSIZE to 96 bits
-#define BLOCKSIZE_BYTE (BLOCKSIZE+7)/8 ///< the BLOCKSIZE in bytes, for convenience only  
+#define BLOCKSIZE_BYTE ((BLOCKSIZE+7)/8) ///< the BLOCKSIZE in bytes, for convenience only  
 #define BLOCKCYPHER_ENCRYPT(in, key, out) bksq_encrypt(in, out, key) ///< dependeny injection, defining the block cypher used
+#define BITSLICE_LANES 64 ///< number of blocks the bitsliced kernel encrypts in parallel, one per bit of a uint64_t
+#define MULTIBLOCK_BATCH 64 ///< number of counter blocks ctr() hands to the multi-block API at once
+#define CHUNKS_PER_THREAD 4 ///< ctr_parallel() splits the data into this many chunks per thread, for load balancing
+#define DM_MANY_LANES 8 ///< number of messages dmhash_many() advances in lock-step
+#define DM_TREE_LEAF 0x00 ///< first byte of the block prepended to every leaf of dmhash_tree()
+#define DM_TREE_NODE 0x01 ///< first byte of the block prepended to every inner node of dmhash_tree()
+#define AE_BATCH_RECORDS 64 ///< number of records ae_enc_batch() encrypts before it MACs them, while they are still in the cache
+#define BACKEND_SELF_TEST_BLOCKS 67 ///< number of blocks the self-test of every backend encrypts at once: a bitsliced batch and a ragged tail
+#define BACKEND_CALIBRATION_BLOCKS 256 ///< number of blocks per call of the calibration run of every backend
+#define BACKEND_CALIBRATION_SINGLE 16 ///< number of single blocks per round of the calibration run of every backend
+#define BACKEND_CALIBRATION_NS 2000000 ///< the calibration run of every backend takes at least this many nanoseconds
+
+#include <pthread.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(BKSQ_NO_SIMD)
+#define BKSQ_X86_SIMD ///< the SSSE3 and AVX2 kernels are compiled in (and picked at runtime if the CPU has them)
+#include <immintrin.h>
+#endif
 
 
 
@@ -70,6 +99,310 @@ typedef struct {
     uint8_t const *nonce; ///< a pointer to the nonce to be used for encryption/decryption
     uint8_t nonce_length; ///< the length of the nonce in bits
 } CONTEXT;
+
+/**
+ * The expanded form of a BKSQ key: all round keys, computed once by bksq_key_expand()
+ */
+typedef struct {
+    uint8_t round_key[11][12]; ///< round_key[0] is the whitening key (the key itself), round_key[t] the key of round t
+    uint32_t theta_round_key[10][4]; ///< theta(round_key[t]) in column words, as needed by the T-table engine
+} BKSQ_KEY_SCHEDULE;
+
+/**
+ * A pool of worker threads, created once by bksq_pool_create() and reused for every parallel operation.
+ * bksq_pool_run() hands out the jobs 0,...,njobs-1 of one operation to the workers and the calling thread.
+ */
+typedef struct {
+    pthread_t *threads; ///< the worker threads
+    int nthreads; ///< the number of worker threads (may be 0, then the caller does all jobs)
+    pthread_mutex_t lock; ///< protects everything below
+    pthread_mutex_t run_lock; ///< serializes concurrent calls of bksq_pool_run()
+    pthread_cond_t work_ready; ///< signalled when new jobs arrive or the pool shuts down
+    pthread_cond_t work_done; ///< signalled when the last job of an operation is finished
+    void (*job)(void *arg, int index); ///< the job function of the current operation
+    void *job_arg; ///< the argument of the job function
+    int njobs; ///< the number of jobs of the current operation
+    int next_job; ///< the next job to be handed out
+    int pending_jobs; ///< the number of jobs not finished yet
+    int shutdown; ///< set by bksq_pool_destroy()
+} BKSQ_THREAD_POOL;
+
+/**
+ * The state of a counter mode stream, see ctr_stream_init(). Unlike ctr(), a stream takes data of any length
+ * in any number of pieces and can jump to any position with ctr_stream_seek().
+ */
+typedef struct {
+    BKSQ_KEY_SCHEDULE ks; ///< the expanded key
+    uint8_t nonce[6]; ///< the nonce, i.e. the first half of every counter block
+    uint8_t nonce_counter[12]; ///< the counter block of the next keystream block
+    uint8_t keystream[12]; ///< the current keystream block
+    uint8_t keystream_used; ///< the number of bytes of |keystream| already used; 12 if there are none left
+} CTR_STREAM;
+
+/**
+ * The state of an incremental Davies-Meyer-hash, see dm_init(). Data can be fed in pieces of any length;
+ * the total length must be a multiple of the blocklength, as with dmhash().
+ */
+typedef struct {
+    uint8_t hash[12]; ///< the chaining value H_i
+    uint8_t buffer[12]; ///< the beginning of the next block
+    uint8_t buffer_length; ///< the number of bytes in |buffer|
+} DM_CTX;
+
+/**
+ * The expanded form of a HMAC key: the chaining values of the inner and the outer hash after their first blocks
+ * ipad^key and opad^key. They depend on the key only and are computed once by hmac_key_expand().
+ */
+typedef struct {
+    uint8_t inner_state[12]; ///< H_1 of the inner hash, i.e. after ipad^key
+    uint8_t outer_state[12]; ///< H_1 of the outer hash, i.e. after opad^key
+} HMAC_KEY_SCHEDULE;
+
+/**
+ * The state of an incremental HMAC, see hmac_init().
+ */
+typedef struct {
+    DM_CTX inner; ///< the inner hash, started from the precomputed state after ipad^key
+    uint8_t outer_state[12]; ///< the precomputed state of the outer hash after opad^key
+} HMAC_CTX;
+
+/**
+ * One implementation of the block cypher, see bksq_backend_select(). bksq_key_expand(), bksq_encrypt_expanded(),
+ * bksq_encrypt_blocks_expanded() and dm_compress_lanes() run the kernels of the current backend.
+ */
+typedef struct {
+    char const *name; ///< the name, as given to bksq_backend_select() or in the environment variable BKSQ_BACKEND
+    uint8_t (*key_expand)(uint8_t const *key, BKSQ_KEY_SCHEDULE *ks); ///< expands a key, see bksq_key_expand()
+    uint8_t (*encrypt)(uint8_t const *plain, uint8_t *cyphertext, BKSQ_KEY_SCHEDULE const *ks); ///< encrypts a single block
+    uint8_t (*encrypt_blocks)(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks); ///< encrypts blocks under one key
+    void (*dm_compress_lanes)(uint8_t hash[][16], uint8_t const * const blocks[]); ///< one Davies-Meyer step of DM_MANY_LANES lanes
+    int (*supported)(void); ///< whether the CPU has the instructions the kernels need
+    int constant_time; ///< whether the kernels, the key schedule included, index no table by the blocks or the keys
+    int usable; ///< set by the probe: supported and the self-test passed
+    double throughput; ///< set by the probe: MB/s of |encrypt_blocks| and |encrypt| in the calibration run, see bksq_backend_calibrate()
+} BKSQ_BACKEND;
+
+BKSQ_BACKEND const *bksq_backend_current(void); //the registry follows the kernels, see dm_compress_lanes()
+BKSQ_BACKEND const *bksq_backend_at(int index); //the backend |index| of the registry, NULL past the last one
+int bksq_backend_index(BKSQ_BACKEND const *backend); //the index of |backend| in the registry
+
+/*
+	Instrumentation (compile with -DBKSQ_INSTRUMENT): every stage below counts its calls, blocks and bytes and
+	accumulates its time, in TSC ticks on x86 and in nanoseconds elsewhere, see bksq_instrument_unit().
+	Times are inclusive, e.g. the time of BKSQ_STAGE_CTR contains the time of BKSQ_STAGE_ENCRYPT_BLOCKS, so the
+	cost of the mode glue is the difference of both. Without BKSQ_INSTRUMENT the macros expand to nothing.
+	theta, theta_inverse, S_box and Permutation are functions of the reference backend only; the kernels of the other
+	backends do all of them at once. What every backend really runs is counted per backend instead, in the kernel
+	stages: single blocks, multi-block calls and Davies-Meyer lanes through the dispatch of the current backend.
+*/
+#ifdef BKSQ_INSTRUMENT
+
+#include <stdio.h>
+#include <time.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <x86intrin.h>
+#endif
+
+#define BKSQ_STAGE_THETA 0 ///< theta(), reference backend only
+#define BKSQ_STAGE_THETA_INVERSE 1 ///< theta_inverse(), reference backend only
+#define BKSQ_STAGE_S_BOX 2 ///< S_box(), reference backend only
+#define BKSQ_STAGE_PERMUTATION 3 ///< Permutation(), reference backend only
+#define BKSQ_STAGE_ROUND_KEY_EVOLUTION 4 ///< the ten round_key_evolution() of every bksq_key_expand(), timed together
+#define BKSQ_STAGE_KEY_EXPAND 5 ///< bksq_key_expand()
+#define BKSQ_STAGE_ENCRYPT_BLOCKS 6 ///< bksq_encrypt_blocks_expanded(), i.e. all block encryptions of the modes
+#define BKSQ_STAGE_CTR 7 ///< ctr_blocks_to(), the counter mode of ctr(), the streams, ctr_parallel() and ae_enc()
+#define BKSQ_STAGE_DMHASH 8 ///< dmhash()
+#define BKSQ_STAGE_HMAC 9 ///< hmac_expanded(), i.e. hmac()
+#define BKSQ_STAGE_AE_ENC 10 ///< ae_enc_expanded()
+#define BKSQ_STAGE_AE_DEC 11 ///< ae_dec_expanded()
+#define BKSQ_STAGE_KERNEL 12 ///< the kernels of backend b of the registry are stage BKSQ_STAGE_KERNEL+b
+#define BKSQ_KERNEL_STAGES 8 ///< number of kernel stages, at least the number of backends
+#define BKSQ_STAGES (BKSQ_STAGE_KERNEL+BKSQ_KERNEL_STAGES) ///< number of instrumented stages
+
+/**
+ * The counters of one instrumented stage
+ */
+typedef struct {
+    uint64_t calls; ///< the number of calls
+    uint64_t blocks; ///< the number of 12 byte blocks processed
+    uint64_t bytes; ///< the number of bytes processed
+    uint64_t time; ///< the accumulated time, see bksq_instrument_unit()
+} BKSQ_STAGE_COUNTERS;
+
+static char const * const bksq_stage_name[BKSQ_STAGE_KERNEL] = {
+	"theta", "theta_inverse", "S_box", "Permutation", "round_key_evolution", "key_expand",
+	"encrypt_blocks", "ctr", "dmhash", "hmac", "ae_enc", "ae_dec"
+};
+/**
+ * The counters of one thread. Only the owning thread writes them, with plain adds stored atomically (no RMW);
+ * bksq_instrument_snapshot() sums the blocks of all threads. The block of a finished thread keeps its counts and is
+ * taken over by the next new thread.
+ */
+typedef struct BKSQ_INSTRUMENT_THREAD {
+    BKSQ_STAGE_COUNTERS counters[BKSQ_STAGES]; ///< the counters of this thread
+    struct BKSQ_INSTRUMENT_THREAD *next; ///< the next block in bksq_instrument_threads
+    int in_use; ///< whether a running thread owns the block
+} BKSQ_INSTRUMENT_THREAD;
+static BKSQ_INSTRUMENT_THREAD *bksq_instrument_threads = NULL; ///< all blocks ever attached, protected by bksq_instrument_lock
+static BKSQ_STAGE_COUNTERS bksq_instrument_baseline[BKSQ_STAGES]; ///< the sums at the last bksq_instrument_reset()
+static pthread_mutex_t bksq_instrument_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t bksq_instrument_key;
+static pthread_once_t bksq_instrument_once = PTHREAD_ONCE_INIT;
+static __thread BKSQ_INSTRUMENT_THREAD *bksq_instrument_self = NULL;
+
+//Gives the block of an exiting thread free:
+static void bksq_instrument_detach(void *arg){
+	pthread_mutex_lock(&bksq_instrument_lock);
+	((BKSQ_INSTRUMENT_THREAD *)arg)->in_use=0;
+	pthread_mutex_unlock(&bksq_instrument_lock);
+}
+static void bksq_instrument_create_key(void){
+	pthread_key_create(&bksq_instrument_key,bksq_instrument_detach);
+}
+//The block of the calling thread, attached on its first call; NULL if none could be allocated (then nothing is counted):
+static BKSQ_INSTRUMENT_THREAD *bksq_instrument_thread(void){
+	BKSQ_INSTRUMENT_THREAD *self;
+	if(bksq_instrument_self!=NULL)
+		return bksq_instrument_self;
+	pthread_once(&bksq_instrument_once,bksq_instrument_create_key);
+	pthread_mutex_lock(&bksq_instrument_lock);
+	for(self=bksq_instrument_threads;self!=NULL && self->in_use;self=self->next);
+	if(self==NULL){
+		self=(BKSQ_INSTRUMENT_THREAD *)calloc(1,sizeof(BKSQ_INSTRUMENT_THREAD));
+		if(self!=NULL){
+			self->next=bksq_instrument_threads;
+			bksq_instrument_threads=self;
+		}
+	}
+	if(self!=NULL)
+		self->in_use=1;
+	pthread_mutex_unlock(&bksq_instrument_lock);
+	if(self!=NULL)
+		pthread_setspecific(bksq_instrument_key,self);
+	bksq_instrument_self=self;
+	return self;
+}
+
+//The clock of the instrumentation:
+static inline uint64_t bksq_instrument_now(void){
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000u+ts.tv_nsec;
+#endif
+}
+//Adds |calls| calls to the counters of a stage in the block of the calling thread; no atomic read-modify-write,
+//since only this thread writes them, and the stores are atomic only for bksq_instrument_snapshot():
+static inline void bksq_instrument_add(int stage, uint64_t calls, uint64_t blocks, uint64_t bytes, uint64_t start){
+	uint64_t time=bksq_instrument_now()-start;
+	BKSQ_INSTRUMENT_THREAD *self=bksq_instrument_thread();
+	BKSQ_STAGE_COUNTERS *c;
+	if(self==NULL)
+		return;
+	c=&self->counters[stage];
+	__atomic_store_n(&c->time,c->time+time,__ATOMIC_RELAXED);
+	__atomic_store_n(&c->calls,c->calls+calls,__ATOMIC_RELAXED);
+	__atomic_store_n(&c->blocks,c->blocks+blocks,__ATOMIC_RELAXED);
+	__atomic_store_n(&c->bytes,c->bytes+bytes,__ATOMIC_RELAXED);
+}
+
+#define BKSQ_INSTRUMENT_START(start) uint64_t start=bksq_instrument_now() ///< starts timing a stage
+#define BKSQ_INSTRUMENT_STOP(stage, start, blocks, bytes) bksq_instrument_add(stage, 1, blocks, bytes, start) ///< ends timing a stage and counts the call
+#define BKSQ_INSTRUMENT_STOP_CALLS(stage, start, calls, blocks, bytes) bksq_instrument_add(stage, calls, blocks, bytes, start) ///< ends timing a stage and counts |calls| calls
+#define BKSQ_INSTRUMENT_STOP_KERNEL(backend, start, blocks) bksq_instrument_add(BKSQ_STAGE_KERNEL+bksq_backend_index(backend), 1, blocks, 12*(blocks), start) ///< ends timing a kernel of |backend|
+
+/**
+ * The unit of BKSQ_STAGE_COUNTERS.time.
+ * @return Returns "tsc" for TSC ticks or "ns" for nanoseconds
+ */
+char const *bksq_instrument_unit(void){
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	return "tsc";
+#else
+	return "ns";
+#endif
+}
+//The sums of the counters of all threads; the caller holds bksq_instrument_lock:
+static void bksq_instrument_sum(BKSQ_STAGE_COUNTERS sum[BKSQ_STAGES]){
+	BKSQ_INSTRUMENT_THREAD *thread;
+	int i;
+	memset(sum,0,BKSQ_STAGES*sizeof(BKSQ_STAGE_COUNTERS));
+	for(thread=bksq_instrument_threads;thread!=NULL;thread=thread->next)
+		for(i=0;i<BKSQ_STAGES;i++){
+			sum[i].calls+=__atomic_load_n(&thread->counters[i].calls,__ATOMIC_RELAXED);
+			sum[i].blocks+=__atomic_load_n(&thread->counters[i].blocks,__ATOMIC_RELAXED);
+			sum[i].bytes+=__atomic_load_n(&thread->counters[i].bytes,__ATOMIC_RELAXED);
+			sum[i].time+=__atomic_load_n(&thread->counters[i].time,__ATOMIC_RELAXED);
+		}
+}
+/**
+ * Copies the counters of all stages, summed over all threads since the last bksq_instrument_reset().
+ * Every counter is read atomically, but not all of them at the same instant.
+ * @param snapshot receives the counters, indexed by BKSQ_STAGE_...
+ */
+void bksq_instrument_snapshot(BKSQ_STAGE_COUNTERS snapshot[BKSQ_STAGES]){
+	int i;
+	pthread_mutex_lock(&bksq_instrument_lock);
+	bksq_instrument_sum(snapshot);
+	for(i=0;i<BKSQ_STAGES;i++){
+		snapshot[i].calls-=bksq_instrument_baseline[i].calls;
+		snapshot[i].blocks-=bksq_instrument_baseline[i].blocks;
+		snapshot[i].bytes-=bksq_instrument_baseline[i].bytes;
+		snapshot[i].time-=bksq_instrument_baseline[i].time;
+	}
+	pthread_mutex_unlock(&bksq_instrument_lock);
+}
+/**
+ * Sets the counters of all stages to zero; the threads keep counting, the current sums become the new baseline.
+ */
+void bksq_instrument_reset(void){
+	pthread_mutex_lock(&bksq_instrument_lock);
+	bksq_instrument_sum(bksq_instrument_baseline);
+	pthread_mutex_unlock(&bksq_instrument_lock);
+}
+/**
+ * Writes a snapshot of the counters as a table or as JSON.
+ * @param f the file to write to
+ * @param json 0 for a table, otherwise a JSON object
+ */
+void bksq_instrument_dump(FILE *f, int json){
+	BKSQ_STAGE_COUNTERS snapshot[BKSQ_STAGES];
+	char name[32];
+	int i;
+	bksq_instrument_snapshot(snapshot);
+	if(json)
+		fprintf(f,"{\"unit\": \"%s\", \"reference_only\": [\"theta\", \"theta_inverse\", \"S_box\", \"Permutation\"], \"stages\": {",bksq_instrument_unit());
+	else
+		fprintf(f,"%-20s %14s %14s %16s %18s %12s\n","stage","calls","blocks","bytes",bksq_instrument_unit(),"per call");
+	for(i=0;i<BKSQ_STAGES;i++){
+		if(i<BKSQ_STAGE_KERNEL)
+			snprintf(name,sizeof(name),"%s",bksq_stage_name[i]);
+		else if(bksq_backend_at(i-BKSQ_STAGE_KERNEL)!=NULL)
+			snprintf(name,sizeof(name),"kernel %s",bksq_backend_at(i-BKSQ_STAGE_KERNEL)->name);
+		else
+			break;
+		if(json)
+			fprintf(f,"%s\n  \"%s\": {\"calls\": %llu, \"blocks\": %llu, \"bytes\": %llu, \"time\": %llu}",i==0 ? "" : ",",name,
+				(unsigned long long)snapshot[i].calls,(unsigned long long)snapshot[i].blocks,(unsigned long long)snapshot[i].bytes,(unsigned long long)snapshot[i].time);
+		else
+			fprintf(f,"%-20s %14llu %14llu %16llu %18llu %12.1f\n",name,
+				(unsigned long long)snapshot[i].calls,(unsigned long long)snapshot[i].blocks,(unsigned long long)snapshot[i].bytes,(unsigned long long)snapshot[i].time,
+				snapshot[i].calls ? (double)snapshot[i].time/snapshot[i].calls : 0.0);
+	}
+	if(json)
+		fprintf(f,"\n}}\n");
+	else
+		fprintf(f,"(theta, theta_inverse, S_box and Permutation count the reference backend only, the kernel rows every backend)\n");
+}
+
+#else
+#define BKSQ_INSTRUMENT_START(start)
+#define BKSQ_INSTRUMENT_STOP(stage, start, blocks, bytes)
+#define BKSQ_INSTRUMENT_STOP_CALLS(stage, start, calls, blocks, bytes)
+#define BKSQ_INSTRUMENT_STOP_KERNEL(backend, start, blocks)
+#endif
     
 
 //The purpose of this function is to implement the logarithm operation.
@@ -90,6 +423,7 @@ int exponent(int a, int b){
 	return n;
 }
 //The purpose of this function is to implement the multiplication operation in the GF(2^8).
+//(The original reference; the ciphers use the GF(2^8) module below, gf_mul() and friends.)
 uint8_t multiply(int val1, int val){
 	int result;
 	int input_vector[8];
@@ -110,6 +444,113 @@ uint8_t multiply(int val1, int val){
 	return result;
 }
 
+/*
+	GF(2^8) module with the polynomial 283 (0x11B). Every function without "table" in its name runs in constant time:
+	no branches and no memory accesses depending on the data. Multiplications by constants are chains of xtime.
+	The log/antilog tables (generator 3) are faster for a general multiplication, but their lookups depend on the data.
+*/
+//Multiplication by 2 in the GF(2^8), i.e. a shift followed by the reduction with 283 if the highest bit falls out:
+uint8_t xtime(uint8_t const val){
+	return (uint8_t)((val<<1)^((val>>7)*27));
+}
+//Multiplication by 3 = 2^1:
+uint8_t gf_mul3(uint8_t const val){
+	return (uint8_t)(xtime(val)^val);
+}
+//Multiplication by 247 = 128^64^32^16^4^2^1 (the coefficient theta_inverse needs, see there):
+uint8_t gf_mul247(uint8_t const val){
+	uint8_t x2=xtime(val);
+	uint8_t x4=xtime(x2);
+	uint8_t x16=xtime(xtime(x4));
+	uint8_t x32=xtime(x16);
+	uint8_t x64=xtime(x32);
+	return (uint8_t)(val^x2^x4^x16^x32^x64^xtime(x64));
+}
+//General multiplication, branch-free: the bits of b select the multiples a*2^i through a mask:
+uint8_t gf_mul(uint8_t a, uint8_t b){
+	uint8_t res=0;
+	int i;
+	for(i=0;i<8;i++){
+		res^=a&(uint8_t)-(b&1);
+		a=xtime(a);
+		b>>=1;
+	}
+	return res;
+}
+//Exponentiation by squaring with a fixed number of steps:
+uint8_t gf_pow(uint8_t a, uint8_t e){
+	uint8_t res=1;
+	uint8_t mask;
+	int i;
+	for(i=7;i>=0;i--){
+		mask=(uint8_t)-((e>>i)&1);
+		res=gf_mul(res,res);
+		res=gf_mul(res,(uint8_t)((a&mask)|(1&~mask)));
+	}
+	return res;
+}
+//gf_exp[i] = 3^i and gf_log[3^i] = i (gf_log[0] is unused):
+static const uint8_t gf_exp[255] = {
+	0x01, 0x03, 0x05, 0x0f, 0x11, 0x33, 0x55, 0xff, 0x1a, 0x2e, 0x72, 0x96, 0xa1, 0xf8, 0x13, 0x35,
+	0x5f, 0xe1, 0x38, 0x48, 0xd8, 0x73, 0x95, 0xa4, 0xf7, 0x02, 0x06, 0x0a, 0x1e, 0x22, 0x66, 0xaa,
+	0xe5, 0x34, 0x5c, 0xe4, 0x37, 0x59, 0xeb, 0x26, 0x6a, 0xbe, 0xd9, 0x70, 0x90, 0xab, 0xe6, 0x31,
+	0x53, 0xf5, 0x04, 0x0c, 0x14, 0x3c, 0x44, 0xcc, 0x4f, 0xd1, 0x68, 0xb8, 0xd3, 0x6e, 0xb2, 0xcd,
+	0x4c, 0xd4, 0x67, 0xa9, 0xe0, 0x3b, 0x4d, 0xd7, 0x62, 0xa6, 0xf1, 0x08, 0x18, 0x28, 0x78, 0x88,
+	0x83, 0x9e, 0xb9, 0xd0, 0x6b, 0xbd, 0xdc, 0x7f, 0x81, 0x98, 0xb3, 0xce, 0x49, 0xdb, 0x76, 0x9a,
+	0xb5, 0xc4, 0x57, 0xf9, 0x10, 0x30, 0x50, 0xf0, 0x0b, 0x1d, 0x27, 0x69, 0xbb, 0xd6, 0x61, 0xa3,
+	0xfe, 0x19, 0x2b, 0x7d, 0x87, 0x92, 0xad, 0xec, 0x2f, 0x71, 0x93, 0xae, 0xe9, 0x20, 0x60, 0xa0,
+	0xfb, 0x16, 0x3a, 0x4e, 0xd2, 0x6d, 0xb7, 0xc2, 0x5d, 0xe7, 0x32, 0x56, 0xfa, 0x15, 0x3f, 0x41,
+	0xc3, 0x5e, 0xe2, 0x3d, 0x47, 0xc9, 0x40, 0xc0, 0x5b, 0xed, 0x2c, 0x74, 0x9c, 0xbf, 0xda, 0x75,
+	0x9f, 0xba, 0xd5, 0x64, 0xac, 0xef, 0x2a, 0x7e, 0x82, 0x9d, 0xbc, 0xdf, 0x7a, 0x8e, 0x89, 0x80,
+	0x9b, 0xb6, 0xc1, 0x58, 0xe8, 0x23, 0x65, 0xaf, 0xea, 0x25, 0x6f, 0xb1, 0xc8, 0x43, 0xc5, 0x54,
+	0xfc, 0x1f, 0x21, 0x63, 0xa5, 0xf4, 0x07, 0x09, 0x1b, 0x2d, 0x77, 0x99, 0xb0, 0xcb, 0x46, 0xca,
+	0x45, 0xcf, 0x4a, 0xde, 0x79, 0x8b, 0x86, 0x91, 0xa8, 0xe3, 0x3e, 0x42, 0xc6, 0x51, 0xf3, 0x0e,
+	0x12, 0x36, 0x5a, 0xee, 0x29, 0x7b, 0x8d, 0x8c, 0x8f, 0x8a, 0x85, 0x94, 0xa7, 0xf2, 0x0d, 0x17,
+	0x39, 0x4b, 0xdd, 0x7c, 0x84, 0x97, 0xa2, 0xfd, 0x1c, 0x24, 0x6c, 0xb4, 0xc7, 0x52, 0xf6
+};
+static const uint8_t gf_log[256] = {
+	0x00, 0x00, 0x19, 0x01, 0x32, 0x02, 0x1a, 0xc6, 0x4b, 0xc7, 0x1b, 0x68, 0x33, 0xee, 0xdf, 0x03,
+	0x64, 0x04, 0xe0, 0x0e, 0x34, 0x8d, 0x81, 0xef, 0x4c, 0x71, 0x08, 0xc8, 0xf8, 0x69, 0x1c, 0xc1,
+	0x7d, 0xc2, 0x1d, 0xb5, 0xf9, 0xb9, 0x27, 0x6a, 0x4d, 0xe4, 0xa6, 0x72, 0x9a, 0xc9, 0x09, 0x78,
+	0x65, 0x2f, 0x8a, 0x05, 0x21, 0x0f, 0xe1, 0x24, 0x12, 0xf0, 0x82, 0x45, 0x35, 0x93, 0xda, 0x8e,
+	0x96, 0x8f, 0xdb, 0xbd, 0x36, 0xd0, 0xce, 0x94, 0x13, 0x5c, 0xd2, 0xf1, 0x40, 0x46, 0x83, 0x38,
+	0x66, 0xdd, 0xfd, 0x30, 0xbf, 0x06, 0x8b, 0x62, 0xb3, 0x25, 0xe2, 0x98, 0x22, 0x88, 0x91, 0x10,
+	0x7e, 0x6e, 0x48, 0xc3, 0xa3, 0xb6, 0x1e, 0x42, 0x3a, 0x6b, 0x28, 0x54, 0xfa, 0x85, 0x3d, 0xba,
+	0x2b, 0x79, 0x0a, 0x15, 0x9b, 0x9f, 0x5e, 0xca, 0x4e, 0xd4, 0xac, 0xe5, 0xf3, 0x73, 0xa7, 0x57,
+	0xaf, 0x58, 0xa8, 0x50, 0xf4, 0xea, 0xd6, 0x74, 0x4f, 0xae, 0xe9, 0xd5, 0xe7, 0xe6, 0xad, 0xe8,
+	0x2c, 0xd7, 0x75, 0x7a, 0xeb, 0x16, 0x0b, 0xf5, 0x59, 0xcb, 0x5f, 0xb0, 0x9c, 0xa9, 0x51, 0xa0,
+	0x7f, 0x0c, 0xf6, 0x6f, 0x17, 0xc4, 0x49, 0xec, 0xd8, 0x43, 0x1f, 0x2d, 0xa4, 0x76, 0x7b, 0xb7,
+	0xcc, 0xbb, 0x3e, 0x5a, 0xfb, 0x60, 0xb1, 0x86, 0x3b, 0x52, 0xa1, 0x6c, 0xaa, 0x55, 0x29, 0x9d,
+	0x97, 0xb2, 0x87, 0x90, 0x61, 0xbe, 0xdc, 0xfc, 0xbc, 0x95, 0xcf, 0xcd, 0x37, 0x3f, 0x5b, 0xd1,
+	0x53, 0x39, 0x84, 0x3c, 0x41, 0xa2, 0x6d, 0x47, 0x14, 0x2a, 0x9e, 0x5d, 0x56, 0xf2, 0xd3, 0xab,
+	0x44, 0x11, 0x92, 0xd9, 0x23, 0x20, 0x2e, 0x89, 0xb4, 0x7c, 0xb8, 0x26, 0x77, 0x99, 0xe3, 0xa5,
+	0x67, 0x4a, 0xed, 0xde, 0xc5, 0x31, 0xfe, 0x18, 0x0d, 0x63, 0x8c, 0x80, 0xc0, 0xf7, 0x70, 0x07
+};
+//Checks the log/antilog tables against gf_mul(). Returns 0 if they are consistent:
+int gf_tables_check(void){
+	int i;
+	uint8_t x=1;
+	for(i=0;i<255;i++){
+		if(gf_exp[i]!=x || gf_log[x]!=i)
+			return 1;
+		x=gf_mul(x,3);
+	}
+	return 0;
+}
+//General multiplication with the log/antilog tables (not constant time, see above):
+uint8_t gf_mul_table(uint8_t a, uint8_t b){
+	int sum=gf_log[a]+gf_log[b];
+	if(a==0 || b==0)
+		return 0;
+	return gf_exp[sum>=255 ? sum-255 : sum];
+}
+//The inverse with the log/antilog tables, 0 for 0 like extended_gcd (not constant time):
+uint8_t gf_inverse_table(uint8_t a){
+	if(a==0)
+		return 0;
+	return gf_exp[(255-gf_log[a])%255];
+}
+
 /*uint8_t multiply(uint8_t const val, int n){
 	int i;
 	i = val * 2;
@@ -130,19 +571,18 @@ uint8_t multiply(int val1, int val){
 }*/
 
 //The purpose of this function is to implement the theta linear transformation.
+//Every column (a,b,c) becomes (3a^2b^2c, 2a^3b^2c, 2a^2b^3c); with 3=1^2 that is each byte plus 2*(a^b^c):
 void theta(uint8_t const *val, uint8_t *res){
-	res[0]  = multiply(val[0],3) ^  multiply(val[1],2)  ^  multiply(val[2],2);
-	res[1]  = multiply(val[0],2) ^  multiply(val[1],3)  ^  multiply(val[2],2);
-	res[2]  = multiply(val[0],2) ^  multiply(val[1],2)  ^  multiply(val[2],3);
-	res[3]  = multiply(val[3],3) ^  multiply(val[4],2)  ^  multiply(val[5],2);
-	res[4]  = multiply(val[3],2) ^  multiply(val[4],3)  ^  multiply(val[5],2);
-	res[5]  = multiply(val[3],2) ^  multiply(val[4],2)  ^  multiply(val[5],3);
-	res[6]  = multiply(val[6],3) ^  multiply(val[7],2)  ^  multiply(val[8],2);
-	res[7]  = multiply(val[6],2) ^  multiply(val[7],3)  ^  multiply(val[8],2);
-	res[8]  = multiply(val[6],2) ^  multiply(val[7],2)  ^  multiply(val[8],3);
-	res[9]  = multiply(val[9],3) ^  multiply(val[10],2) ^  multiply(val[11],2);
-	res[10] = multiply(val[9],2) ^  multiply(val[10],3) ^  multiply(val[11],2);
-	res[11] = multiply(val[9],2) ^  multiply(val[10],2) ^  multiply(val[11],3);
+	int i;
+	uint8_t column;
+	BKSQ_INSTRUMENT_START(start);
+	for(i=0;i<12;i+=3){
+		column=xtime(val[i]^val[i+1]^val[i+2]);
+		res[i]=val[i]^column;
+		res[i+1]=val[i+1]^column;
+		res[i+2]=val[i+2]^column;
+	}
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_THETA,start,1,12);
 }
 //The purpose of this function is to implement the extended Eucledian algorithm to find the inverse of an element.
 uint8_t extended_gcd(uint8_t const val){
@@ -231,19 +671,86 @@ void affine_mapping(uint8_t const *val, uint8_t *res){
 	for(i=0;i<12;i++)
 		res[i]=affine_mapping_single(val[i]);
 }
+//S-Box single, computed from scratch (inversion followed by the affine mapping). Only used to check the tables below:
+uint8_t S_box_single_reference(uint8_t const val){
+	return affine_mapping_single(extended_gcd(val));
+}
+//Precomputed S-Box, i.e. sbox_table[x] == S_box_single_reference(x) for every byte x:
+static const uint8_t sbox_table[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+//Precomputed inverse S-Box, i.e. inverse_sbox_table[sbox_table[x]] == x for every byte x:
+static const uint8_t inverse_sbox_table[256] = {
+	0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+	0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+	0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+	0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+	0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+	0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+	0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+	0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+	0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+	0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+	0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+	0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+	0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+	0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+	0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+	0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
+};
+//Checks the precomputed tables against the reference S-Box. Returns 0 if both tables are consistent:
+int sbox_tables_check(void){
+	int i;
+	for(i=0;i<256;i++){
+		if(sbox_table[i]!=S_box_single_reference((uint8_t)i))
+			return 1;
+		if(inverse_sbox_table[sbox_table[i]]!=i)
+			return 1;
+	}
+	return 0;
+}
 //S-Box single:
 uint8_t S_box_single(uint8_t const val){
-	return affine_mapping_single(extended_gcd(val));
+	return sbox_table[val];
+}
+//Inverse S-Box single:
+uint8_t S_box_inverse_single(uint8_t const val){
+	return inverse_sbox_table[val];
 }
 //S-Box:
 void S_box(uint8_t const *val, uint8_t *res){
+	int i;
+	BKSQ_INSTRUMENT_START(start);
+	for(i=0;i<12;i++){
+		res[i]=sbox_table[val[i]];
+	}
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_S_BOX,start,1,12);
+}
+//Inverse S-Box:
+void S_box_inverse(uint8_t const *val, uint8_t *res){
 	int i;
 	for(i=0;i<12;i++){
-		res[i]=affine_mapping_single(extended_gcd(val[i]));
+		res[i]=inverse_sbox_table[val[i]];
 	}
 }
 //The byte permutation:
 void Permutation(uint8_t const *val, uint8_t *res){
+	BKSQ_INSTRUMENT_START(start);
 	res[0]=val[0];
 	res[1]=val[10];
 	res[2]=val[8];
@@ -256,24 +763,26 @@ void Permutation(uint8_t const *val, uint8_t *res){
 	res[9]=val[9];
 	res[10]=val[7];
 	res[11]=val[5];
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_PERMUTATION,start,1,12);
 }
 //The purpose of this function is to implement the inverse theta linear transformation:
+//Every column (a,b,c) becomes (246a^247b^247c, ...); with 246=247^1 that is each byte plus 247*(a^b^c):
 void theta_inverse(uint8_t const *val, uint8_t *res){
-	res[0]  = multiply(val[0],246) ^  multiply(val[1],247)  ^  multiply(val[2],247);
-	res[1]  = multiply(val[0],247) ^  multiply(val[1],246)  ^  multiply(val[2],247);
-	res[2]  = multiply(val[0],247) ^  multiply(val[1],247)  ^  multiply(val[2],246);
-	res[3]  = multiply(val[3],246) ^  multiply(val[4],247)  ^  multiply(val[5],247);
-	res[4]  = multiply(val[3],247) ^  multiply(val[4],246)  ^  multiply(val[5],247);
-	res[5]  = multiply(val[3],247) ^  multiply(val[4],247)  ^  multiply(val[5],246);
-	res[6]  = multiply(val[6],246) ^  multiply(val[7],247)  ^  multiply(val[8],247);
-	res[7]  = multiply(val[6],247) ^  multiply(val[7],246)  ^  multiply(val[8],247);
-	res[8]  = multiply(val[6],247) ^  multiply(val[7],247)  ^  multiply(val[8],246);
-	res[9]  = multiply(val[9],246) ^  multiply(val[10],247) ^  multiply(val[11],247);
-	res[10] = multiply(val[9],247) ^  multiply(val[10],246) ^  multiply(val[11],247);
-	res[11] = multiply(val[9],247) ^  multiply(val[10],247) ^  multiply(val[11],246);
+	int i;
+	uint8_t column;
+	BKSQ_INSTRUMENT_START(start);
+	for(i=0;i<12;i+=3){
+		column=gf_mul247(val[i]^val[i+1]^val[i+2]);
+		res[i]=val[i]^column;
+		res[i+1]=val[i+1]^column;
+		res[i+2]=val[i+2]^column;
+	}
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_THETA_INVERSE,start,1,12);
 }
+//The round constants multiply(1,exponent(2,t)) = gf_pow(2,t) for the rounds t=1,...,10 (index 0 is unused):
+static const uint8_t round_constant[11] = {0x00, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36, 0x6c};
 void round_key_evolution(uint8_t const *val,uint8_t *res,int t){
-	res[0]=val[0]^S_box_single(val[10])^multiply(1,exponent(2,t));
+	res[0]=val[0]^S_box_single(val[10])^round_constant[t];
 	res[1]=val[1]^S_box_single(val[11]);
 	res[2]=val[2]^S_box_single(val[9]);
 	
@@ -298,6 +807,243 @@ void complete_round(uint8_t const *plain,uint8_t const *round_key,uint8_t *res){
 	for(i=0;i<12;i++)
 		res[i]=res[i]^round_key[i];
 }
+//Theta of a round key, packed into column words: every byte of a column gets 2*(a^b^c) added since 3=1^2:
+void theta_key_words(uint8_t const *val, uint32_t *res){
+	int i;
+	uint8_t column;
+	for(i=0;i<4;i++){
+		column=xtime(val[3*i]^val[3*i+1]^val[3*i+2]);
+		res[i]=(uint32_t)(val[3*i]^column)|((uint32_t)(val[3*i+1]^column)<<8)|((uint32_t)(val[3*i+2]^column)<<16);
+	}
+}
+//The key schedule with the S-Box table, for all backends but the constant-time ones:
+uint8_t bksq_key_expand_table(uint8_t const *key, BKSQ_KEY_SCHEDULE *ks){
+	int i,t;
+	BKSQ_INSTRUMENT_START(start);
+	for(i=0;i<12;i++)
+		ks->round_key[0][i]=key[i];
+	//The round keys are timed together, one probe instead of ten around a function of a few dozen cycles:
+	BKSQ_INSTRUMENT_START(evolution);
+	for(t=1;t<11;t++)
+		round_key_evolution(ks->round_key[t-1],ks->round_key[t],t);
+	BKSQ_INSTRUMENT_STOP_CALLS(BKSQ_STAGE_ROUND_KEY_EVOLUTION,evolution,10,10,120);
+	for(t=0;t<10;t++)
+		theta_key_words(ks->round_key[t],ks->theta_round_key[t]);
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_KEY_EXPAND,start,1,12);
+	return BKSQ_ENCRYPT_OK;
+}
+/**
+ * Expands a key into all of its round keys, so that the key schedule runs once per key instead of once per block.
+ * Every backend gives the same schedule, so it stays valid across bksq_backend_select().
+ * @param key provides the 96 bit (12 byte) key
+ * @param ks receives the expanded key
+ * @returns whether operation was successful
+ */
+uint8_t bksq_key_expand(uint8_t const *key, BKSQ_KEY_SCHEDULE *ks){
+	return bksq_backend_current()->key_expand(key,ks);
+}
+//T-table round engine (compile with -DBKSQ_TTABLE to make the ttable backend the default).
+//The state is kept as four 32-bit words, one per column of three bytes (byte 3*w+k sits in bits 8*k..8*k+7 of word w).
+//Since theta(Permutation(S_box(y))) is linear in every single S-Box output, one round becomes twelve table lookups:
+//ttable[k][x] holds the column theta produces from the byte S(x) standing in row k of a column.
+#define TTABLE_FOOTPRINT (3*256*sizeof(uint32_t)) ///< size of the T-tables in bytes
+static const uint32_t ttable[3][256] = {
+	{
+		0xc6c6a5, 0xf8f884, 0xeeee99, 0xf6f68d, 0xffff0d, 0xd6d6bd, 0xdedeb1, 0x919154,
+		0x606050, 0x020203, 0xcecea9, 0x56567d, 0xe7e719, 0xb5b562, 0x4d4de6, 0xecec9a,
+		0x8f8f45, 0x1f1f9d, 0x898940, 0xfafa87, 0xefef15, 0xb2b2eb, 0x8e8ec9, 0xfbfb0b,
+		0x4141ec, 0xb3b367, 0x5f5ffd, 0x4545ea, 0x2323bf, 0x5353f7, 0xe4e496, 0x9b9b5b,
+		0x7575c2, 0xe1e11c, 0x3d3dae, 0x4c4c6a, 0x6c6c5a, 0x7e7e41, 0xf5f502, 0x83834f,
+		0x68685c, 0x5151f4, 0xd1d134, 0xf9f908, 0xe2e293, 0xabab73, 0x626253, 0x2a2a3f,
+		0x08080c, 0x959552, 0x464665, 0x9d9d5e, 0x303028, 0x3737a1, 0x0a0a0f, 0x2f2fb5,
+		0x0e0e09, 0x242436, 0x1b1b9b, 0xdfdf3d, 0xcdcd26, 0x4e4e69, 0x7f7fcd, 0xeaea9f,
+		0x12121b, 0x1d1d9e, 0x585874, 0x34342e, 0x36362d, 0xdcdcb2, 0xb4b4ee, 0x5b5bfb,
+		0xa4a4f6, 0x76764d, 0xb7b761, 0x7d7dce, 0x52527b, 0xdddd3e, 0x5e5e71, 0x131397,
+		0xa6a6f5, 0xb9b968, 0x000000, 0xc1c12c, 0x404060, 0xe3e31f, 0x7979c8, 0xb6b6ed,
+		0xd4d4be, 0x8d8d46, 0x6767d9, 0x72724b, 0x9494de, 0x9898d4, 0xb0b0e8, 0x85854a,
+		0xbbbb6b, 0xc5c52a, 0x4f4fe5, 0xeded16, 0x8686c5, 0x9a9ad7, 0x666655, 0x111194,
+		0x8a8acf, 0xe9e910, 0x040406, 0xfefe81, 0xa0a0f0, 0x787844, 0x2525ba, 0x4b4be3,
+		0xa2a2f3, 0x5d5dfe, 0x8080c0, 0x05058a, 0x3f3fad, 0x2121bc, 0x707048, 0xf1f104,
+		0x6363df, 0x7777c1, 0xafaf75, 0x424263, 0x202030, 0xe5e51a, 0xfdfd0e, 0xbfbf6d,
+		0x81814c, 0x181814, 0x262635, 0xc3c32f, 0xbebee1, 0x3535a2, 0x8888cc, 0x2e2e39,
+		0x939357, 0x5555f2, 0xfcfc82, 0x7a7a47, 0xc8c8ac, 0xbabae7, 0x32322b, 0xe6e695,
+		0xc0c0a0, 0x191998, 0x9e9ed1, 0xa3a37f, 0x444466, 0x54547e, 0x3b3bab, 0x0b0b83,
+		0x8c8cca, 0xc7c729, 0x6b6bd3, 0x28283c, 0xa7a779, 0xbcbce2, 0x16161d, 0xadad76,
+		0xdbdb3b, 0x646456, 0x74744e, 0x14141e, 0x9292db, 0x0c0c0a, 0x48486c, 0xb8b8e4,
+		0x9f9f5d, 0xbdbd6e, 0x4343ef, 0xc4c4a6, 0x3939a8, 0x3131a4, 0xd3d337, 0xf2f28b,
+		0xd5d532, 0x8b8b43, 0x6e6e59, 0xdadab7, 0x01018c, 0xb1b164, 0x9c9cd2, 0x4949e0,
+		0xd8d8b4, 0xacacfa, 0xf3f307, 0xcfcf25, 0xcacaaf, 0xf4f48e, 0x4747e9, 0x101018,
+		0x6f6fd5, 0xf0f088, 0x4a4a6f, 0x5c5c72, 0x383824, 0x5757f1, 0x7373c7, 0x979751,
+		0xcbcb23, 0xa1a17c, 0xe8e89c, 0x3e3e21, 0x9696dd, 0x6161dc, 0x0d0d86, 0x0f0f85,
+		0xe0e090, 0x7c7c42, 0x7171c4, 0xccccaa, 0x9090d8, 0x060605, 0xf7f701, 0x1c1c12,
+		0xc2c2a3, 0x6a6a5f, 0xaeaef9, 0x6969d0, 0x171791, 0x999958, 0x3a3a27, 0x2727b9,
+		0xd9d938, 0xebeb13, 0x2b2bb3, 0x222233, 0xd2d2bb, 0xa9a970, 0x070789, 0x3333a7,
+		0x2d2db6, 0x3c3c22, 0x151592, 0xc9c920, 0x878749, 0xaaaaff, 0x505078, 0xa5a57a,
+		0x03038f, 0x5959f8, 0x090980, 0x1a1a17, 0x6565da, 0xd7d731, 0x8484c6, 0xd0d0b8,
+		0x8282c3, 0x2929b0, 0x5a5a77, 0x1e1e11, 0x7b7bcb, 0xa8a8fc, 0x6d6dd6, 0x2c2c3a
+	},
+	{
+		0xc6a5c6, 0xf884f8, 0xee99ee, 0xf68df6, 0xff0dff, 0xd6bdd6, 0xdeb1de, 0x915491,
+		0x605060, 0x020302, 0xcea9ce, 0x567d56, 0xe719e7, 0xb562b5, 0x4de64d, 0xec9aec,
+		0x8f458f, 0x1f9d1f, 0x894089, 0xfa87fa, 0xef15ef, 0xb2ebb2, 0x8ec98e, 0xfb0bfb,
+		0x41ec41, 0xb367b3, 0x5ffd5f, 0x45ea45, 0x23bf23, 0x53f753, 0xe496e4, 0x9b5b9b,
+		0x75c275, 0xe11ce1, 0x3dae3d, 0x4c6a4c, 0x6c5a6c, 0x7e417e, 0xf502f5, 0x834f83,
+		0x685c68, 0x51f451, 0xd134d1, 0xf908f9, 0xe293e2, 0xab73ab, 0x625362, 0x2a3f2a,
+		0x080c08, 0x955295, 0x466546, 0x9d5e9d, 0x302830, 0x37a137, 0x0a0f0a, 0x2fb52f,
+		0x0e090e, 0x243624, 0x1b9b1b, 0xdf3ddf, 0xcd26cd, 0x4e694e, 0x7fcd7f, 0xea9fea,
+		0x121b12, 0x1d9e1d, 0x587458, 0x342e34, 0x362d36, 0xdcb2dc, 0xb4eeb4, 0x5bfb5b,
+		0xa4f6a4, 0x764d76, 0xb761b7, 0x7dce7d, 0x527b52, 0xdd3edd, 0x5e715e, 0x139713,
+		0xa6f5a6, 0xb968b9, 0x000000, 0xc12cc1, 0x406040, 0xe31fe3, 0x79c879, 0xb6edb6,
+		0xd4bed4, 0x8d468d, 0x67d967, 0x724b72, 0x94de94, 0x98d498, 0xb0e8b0, 0x854a85,
+		0xbb6bbb, 0xc52ac5, 0x4fe54f, 0xed16ed, 0x86c586, 0x9ad79a, 0x665566, 0x119411,
+		0x8acf8a, 0xe910e9, 0x040604, 0xfe81fe, 0xa0f0a0, 0x784478, 0x25ba25, 0x4be34b,
+		0xa2f3a2, 0x5dfe5d, 0x80c080, 0x058a05, 0x3fad3f, 0x21bc21, 0x704870, 0xf104f1,
+		0x63df63, 0x77c177, 0xaf75af, 0x426342, 0x203020, 0xe51ae5, 0xfd0efd, 0xbf6dbf,
+		0x814c81, 0x181418, 0x263526, 0xc32fc3, 0xbee1be, 0x35a235, 0x88cc88, 0x2e392e,
+		0x935793, 0x55f255, 0xfc82fc, 0x7a477a, 0xc8acc8, 0xbae7ba, 0x322b32, 0xe695e6,
+		0xc0a0c0, 0x199819, 0x9ed19e, 0xa37fa3, 0x446644, 0x547e54, 0x3bab3b, 0x0b830b,
+		0x8cca8c, 0xc729c7, 0x6bd36b, 0x283c28, 0xa779a7, 0xbce2bc, 0x161d16, 0xad76ad,
+		0xdb3bdb, 0x645664, 0x744e74, 0x141e14, 0x92db92, 0x0c0a0c, 0x486c48, 0xb8e4b8,
+		0x9f5d9f, 0xbd6ebd, 0x43ef43, 0xc4a6c4, 0x39a839, 0x31a431, 0xd337d3, 0xf28bf2,
+		0xd532d5, 0x8b438b, 0x6e596e, 0xdab7da, 0x018c01, 0xb164b1, 0x9cd29c, 0x49e049,
+		0xd8b4d8, 0xacfaac, 0xf307f3, 0xcf25cf, 0xcaafca, 0xf48ef4, 0x47e947, 0x101810,
+		0x6fd56f, 0xf088f0, 0x4a6f4a, 0x5c725c, 0x382438, 0x57f157, 0x73c773, 0x975197,
+		0xcb23cb, 0xa17ca1, 0xe89ce8, 0x3e213e, 0x96dd96, 0x61dc61, 0x0d860d, 0x0f850f,
+		0xe090e0, 0x7c427c, 0x71c471, 0xccaacc, 0x90d890, 0x060506, 0xf701f7, 0x1c121c,
+		0xc2a3c2, 0x6a5f6a, 0xaef9ae, 0x69d069, 0x179117, 0x995899, 0x3a273a, 0x27b927,
+		0xd938d9, 0xeb13eb, 0x2bb32b, 0x223322, 0xd2bbd2, 0xa970a9, 0x078907, 0x33a733,
+		0x2db62d, 0x3c223c, 0x159215, 0xc920c9, 0x874987, 0xaaffaa, 0x507850, 0xa57aa5,
+		0x038f03, 0x59f859, 0x098009, 0x1a171a, 0x65da65, 0xd731d7, 0x84c684, 0xd0b8d0,
+		0x82c382, 0x29b029, 0x5a775a, 0x1e111e, 0x7bcb7b, 0xa8fca8, 0x6dd66d, 0x2c3a2c
+	},
+	{
+		0xa5c6c6, 0x84f8f8, 0x99eeee, 0x8df6f6, 0x0dffff, 0xbdd6d6, 0xb1dede, 0x549191,
+		0x506060, 0x030202, 0xa9cece, 0x7d5656, 0x19e7e7, 0x62b5b5, 0xe64d4d, 0x9aecec,
+		0x458f8f, 0x9d1f1f, 0x408989, 0x87fafa, 0x15efef, 0xebb2b2, 0xc98e8e, 0x0bfbfb,
+		0xec4141, 0x67b3b3, 0xfd5f5f, 0xea4545, 0xbf2323, 0xf75353, 0x96e4e4, 0x5b9b9b,
+		0xc27575, 0x1ce1e1, 0xae3d3d, 0x6a4c4c, 0x5a6c6c, 0x417e7e, 0x02f5f5, 0x4f8383,
+		0x5c6868, 0xf45151, 0x34d1d1, 0x08f9f9, 0x93e2e2, 0x73abab, 0x536262, 0x3f2a2a,
+		0x0c0808, 0x529595, 0x654646, 0x5e9d9d, 0x283030, 0xa13737, 0x0f0a0a, 0xb52f2f,
+		0x090e0e, 0x362424, 0x9b1b1b, 0x3ddfdf, 0x26cdcd, 0x694e4e, 0xcd7f7f, 0x9feaea,
+		0x1b1212, 0x9e1d1d, 0x745858, 0x2e3434, 0x2d3636, 0xb2dcdc, 0xeeb4b4, 0xfb5b5b,
+		0xf6a4a4, 0x4d7676, 0x61b7b7, 0xce7d7d, 0x7b5252, 0x3edddd, 0x715e5e, 0x971313,
+		0xf5a6a6, 0x68b9b9, 0x000000, 0x2cc1c1, 0x604040, 0x1fe3e3, 0xc87979, 0xedb6b6,
+		0xbed4d4, 0x468d8d, 0xd96767, 0x4b7272, 0xde9494, 0xd49898, 0xe8b0b0, 0x4a8585,
+		0x6bbbbb, 0x2ac5c5, 0xe54f4f, 0x16eded, 0xc58686, 0xd79a9a, 0x556666, 0x941111,
+		0xcf8a8a, 0x10e9e9, 0x060404, 0x81fefe, 0xf0a0a0, 0x447878, 0xba2525, 0xe34b4b,
+		0xf3a2a2, 0xfe5d5d, 0xc08080, 0x8a0505, 0xad3f3f, 0xbc2121, 0x487070, 0x04f1f1,
+		0xdf6363, 0xc17777, 0x75afaf, 0x634242, 0x302020, 0x1ae5e5, 0x0efdfd, 0x6dbfbf,
+		0x4c8181, 0x141818, 0x352626, 0x2fc3c3, 0xe1bebe, 0xa23535, 0xcc8888, 0x392e2e,
+		0x579393, 0xf25555, 0x82fcfc, 0x477a7a, 0xacc8c8, 0xe7baba, 0x2b3232, 0x95e6e6,
+		0xa0c0c0, 0x981919, 0xd19e9e, 0x7fa3a3, 0x664444, 0x7e5454, 0xab3b3b, 0x830b0b,
+		0xca8c8c, 0x29c7c7, 0xd36b6b, 0x3c2828, 0x79a7a7, 0xe2bcbc, 0x1d1616, 0x76adad,
+		0x3bdbdb, 0x566464, 0x4e7474, 0x1e1414, 0xdb9292, 0x0a0c0c, 0x6c4848, 0xe4b8b8,
+		0x5d9f9f, 0x6ebdbd, 0xef4343, 0xa6c4c4, 0xa83939, 0xa43131, 0x37d3d3, 0x8bf2f2,
+		0x32d5d5, 0x438b8b, 0x596e6e, 0xb7dada, 0x8c0101, 0x64b1b1, 0xd29c9c, 0xe04949,
+		0xb4d8d8, 0xfaacac, 0x07f3f3, 0x25cfcf, 0xafcaca, 0x8ef4f4, 0xe94747, 0x181010,
+		0xd56f6f, 0x88f0f0, 0x6f4a4a, 0x725c5c, 0x243838, 0xf15757, 0xc77373, 0x519797,
+		0x23cbcb, 0x7ca1a1, 0x9ce8e8, 0x213e3e, 0xdd9696, 0xdc6161, 0x860d0d, 0x850f0f,
+		0x90e0e0, 0x427c7c, 0xc47171, 0xaacccc, 0xd89090, 0x050606, 0x01f7f7, 0x121c1c,
+		0xa3c2c2, 0x5f6a6a, 0xf9aeae, 0xd06969, 0x911717, 0x589999, 0x273a3a, 0xb92727,
+		0x38d9d9, 0x13ebeb, 0xb32b2b, 0x332222, 0xbbd2d2, 0x70a9a9, 0x890707, 0xa73333,
+		0xb62d2d, 0x223c3c, 0x921515, 0x20c9c9, 0x498787, 0xffaaaa, 0x785050, 0x7aa5a5,
+		0x8f0303, 0xf85959, 0x800909, 0x171a1a, 0xda6565, 0x31d7d7, 0xc68484, 0xb8d0d0,
+		0xc38282, 0xb02929, 0x775a5a, 0x111e1e, 0xcb7b7b, 0xfca8a8, 0xd66d6d, 0x3a2c2c
+	}
+};
+//Returns the memory footprint of the T-tables in bytes (to judge the L1 pressure of the T-table engine):
+size_t ttable_footprint(void){
+	return TTABLE_FOOTPRINT;
+}
+//Checks the T-tables against theta and the S-Box. Returns 0 if the tables are consistent:
+int ttable_check(void){
+	int i,k;
+	uint8_t column[3];
+	for(i=0;i<256;i++){
+		for(k=0;k<3;k++){
+			column[0]=multiply(S_box_single_reference((uint8_t)i),k==0?3:2);
+			column[1]=multiply(S_box_single_reference((uint8_t)i),k==1?3:2);
+			column[2]=multiply(S_box_single_reference((uint8_t)i),k==2?3:2);
+			if(ttable[k][i]!=((uint32_t)column[0]|((uint32_t)column[1]<<8)|((uint32_t)column[2]<<16)))
+				return 1;
+		}
+	}
+	return 0;
+}
+//Packs a 12 byte block into four column words and back:
+void ttable_pack(uint8_t const *val, uint32_t *res){
+	int i;
+	for(i=0;i<4;i++)
+		res[i]=(uint32_t)val[3*i]|((uint32_t)val[3*i+1]<<8)|((uint32_t)val[3*i+2]<<16);
+}
+void ttable_unpack(uint32_t const *val, uint8_t *res){
+	int i;
+	for(i=0;i<4;i++){
+		res[3*i]=(uint8_t)val[i];
+		res[3*i+1]=(uint8_t)(val[i]>>8);
+		res[3*i+2]=(uint8_t)(val[i]>>16);
+	}
+}
+#define TTABLE_BYTE(w,i) ((uint8_t)((w)[(i)/3]>>(8*((i)%3)))) ///< byte i of a packed state
+//Fused round: res = theta(Permutation(S_box(val))) ^ round_key, with the Permutation folded into the byte selection:
+void ttable_round(uint32_t const *val, uint32_t const *round_key, uint32_t *res){
+	res[0]=ttable[0][TTABLE_BYTE(val,0)]^ttable[1][TTABLE_BYTE(val,10)]^ttable[2][TTABLE_BYTE(val,8)]^round_key[0];
+	res[1]=ttable[0][TTABLE_BYTE(val,3)]^ttable[1][TTABLE_BYTE(val,1)]^ttable[2][TTABLE_BYTE(val,11)]^round_key[1];
+	res[2]=ttable[0][TTABLE_BYTE(val,6)]^ttable[1][TTABLE_BYTE(val,4)]^ttable[2][TTABLE_BYTE(val,2)]^round_key[2];
+	res[3]=ttable[0][TTABLE_BYTE(val,9)]^ttable[1][TTABLE_BYTE(val,7)]^ttable[2][TTABLE_BYTE(val,5)]^round_key[3];
+}
+//Last round: res = Permutation(S_box(val)) ^ round_key, i.e. without the theta of the following round:
+void ttable_final_round(uint32_t const *val, uint8_t const *round_key, uint8_t *res){
+	res[0]=sbox_table[TTABLE_BYTE(val,0)]^round_key[0];
+	res[1]=sbox_table[TTABLE_BYTE(val,10)]^round_key[1];
+	res[2]=sbox_table[TTABLE_BYTE(val,8)]^round_key[2];
+	res[3]=sbox_table[TTABLE_BYTE(val,3)]^round_key[3];
+	res[4]=sbox_table[TTABLE_BYTE(val,1)]^round_key[4];
+	res[5]=sbox_table[TTABLE_BYTE(val,11)]^round_key[5];
+	res[6]=sbox_table[TTABLE_BYTE(val,6)]^round_key[6];
+	res[7]=sbox_table[TTABLE_BYTE(val,4)]^round_key[7];
+	res[8]=sbox_table[TTABLE_BYTE(val,2)]^round_key[8];
+	res[9]=sbox_table[TTABLE_BYTE(val,9)]^round_key[9];
+	res[10]=sbox_table[TTABLE_BYTE(val,7)]^round_key[10];
+	res[11]=sbox_table[TTABLE_BYTE(val,5)]^round_key[11];
+}
+//Fused first step: theta(theta_inverse(plain) ^ key) == plain ^ theta(key), so the whitening needs no theta_inverse at all:
+void ttable_first_step(uint8_t const *plain, uint32_t const *theta_key, uint32_t *res){
+	ttable_pack(plain,res);
+	res[0]^=theta_key[0];
+	res[1]^=theta_key[1];
+	res[2]^=theta_key[2];
+	res[3]^=theta_key[3];
+}
+/** Encrypts a single block with the T-table engine. Produces the same output as the reference rounds of bksq_encrypt.
+ * 
+ * @param plain points to a 96 bit (12 byte) input-to-be-encrypted
+ * @param cyphertext points to a 96 bit (12 byte) array to receive the output
+ * @param ks the expanded key, see bksq_key_expand()
+ * @returns whether operation was successful
+ */
+uint8_t bksq_encrypt_expanded_ttable(uint8_t const * plain, uint8_t * cyphertext, BKSQ_KEY_SCHEDULE const * ks) {
+	uint32_t state[4];
+	uint32_t next_state[4];
+	int t;
+	//Theta inverse and key whitening (0th round), already moved through the theta of the 1st round:
+	ttable_first_step(plain,ks->theta_round_key[0],state);
+	//1st to 9th round, two rounds per iteration; the round key enters through theta as well:
+	for(t=1;t<9;t+=2){
+		ttable_round(state,ks->theta_round_key[t],next_state);
+		ttable_round(next_state,ks->theta_round_key[t+1],state);
+	}
+	ttable_round(state,ks->theta_round_key[9],next_state);
+	//10th round without a following theta:
+	ttable_final_round(next_state,ks->round_key[10],cyphertext);
+	return BKSQ_ENCRYPT_OK;
+}
+//T-table engine with an unexpanded key:
+uint8_t bksq_encrypt_ttable(uint8_t const * plain, uint8_t * cyphertext, uint8_t const * key) {
+	BKSQ_KEY_SCHEDULE ks;
+	bksq_key_expand(key,&ks);
+	return bksq_encrypt_expanded_ttable(plain,cyphertext,&ks);
+}
 //The purpose of this function is to implement the counter operation:
 void counter(uint8_t nonce_counter[12]){
 	if(nonce_counter[11]<255)
@@ -334,149 +1080,1801 @@ void counter(uint8_t nonce_counter[12]){
     
 
 
-/** The |bksq_encrypt| ist the main method to encrypt a single block of data with the BKSQ algorithm. 
- * Note that we only support 96 bit (12 byte) keys.
+/** Encrypts a single block with an expanded key round by round, as in the specification; the reference backend.
  * 
  * @param plain points to a 96 bit (12 byte) input-to-be-encrypted
  * @param cyphertext points to a 96 bit (12 byte) array to receive the output
- * @param key provides the 96 bit (12 byte) key for encryption
+ * @param ks the expanded key
  * @returns whether operation was successful
  */
-uint8_t bksq_encrypt(uint8_t const * plain, uint8_t * cyphertext, uint8_t const * key) {
-
-    // TODO: put your code for BKSQ-Encryption here.
-    
+uint8_t bksq_encrypt_expanded_reference(uint8_t const * plain, uint8_t * cyphertext, BKSQ_KEY_SCHEDULE const * ks) {
     uint8_t temp[12];
-    uint8_t temp1_key[12];
-    uint8_t temp2_key[12];
+    int i;
+    int t;
     //Theta inverse linear transformation:
     theta_inverse(plain,temp);
-    int i;
     //Key whitening (0th round):
     for(i=0;i<12;i++)
-    	temp[i]=temp[i]^key[i];
-    //1st round key evolution and round:	
-    round_key_evolution(key,temp1_key,1);
-    complete_round(temp,temp1_key,cyphertext);
-    //2nd round key evolution and round:
-    round_key_evolution(temp1_key,temp2_key,2);
-    complete_round(cyphertext,temp2_key,temp);
-    //3rd round key evolution and round:
-    round_key_evolution(temp2_key,temp1_key,3);
-    complete_round(temp,temp1_key,cyphertext);
-    //4th round key evolution and round:
-    round_key_evolution(temp1_key,temp2_key,4);
-    complete_round(cyphertext,temp2_key,temp);
-    //5th round key evolution and round:
-    round_key_evolution(temp2_key,temp1_key,5);
-    complete_round(temp,temp1_key,cyphertext);
-    //6th round key evolution and round:
-    round_key_evolution(temp1_key,temp2_key,6);
-    complete_round(cyphertext,temp2_key,temp);
-    //7th round key evolution and round:
-    round_key_evolution(temp2_key,temp1_key,7);
-    complete_round(temp,temp1_key,cyphertext);
-    //8th round key evolution and round:
-    round_key_evolution(temp1_key,temp2_key,8);
-    complete_round(cyphertext,temp2_key,temp);
-    //9th round key evolution and round:
-    round_key_evolution(temp2_key,temp1_key,9);
-    complete_round(temp,temp1_key,cyphertext);
-    //10th round key evolution and round:
-    round_key_evolution(temp1_key,temp2_key,10);
-    complete_round(cyphertext,temp2_key,temp);
+    	temp[i]=temp[i]^ks->round_key[0][i];
+    //1st to 10th round, two rounds per iteration so that the result ends up in temp:
+    for(t=1;t<11;t+=2){
+    	complete_round(temp,ks->round_key[t],cyphertext);
+    	complete_round(cyphertext,ks->round_key[t+1],temp);
+    }
     //Updating the cyphertext array:
     for(i=0;i<12;i++)
     	cyphertext[i]=temp[i];
-    
 
     return BKSQ_ENCRYPT_OK;
 }
 
+/** Encrypts a single block with an expanded key, see bksq_key_expand(), with the current backend.
+ * 
+ * @param plain points to a 96 bit (12 byte) input-to-be-encrypted
+ * @param cyphertext points to a 96 bit (12 byte) array to receive the output
+ * @param ks the expanded key
+ * @returns whether operation was successful
+ */
+uint8_t bksq_encrypt_expanded(uint8_t const * plain, uint8_t * cyphertext, BKSQ_KEY_SCHEDULE const * ks) {
+    BKSQ_BACKEND const *backend = bksq_backend_current();
+    uint8_t ret;
+    BKSQ_INSTRUMENT_START(start);
+    ret = backend->encrypt(plain, cyphertext, ks);
+    BKSQ_INSTRUMENT_STOP_KERNEL(backend, start, 1);
+    return ret;
+}
 
-   
+/** The |bksq_encrypt| ist the main method to encrypt a single block of data with the BKSQ algorithm. 
+ * Note that we only support 96 bit (12 byte) keys.
+ * 
+ * @param plain points to a 96 bit (12 byte) input-to-be-encrypted
+ * @param cyphertext points to a 96 bit (12 byte) array to receive the output
+ * @param key provides the 96 bit (12 byte) key for encryption
+ * @returns whether operation was successful
+ */
+uint8_t bksq_encrypt(uint8_t const * plain, uint8_t * cyphertext, uint8_t const * key) {
 
+    // TODO: put your code for BKSQ-Encryption here.
+    
+    BKSQ_KEY_SCHEDULE ks;
+    bksq_key_expand(key,&ks);
+    return bksq_encrypt_expanded(plain,cyphertext,&ks);
+}
 
 
-/**
- * Encrypts/Decrypts data in counter mode. The structure |ctx| holds the relevant data.
- * Note that operation happens \e in place, so input data is overwritten by output!
- * @param ctx The encryption/decryption context.
- * @return Returns 0, if encryption/decryption was successful
- */
-uint8_t ctr(CONTEXT const ctx) {
-    // sanity checks
-    if ((ctx.data_length % BLOCKSIZE) != 0) return INVALID_DATA_LENGTH;
-    if (ctx.nonce_length != (BLOCKSIZE / 2)) return INVALID_NONCE_LENGTH;
-    
-    
-    /*typedef struct {
-    uint8_t *data; ///< a pointer to the input data
-    uint32_t data_length; ///< length of the input data in bits; must be a multiple of the blocklength
-    uint8_t const *key; ///< a pointer to the key
-    uint8_t const *nonce; ///< a pointer to the nonce to be used for encryption/decryption
-    uint8_t nonce_length; ///< the length of the nonce in bits
-} CONTEXT;*/
+   
 
-    // TODO: put your code for Counter-Mode here
-    int n=ctx.data_length/(8*12);
-    int i;
-    int j;
-    uint8_t temp1[12];
-    uint8_t temp2[12];
-    uint8_t nonce_counter[12];
-    for(i=0;i<6;i++)
-    	nonce_counter[i]=ctx.nonce[i];
-    for(i=6;i<12;i++)
-    	nonce_counter[i]=0;
-    for(i=0;i<n;i++){
-    	for(j=0;j<12;j++){
-    		temp1[j]=ctx.data[12*i+j];
-		}
-		bksq_encrypt(nonce_counter,temp2,ctx.key);
-		for(j=0;j<12;j++){
-			ctx.data[12*i+j]=temp2[j]^temp1[j];
+
+
+/*
+	Bitsliced kernel: BITSLICE_LANES blocks are encrypted at once and in constant time.
+	Bit k of byte i of all blocks is stored in one word, slice[8*i+k], where bit l of the word belongs to block l.
+	There are no table lookups and no branches on the blocks: the S-Box is the 113 gate circuit of Boyar and Peralta
+	(the S-Box is the one of the AES: inversion in the same field, same affine mapping), theta with xtime is a linear
+	map on the slices, and the Permutation is a mere renaming of the slices. The key schedule of the backend,
+	bksq_key_expand_table(), still uses the S-Box table, so only the blocks are processed in constant time, not the key.
+	A pass costs the same for one block as for BITSLICE_LANES, so the bitslice backend only takes it for full groups
+	of BITSLICE_LANES blocks and leaves single blocks, the rest of a batch and the Davies-Meyer lanes (DM_MANY_LANES
+	of them, each with its own key) to the T-table engine.
+*/
+//Transposes a 64x64 bit matrix in place, bit c of a[r] swaps with bit r of a[c]; six butterfly stages:
+void bitslice_transpose64(uint64_t a[64]){
+	uint64_t m=0x00000000FFFFFFFFull;
+	uint64_t t;
+	int j,k;
+	for(j=32;j!=0;j>>=1,m^=m<<j)
+		for(k=0;k<64;k=((k|j)+1)&~j){
+			t=((a[k]>>j)^a[k|j])&m;
+			a[k]^=t<<j;
+			a[k|j]^=t;
 		}
-		counter(nonce_counter);
+}
+//Transposes up to BITSLICE_LANES blocks into slices (unused lanes are zero): bytes 0 to 7 and bytes 8 to 11 of
+//every block as two 64x64 bit matrices, one row per block:
+void bitslice_pack(uint8_t const *in, int nblocks, uint64_t *slice){
+	uint64_t high[64];
+	int i,l;
+	for(l=0;l<64;l++){
+		slice[l]=0;
+		high[l]=0;
 	}
-	
-    return CTR_OK;
+	for(l=0;l<nblocks;l++){
+		for(i=0;i<8;i++)
+			slice[l]|=(uint64_t)in[12*l+i]<<(8*i);
+		for(i=0;i<4;i++)
+			high[l]|=(uint64_t)in[12*l+8+i]<<(8*i);
+	}
+	bitslice_transpose64(slice);
+	bitslice_transpose64(high);
+	for(i=0;i<32;i++)
+		slice[64+i]=high[i];
+}
+//Transposes slices back into blocks:
+void bitslice_unpack(uint64_t const *slice, int nblocks, uint8_t *out){
+	uint64_t low[64];
+	uint64_t high[64];
+	int i,l;
+	for(i=0;i<64;i++){
+		low[i]=slice[i];
+		high[i]=i<32 ? slice[64+i] : 0;
+	}
+	bitslice_transpose64(low);
+	bitslice_transpose64(high);
+	for(l=0;l<nblocks;l++){
+		for(i=0;i<8;i++)
+			out[12*l+i]=(uint8_t)(low[l]>>(8*i));
+		for(i=0;i<4;i++)
+			out[12*l+8+i]=(uint8_t)(high[l]>>(8*i));
+	}
+}
+//S-Box single on sliced bytes, the circuit of Boyar and Peralta: a linear top layer, the inversion in GF(2^8) over
+//GF(2^4) with 32 ANDs and a linear bottom layer, which includes the affine mapping. x0 is the most significant bit:
+void bitslice_S_box_single(uint64_t const *val, uint64_t *res){
+	uint64_t x0=val[7],x1=val[6],x2=val[5],x3=val[4],x4=val[3],x5=val[2],x6=val[1],x7=val[0];
+	uint64_t y1,y2,y3,y4,y5,y6,y7,y8,y9,y10,y11,y12,y13,y14,y15,y16,y17,y18,y19,y20,y21;
+	uint64_t t0,t1,t2,t3,t4,t5,t6,t7,t8,t9,t10,t11,t12,t13,t14,t15,t16,t17,t18,t19,t20,t21,t22,t23;
+	uint64_t t24,t25,t26,t27,t28,t29,t30,t31,t32,t33,t34,t35,t36,t37,t38,t39,t40,t41,t42,t43,t44,t45;
+	uint64_t t46,t47,t48,t49,t50,t51,t52,t53,t54,t55,t56,t57,t58,t59,t60,t61,t62,t63,t64,t65,t66,t67;
+	uint64_t z0,z1,z2,z3,z4,z5,z6,z7,z8,z9,z10,z11,z12,z13,z14,z15,z16,z17;
+	uint64_t s3;
+	//Top linear layer:
+	y14=x3^x5;
+	y13=x0^x6;
+	y9=x0^x3;
+	y8=x0^x5;
+	t0=x1^x2;
+	y1=t0^x7;
+	y4=y1^x3;
+	y12=y13^y14;
+	y2=y1^x0;
+	y5=y1^x6;
+	y3=y5^y8;
+	t1=x4^y12;
+	y15=t1^x5;
+	y20=t1^x1;
+	y6=y15^x7;
+	y10=y15^t0;
+	y11=y20^y9;
+	y7=x7^y11;
+	y17=y10^y11;
+	y19=y10^y8;
+	y16=t0^y11;
+	y21=y13^y16;
+	y18=x0^y16;
+	//Nonlinear middle layer, the inversion:
+	t2=y12&y15;
+	t3=y3&y6;
+	t4=t3^t2;
+	t5=y4&x7;
+	t6=t5^t2;
+	t7=y13&y16;
+	t8=y5&y1;
+	t9=t8^t7;
+	t10=y2&y7;
+	t11=t10^t7;
+	t12=y9&y11;
+	t13=y14&y17;
+	t14=t13^t12;
+	t15=y8&y10;
+	t16=t15^t12;
+	t17=t4^t14;
+	t18=t6^t16;
+	t19=t9^t14;
+	t20=t11^t16;
+	t21=t17^y20;
+	t22=t18^y19;
+	t23=t19^y21;
+	t24=t20^y18;
+	t25=t21^t22;
+	t26=t21&t23;
+	t27=t24^t26;
+	t28=t25&t27;
+	t29=t28^t22;
+	t30=t23^t24;
+	t31=t22^t26;
+	t32=t31&t30;
+	t33=t32^t24;
+	t34=t23^t33;
+	t35=t27^t33;
+	t36=t24&t35;
+	t37=t36^t34;
+	t38=t27^t36;
+	t39=t29&t38;
+	t40=t25^t39;
+	t41=t40^t37;
+	t42=t29^t33;
+	t43=t29^t40;
+	t44=t33^t37;
+	t45=t42^t41;
+	z0=t44&y15;
+	z1=t37&y6;
+	z2=t33&x7;
+	z3=t43&y16;
+	z4=t40&y1;
+	z5=t29&y7;
+	z6=t42&y11;
+	z7=t45&y17;
+	z8=t41&y10;
+	z9=t44&y12;
+	z10=t37&y3;
+	z11=t33&y4;
+	z12=t43&y13;
+	z13=t40&y5;
+	z14=t29&y2;
+	z15=t42&y9;
+	z16=t45&y14;
+	z17=t41&y8;
+	//Bottom linear layer with the affine mapping, the constant 0x63 flips four outputs:
+	t46=z15^z16;
+	t47=z10^z11;
+	t48=z5^z13;
+	t49=z9^z10;
+	t50=z2^z12;
+	t51=z2^z5;
+	t52=z7^z8;
+	t53=z0^z3;
+	t54=z6^z7;
+	t55=z16^z17;
+	t56=z12^t48;
+	t57=t50^t53;
+	t58=z4^t46;
+	t59=z3^t54;
+	t60=t46^t57;
+	t61=z14^t57;
+	t62=t52^t58;
+	t63=t49^t58;
+	t64=z4^t59;
+	t65=t61^t62;
+	t66=z1^t63;
+	t67=t64^t65;
+	s3=t53^t66;
+	res[7]=t59^t63;
+	res[6]=t64^~s3;
+	res[5]=t55^~t67;
+	res[4]=s3;
+	res[3]=t51^t66;
+	res[2]=t47^t65;
+	res[1]=t56^~t62;
+	res[0]=t48^~t60;
+}
+//Theta on slices; with 3=1^2 every byte of a column gets 2*(a^b^c) added:
+void bitslice_theta(uint64_t const *val, uint64_t *res){
+	uint64_t s[8];
+	uint64_t d[8];
+	int c,i,k;
+	for(c=0;c<4;c++){
+		for(k=0;k<8;k++)
+			s[k]=val[24*c+k]^val[24*c+8+k]^val[24*c+16+k];
+		d[0]=s[7];
+		d[1]=s[0]^s[7];
+		d[2]=s[1];
+		d[3]=s[2]^s[7];
+		d[4]=s[3]^s[7];
+		d[5]=s[4];
+		d[6]=s[5];
+		d[7]=s[6];
+		for(i=0;i<3;i++)
+			for(k=0;k<8;k++)
+				res[24*c+8*i+k]=val[24*c+8*i+k]^d[k];
+	}
+}
+//The byte Permutation, S-Box and key addition on slices: res = Permutation(S_box(val)) ^ round_key:
+void bitslice_round_tail(uint64_t const *val, uint64_t const *round_key, uint64_t *res){
+	static const int permutation[12] = {0, 10, 8, 3, 1, 11, 6, 4, 2, 9, 7, 5};
+	int i;
+	for(i=0;i<12;i++)
+		bitslice_S_box_single(val+8*permutation[i],res+8*i);
+	for(i=0;i<96;i++)
+		res[i]^=round_key[i];
+}
+//The same 12 bytes in every lane:
+void bitslice_broadcast(uint8_t const *val, uint64_t *slice){
+	int i,k;
+	for(i=0;i<12;i++)
+		for(k=0;k<8;k++)
+			slice[8*i+k]=-(uint64_t)((val[i]>>k)&1);
+}
+//Encrypts the blocks in |state| in place, with the 11 round keys as slices:
+void bitslice_encrypt_slices(uint64_t *state, uint64_t const (*round_key)[96]){
+	uint64_t temp[96];
+	int i,t;
+	//Theta inverse and key whitening, moved through the theta of the 1st round (see ttable_first_step):
+	bitslice_theta(round_key[0],temp);
+	for(i=0;i<96;i++)
+		state[i]^=temp[i];
+	//1st to 9th round:
+	for(t=1;t<10;t++){
+		bitslice_round_tail(state,round_key[t],temp);
+		bitslice_theta(temp,state);
+	}
+	//10th round without the following theta:
+	bitslice_round_tail(state,round_key[10],temp);
+	memcpy(state,temp,sizeof(temp));
 }
-
 /**
- * hashes given data using the Davies-Meyer-construction
- * @param data a pointer to the data to be hashed
- * @param data_length The length of the data in bits
- * @param hash a pointer to an array for receiving the hash, must be of size |BLOCKSIZE_BYTE| bytes
- * @return Returns 0, if hashing successful
+ * Encrypts |nblocks| independent blocks under the same expanded key with the bitsliced kernel.
+ * The blocks are processed in groups of BITSLICE_LANES; the running time depends only on |nblocks|.
+ * @param in points to nblocks*12 bytes of input
+ * @param out points to nblocks*12 bytes receiving the output (may be the same as |in|)
+ * @param nblocks the number of blocks
+ * @param ks the expanded key, see bksq_key_expand()
+ * @returns whether operation was successful
  */
-uint8_t dmhash(uint8_t const *data, uint32_t const data_length, uint8_t * hash) {
-    // sanity checks
-    if ((data_length % BLOCKSIZE) != 0) return INVALID_DATA_LENGTH;
-    
-	// TODO: put your code for hashing here
-	int n=data_length/(8*12);
+uint8_t bksq_encrypt_blocks_bitslice(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	uint64_t round_key[11][96];
+	uint64_t state[96];
+	int t,lanes;
+	for(t=0;t<11;t++)
+		bitslice_broadcast(ks->round_key[t],round_key[t]);
+	while(nblocks>0){
+		lanes=nblocks<BITSLICE_LANES ? (int)nblocks : BITSLICE_LANES;
+		bitslice_pack(in,lanes,state);
+		bitslice_encrypt_slices(state,round_key);
+		bitslice_unpack(state,lanes,out);
+		in+=12*lanes;
+		out+=12*lanes;
+		nblocks-=lanes;
+	}
+	return BKSQ_ENCRYPT_OK;
+}
+#ifdef BKSQ_X86_SIMD
+/*
+	SIMD kernels: one block per 128 bit lane (bytes 12 to 15 are don't cares), several lanes in flight.
+	theta is x ^ 2*(a^b^c) per column, where the column sums come from two byte rotations and
+	the multiplication by 2 from two nibble lookups with pshufb. The S-Box inverts in GF(2^8) as a quadratic extension
+	of GF(2^4), where everything is a lookup of a nibble (Hamburg, vector permute AES): a byte is written as i*b+j*b^16
+	in a normal basis {b,b^16} with b+b^16=1 and i,j in GF(2^4), so that its inverse is (j*b+i*b^16)/N with the norm
+	N=n*(i+j)^2+i*j, n=b^17. With k=i+j and a=1/n, the nibbles
+		io = j+1/(1/i+a/k) = a*N/(k+a*i)    and    jo = i+1/(1/j+a/k) = a*N/(k+a*j)
+	take 5 lookups of 1/x and a/x in GF(2^4), and the inverse is linear in 1/io and 1/jo, so one lookup of each
+	gives the affine mapping of the inverse. An inverse of 0 is 0x80, which makes the following pshufb give 0.
+	The tables are the change of basis in (two lookups), 1/x, a/x and the two halves of the way out.
+	Since the S-Box works bytewise, the Permutation (one pshufb) is done first.
+*/
+#define SSSE3_WAY 4 ///< number of blocks the SSSE3 kernel keeps in flight
+#define AVX2_WAY 4 ///< number of 256 bit registers the AVX2 kernel keeps in flight, two blocks each
+static const uint8_t simd_xtime_low[16] = {0x00, 0x02, 0x04, 0x06, 0x08, 0x0a, 0x0c, 0x0e, 0x10, 0x12, 0x14, 0x16, 0x18, 0x1a, 0x1c, 0x1e};
+static const uint8_t simd_xtime_high[16] = {0x00, 0x20, 0x40, 0x60, 0x80, 0xa0, 0xc0, 0xe0, 0x1b, 0x3b, 0x5b, 0x7b, 0x9b, 0xbb, 0xdb, 0xfb};
+static const uint8_t simd_permutation[16] = {0, 10, 8, 3, 1, 11, 6, 4, 2, 9, 7, 5, 0x80, 0x80, 0x80, 0x80};
+static const uint8_t simd_rotate1[16] = {1, 2, 0, 4, 5, 3, 7, 8, 6, 10, 11, 9, 0x80, 0x80, 0x80, 0x80};
+static const uint8_t simd_rotate2[16] = {2, 0, 1, 5, 3, 4, 8, 6, 7, 11, 9, 10, 0x80, 0x80, 0x80, 0x80};
+static const uint8_t simd_sbox_in_low[16] = {0x00, 0x10, 0x56, 0x46, 0xbc, 0xac, 0xea, 0xfa, 0x9c, 0x8c, 0xca, 0xda, 0x20, 0x30, 0x76, 0x66};
+static const uint8_t simd_sbox_in_high[16] = {0x00, 0x47, 0x39, 0x7e, 0x07, 0x40, 0x3e, 0x79, 0xfe, 0xb9, 0xc7, 0x80, 0xf9, 0xbe, 0xc0, 0x87};
+static const uint8_t simd_sbox_inverse[16] = {0x80, 0x01, 0x08, 0x0d, 0x0f, 0x06, 0x05, 0x0e, 0x02, 0x0c, 0x0b, 0x0a, 0x09, 0x03, 0x07, 0x04};
+static const uint8_t simd_sbox_a_inverse[16] = {0x80, 0x0d, 0x05, 0x06, 0x0a, 0x02, 0x03, 0x07, 0x0c, 0x0b, 0x04, 0x09, 0x08, 0x01, 0x0f, 0x0e};
+static const uint8_t simd_sbox_out_i[16] = {0x00, 0x4b, 0x2a, 0xb5, 0xc2, 0xa3, 0x9f, 0x89, 0x77, 0xfe, 0x16, 0x5d, 0x61, 0x3c, 0xe8, 0xd4};
+static const uint8_t simd_sbox_out_j[16] = {0x00, 0x54, 0xb7, 0x01, 0xf2, 0x11, 0xb6, 0xa6, 0xf3, 0x55, 0x10, 0x44, 0xe3, 0xa7, 0x45, 0xe2};
+//Loads a 12 byte block into a 16 byte buffer with zero padding:
+void simd_load_block(uint8_t const *val, uint8_t *res){
 	int i;
-	int j;
-	uint8_t temp_key[12];
-	uint8_t temp_cipher[12];
-	//Initializing H0 as full of zeros:
 	for(i=0;i<12;i++)
-		hash[i]=0;
-	for(i=0;i<n;i++){
-		//Storing the key number i, i.e. the plaintext xi in a temporary variable:
-		for(j=0;j<12;j++){
-    		temp_key[j]=data[12*i+j];
+		res[i]=val[i];
+	for(i=12;i<16;i++)
+		res[i]=0;
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i ssse3_S_box(__m128i val){
+	__m128i mask=_mm_set1_epi8(0x0f);
+	__m128i inverse=_mm_loadu_si128((__m128i const *)simd_sbox_inverse);
+	__m128i t,i,j,k,ak,iak,jak;
+	//Change of basis, i in the high and k in the low nibble:
+	t=_mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)simd_sbox_in_low),_mm_and_si128(val,mask)),_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)simd_sbox_in_high),_mm_and_si128(_mm_srli_epi16(val,4),mask)));
+	i=_mm_and_si128(_mm_srli_epi16(t,4),mask);
+	k=_mm_and_si128(t,mask);
+	j=_mm_xor_si128(i,k);
+	//io and jo:
+	ak=_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)simd_sbox_a_inverse),k);
+	iak=_mm_xor_si128(_mm_shuffle_epi8(inverse,i),ak);
+	jak=_mm_xor_si128(_mm_shuffle_epi8(inverse,j),ak);
+	i=_mm_xor_si128(i,_mm_shuffle_epi8(inverse,jak));
+	j=_mm_xor_si128(j,_mm_shuffle_epi8(inverse,iak));
+	//The affine mapping of the inverse:
+	t=_mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)simd_sbox_out_i),j),_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)simd_sbox_out_j),i));
+	return _mm_xor_si128(t,_mm_set1_epi8(0x63));
+}
+__attribute__((target("ssse3")))
+static inline __m128i ssse3_theta(__m128i val){
+	__m128i mask=_mm_set1_epi8(0x0f);
+	__m128i sum=_mm_xor_si128(val,_mm_xor_si128(_mm_shuffle_epi8(val,_mm_loadu_si128((__m128i const *)simd_rotate1)),_mm_shuffle_epi8(val,_mm_loadu_si128((__m128i const *)simd_rotate2))));
+	__m128i low=_mm_and_si128(sum,mask);
+	__m128i high=_mm_and_si128(_mm_srli_epi16(sum,4),mask);
+	__m128i twice=_mm_xor_si128(_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)simd_xtime_low),low),_mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)simd_xtime_high),high));
+	return _mm_xor_si128(val,twice);
+}
+//SSSE3 kernel, SSSE3_WAY blocks per iteration:
+__attribute__((target("ssse3")))
+uint8_t bksq_encrypt_blocks_ssse3(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	uint8_t buffer[16*SSSE3_WAY];
+	uint8_t theta_key[12];
+	__m128i round_key[11];
+	__m128i state[SSSE3_WAY];
+	__m128i permutation=_mm_loadu_si128((__m128i const *)simd_permutation);
+	int l,t,lanes;
+	ttable_unpack(ks->theta_round_key[0],theta_key);
+	simd_load_block(theta_key,buffer);
+	round_key[0]=_mm_loadu_si128((__m128i const *)buffer);
+	for(t=1;t<11;t++){
+		simd_load_block(ks->round_key[t],buffer);
+		round_key[t]=_mm_loadu_si128((__m128i const *)buffer);
+	}
+	while(nblocks>0){
+		lanes=nblocks<SSSE3_WAY ? (int)nblocks : SSSE3_WAY;
+		for(l=0;l<SSSE3_WAY;l++){
+			simd_load_block(in+12*(l<lanes ? l : 0),buffer+16*l);
+			//Theta inverse and key whitening, moved through the theta of the 1st round (see ttable_first_step):
+			state[l]=_mm_xor_si128(_mm_loadu_si128((__m128i const *)(buffer+16*l)),round_key[0]);
 		}
-		//Storing the output in a temporary variable temp_cipher:
-		bksq_encrypt(hash,temp_cipher,temp_key);
-		//Basic bitwise XOR operation:
-		for(j=0;j<12;j++){
-			hash[j]=hash[j]^temp_cipher[j];
+		for(t=1;t<11;t++)
+			for(l=0;l<SSSE3_WAY;l++){
+				state[l]=_mm_xor_si128(ssse3_S_box(_mm_shuffle_epi8(state[l],permutation)),round_key[t]);
+				if(t<10)
+					state[l]=ssse3_theta(state[l]);
+			}
+		for(l=0;l<lanes;l++){
+			_mm_storeu_si128((__m128i *)buffer,state[l]);
+			memcpy(out+12*l,buffer,12);
 		}
+		in+=12*lanes;
+		out+=12*lanes;
+		nblocks-=lanes;
 	}
-
-    return DM_OK;
+	return BKSQ_ENCRYPT_OK;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_S_box(__m256i val){
+	__m256i mask=_mm256_set1_epi8(0x0f);
+	__m256i inverse=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_sbox_inverse));
+	__m256i t,i,j,k,ak,iak,jak;
+	//Change of basis, i in the high and k in the low nibble, then io and jo as in ssse3_S_box():
+	t=_mm256_xor_si256(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_sbox_in_low)),_mm256_and_si256(val,mask)),_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_sbox_in_high)),_mm256_and_si256(_mm256_srli_epi16(val,4),mask)));
+	i=_mm256_and_si256(_mm256_srli_epi16(t,4),mask);
+	k=_mm256_and_si256(t,mask);
+	j=_mm256_xor_si256(i,k);
+	ak=_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_sbox_a_inverse)),k);
+	iak=_mm256_xor_si256(_mm256_shuffle_epi8(inverse,i),ak);
+	jak=_mm256_xor_si256(_mm256_shuffle_epi8(inverse,j),ak);
+	i=_mm256_xor_si256(i,_mm256_shuffle_epi8(inverse,jak));
+	j=_mm256_xor_si256(j,_mm256_shuffle_epi8(inverse,iak));
+	t=_mm256_xor_si256(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_sbox_out_i)),j),_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_sbox_out_j)),i));
+	return _mm256_xor_si256(t,_mm256_set1_epi8(0x63));
+}
+__attribute__((target("avx2")))
+static inline __m256i avx2_theta(__m256i val){
+	__m256i mask=_mm256_set1_epi8(0x0f);
+	__m256i rotate1=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_rotate1));
+	__m256i rotate2=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_rotate2));
+	__m256i sum=_mm256_xor_si256(val,_mm256_xor_si256(_mm256_shuffle_epi8(val,rotate1),_mm256_shuffle_epi8(val,rotate2)));
+	__m256i low=_mm256_and_si256(sum,mask);
+	__m256i high=_mm256_and_si256(_mm256_srli_epi16(sum,4),mask);
+	__m256i twice=_mm256_xor_si256(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_xtime_low)),low),_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_xtime_high)),high));
+	return _mm256_xor_si256(val,twice);
+}
+//AVX2 kernel, 2*AVX2_WAY blocks per iteration (pshufb works within 128 bit lanes, so a block never crosses one):
+__attribute__((target("avx2")))
+uint8_t bksq_encrypt_blocks_avx2(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	uint8_t buffer[32*AVX2_WAY];
+	uint8_t theta_key[12];
+	__m256i round_key[11];
+	__m256i state[AVX2_WAY];
+	__m256i permutation=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_permutation));
+	int l,t,lanes;
+	ttable_unpack(ks->theta_round_key[0],theta_key);
+	simd_load_block(theta_key,buffer);
+	round_key[0]=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)buffer));
+	for(t=1;t<11;t++){
+		simd_load_block(ks->round_key[t],buffer);
+		round_key[t]=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)buffer));
+	}
+	while(nblocks>0){
+		lanes=nblocks<2*AVX2_WAY ? (int)nblocks : 2*AVX2_WAY;
+		for(l=0;l<2*AVX2_WAY;l++)
+			simd_load_block(in+12*(l<lanes ? l : 0),buffer+16*l);
+		for(l=0;l<AVX2_WAY;l++)
+			state[l]=_mm256_xor_si256(_mm256_loadu_si256((__m256i const *)(buffer+32*l)),round_key[0]);
+		for(t=1;t<11;t++)
+			for(l=0;l<AVX2_WAY;l++){
+				state[l]=_mm256_xor_si256(avx2_S_box(_mm256_shuffle_epi8(state[l],permutation)),round_key[t]);
+				if(t<10)
+					state[l]=avx2_theta(state[l]);
+			}
+		for(l=0;l<AVX2_WAY;l++)
+			_mm256_storeu_si256((__m256i *)(buffer+32*l),state[l]);
+		for(l=0;l<lanes;l++)
+			memcpy(out+12*l,buffer+16*l,12);
+		in+=12*lanes;
+		out+=12*lanes;
+		nblocks-=lanes;
+	}
+	return BKSQ_ENCRYPT_OK;
+}
+#endif
+//Picks the kernel of the current backend for |nblocks| blocks, see bksq_encrypt_blocks_expanded().
+//A single block (every step of dmhash() and hmac() through dm_compress_expanded()) goes to bksq_encrypt_expanded()
+//and does not pay the setup of the SIMD and bitsliced kernels, which costs ten times the block itself:
+uint8_t bksq_encrypt_blocks_kernel(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	BKSQ_BACKEND const *backend;
+	uint8_t ret;
+	if(nblocks==1)
+		return bksq_encrypt_expanded(in,out,ks);
+	backend=bksq_backend_current();
+	BKSQ_INSTRUMENT_START(start);
+	ret=backend->encrypt_blocks(in,out,nblocks,ks);
+	BKSQ_INSTRUMENT_STOP_KERNEL(backend,start,nblocks);
+	return ret;
+}
+/**
+ * Encrypts |nblocks| independent blocks under the same expanded key with the kernels of the current backend,
+ * see bksq_backend_select(). All kernels give the same result.
+ * @param in points to nblocks*12 bytes of input
+ * @param out points to nblocks*12 bytes receiving the output (may be the same as |in|)
+ * @param nblocks the number of blocks
+ * @param ks the expanded key, see bksq_key_expand()
+ * @returns whether operation was successful
+ */
+uint8_t bksq_encrypt_blocks_expanded(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	uint8_t ret;
+	BKSQ_INSTRUMENT_START(start);
+	ret=bksq_encrypt_blocks_kernel(in,out,nblocks,ks);
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_ENCRYPT_BLOCKS,start,nblocks,12*nblocks);
+	return ret;
+}
+/**
+ * Encrypts |nblocks| independent blocks under the same key.
+ * @param in points to nblocks*12 bytes of input
+ * @param out points to nblocks*12 bytes receiving the output (may be the same as |in|)
+ * @param nblocks the number of blocks
+ * @param key provides the 96 bit (12 byte) key for encryption
+ * @returns whether operation was successful
+ */
+uint8_t bksq_encrypt_blocks(uint8_t const *in, uint8_t *out, size_t nblocks, uint8_t const *key){
+	BKSQ_KEY_SCHEDULE ks;
+	bksq_key_expand(key,&ks);
+	return bksq_encrypt_blocks_expanded(in,out,nblocks,&ks);
+}
+
+//The purpose of this function is to add a number of blocks to the 48 bit counter in the last six bytes, like calling counter() that often:
+void counter_add(uint8_t nonce_counter[12], uint64_t blocks){
+	int i;
+	uint64_t sum=0;
+	for(i=6;i<12;i++)
+		sum=(sum<<8)|nonce_counter[i];
+	sum+=blocks;
+	for(i=11;i>=6;i--){
+		nonce_counter[i]=(uint8_t)sum;
+		sum>>=8;
+	}
+}
+
+//Worker thread of a BKSQ_THREAD_POOL: takes jobs until the pool shuts down:
+void *bksq_pool_worker(void *arg){
+	BKSQ_THREAD_POOL *pool=(BKSQ_THREAD_POOL *)arg;
+	int index;
+	pthread_mutex_lock(&pool->lock);
+	for(;;){
+		while(!pool->shutdown && pool->next_job>=pool->njobs)
+			pthread_cond_wait(&pool->work_ready,&pool->lock);
+		if(pool->shutdown)
+			break;
+		index=pool->next_job++;
+		pthread_mutex_unlock(&pool->lock);
+		pool->job(pool->job_arg,index);
+		pthread_mutex_lock(&pool->lock);
+		if(--pool->pending_jobs==0)
+			pthread_cond_signal(&pool->work_done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+/**
+ * Creates a pool of worker threads.
+ * @param pool the pool to be initialized
+ * @param nthreads the number of worker threads; the thread calling bksq_pool_run() works as well
+ * @return Returns 0, if all threads were started; bksq_pool_destroy() must be called in either case
+ */
+uint8_t bksq_pool_create(BKSQ_THREAD_POOL *pool, int nthreads){
+	int i;
+	pool->threads=NULL;
+	pool->nthreads=0;
+	pool->job=NULL;
+	pool->job_arg=NULL;
+	pool->njobs=0;
+	pool->next_job=0;
+	pool->pending_jobs=0;
+	pool->shutdown=0;
+	pthread_mutex_init(&pool->lock,NULL);
+	pthread_mutex_init(&pool->run_lock,NULL);
+	pthread_cond_init(&pool->work_ready,NULL);
+	pthread_cond_init(&pool->work_done,NULL);
+	if(nthreads<=0)
+		return 0;
+	pool->threads=(pthread_t *)malloc(nthreads*sizeof(pthread_t));
+	if(pool->threads==NULL)
+		return THREAD_ERROR;
+	for(i=0;i<nthreads;i++){
+		if(pthread_create(&pool->threads[i],NULL,bksq_pool_worker,pool)!=0)
+			return THREAD_ERROR;
+		pool->nthreads++;
+	}
+	return 0;
+}
+/**
+ * Stops and joins the worker threads of a pool and frees its resources.
+ * @param pool the pool created by bksq_pool_create()
+ */
+void bksq_pool_destroy(BKSQ_THREAD_POOL *pool){
+	int i;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown=1;
+	pthread_cond_broadcast(&pool->work_ready);
+	pthread_mutex_unlock(&pool->lock);
+	for(i=0;i<pool->nthreads;i++)
+		pthread_join(pool->threads[i],NULL);
+	free(pool->threads);
+	pool->threads=NULL;
+	pool->nthreads=0;
+	pthread_cond_destroy(&pool->work_done);
+	pthread_cond_destroy(&pool->work_ready);
+	pthread_mutex_destroy(&pool->run_lock);
+	pthread_mutex_destroy(&pool->lock);
+}
+/**
+ * Runs job(arg,0),...,job(arg,njobs-1) on the workers of the pool and the calling thread, and returns when all are done.
+ * @param pool the pool created by bksq_pool_create()
+ * @param job the job function
+ * @param arg the argument passed to every job
+ * @param njobs the number of jobs
+ */
+void bksq_pool_run(BKSQ_THREAD_POOL *pool, void (*job)(void *arg, int index), void *arg, int njobs){
+	int index;
+	if(njobs<=0)
+		return;
+	pthread_mutex_lock(&pool->run_lock);
+	pthread_mutex_lock(&pool->lock);
+	pool->job=job;
+	pool->job_arg=arg;
+	pool->njobs=njobs;
+	pool->next_job=0;
+	pool->pending_jobs=njobs;
+	pthread_cond_broadcast(&pool->work_ready);
+	//The calling thread takes jobs as well:
+	while(pool->next_job<pool->njobs){
+		index=pool->next_job++;
+		pthread_mutex_unlock(&pool->lock);
+		job(arg,index);
+		pthread_mutex_lock(&pool->lock);
+		pool->pending_jobs--;
+	}
+	while(pool->pending_jobs>0)
+		pthread_cond_wait(&pool->work_done,&pool->lock);
+	pool->njobs=0;
+	pool->next_job=0;
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->run_lock);
+}
+
+//Counter mode over |nblocks| whole blocks from |in| to |out| (which may be the same), starting with the counter block |nonce_counter| (which is advanced):
+void ctr_blocks_to(uint8_t const *in, uint8_t *out, size_t nblocks, uint8_t nonce_counter[12], BKSQ_KEY_SCHEDULE const *ks){
+	size_t i;
+	size_t j;
+	size_t lanes;
+	uint8_t keystream[12*MULTIBLOCK_BATCH];
+	BKSQ_INSTRUMENT_START(start);
+	//MULTIBLOCK_BATCH counter blocks at once through the multi-block API:
+	for(i=0;i<nblocks;i+=lanes){
+		lanes=(nblocks-i)<MULTIBLOCK_BATCH ? nblocks-i : MULTIBLOCK_BATCH;
+		for(j=0;j<lanes;j++){
+			memcpy(keystream+12*j,nonce_counter,12);
+			counter(nonce_counter);
+		}
+		bksq_encrypt_blocks_expanded(keystream,keystream,lanes,ks);
+		for(j=0;j<12*lanes;j++)
+			out[12*i+j]=in[12*i+j]^keystream[j];
+	}
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_CTR,start,nblocks,12*nblocks);
+}
+//Counter mode over |nblocks| whole blocks in place, see ctr_blocks_to():
+void ctr_blocks(uint8_t *data, size_t nblocks, uint8_t nonce_counter[12], BKSQ_KEY_SCHEDULE const *ks){
+	ctr_blocks_to(data,data,nblocks,nonce_counter,ks);
+}
+
+/**
+ * Counter mode with an expanded key; ctx.key is not used.
+ * Note that operation happens \e in place, so input data is overwritten by output!
+ * @param ctx The encryption/decryption context.
+ * @param ks the expanded key, see bksq_key_expand()
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ctr_expanded(CONTEXT const ctx, BKSQ_KEY_SCHEDULE const *ks) {
+    // sanity checks
+    if ((ctx.data_length % BLOCKSIZE) != 0) return INVALID_DATA_LENGTH;
+    if (ctx.nonce_length != (BLOCKSIZE / 2)) return INVALID_NONCE_LENGTH;
+    
+    
+    /*typedef struct {
+    uint8_t *data; ///< a pointer to the input data
+    uint32_t data_length; ///< length of the input data in bits; must be a multiple of the blocklength
+    uint8_t const *key; ///< a pointer to the key
+    uint8_t const *nonce; ///< a pointer to the nonce to be used for encryption/decryption
+    uint8_t nonce_length; ///< the length of the nonce in bits
+} CONTEXT;*/
+
+    // TODO: put your code for Counter-Mode here
+    int n=ctx.data_length/(8*12);
+    int i;
+    uint8_t nonce_counter[12];
+    for(i=0;i<6;i++)
+    	nonce_counter[i]=ctx.nonce[i];
+    for(i=6;i<12;i++)
+    	nonce_counter[i]=0;
+    ctr_blocks(ctx.data,n,nonce_counter,ks);
+	
+    return CTR_OK;
+}
+
+/**
+ * Encrypts/Decrypts data in counter mode. The structure |ctx| holds the relevant data.
+ * Note that operation happens \e in place, so input data is overwritten by output!
+ * @param ctx The encryption/decryption context.
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ctr(CONTEXT const ctx) {
+    BKSQ_KEY_SCHEDULE ks;
+    bksq_key_expand(ctx.key,&ks);
+    return ctr_expanded(ctx,&ks);
+}
+
+/**
+ * Moves a counter mode stream to an arbitrary byte position; costs at most one block encryption.
+ * @param stream the stream
+ * @param offset the byte position the next call of ctr_stream_update() starts at
+ * @return Returns 0, if successful
+ */
+uint8_t ctr_stream_seek(CTR_STREAM *stream, uint64_t const offset) {
+	int i;
+	for(i=0;i<6;i++)
+		stream->nonce_counter[i]=stream->nonce[i];
+	for(i=6;i<12;i++)
+		stream->nonce_counter[i]=0;
+	counter_add(stream->nonce_counter,offset/BLOCKSIZE_BYTE);
+	stream->keystream_used=BLOCKSIZE_BYTE;
+	if(offset%BLOCKSIZE_BYTE!=0){
+		bksq_encrypt_expanded(stream->nonce_counter,stream->keystream,&stream->ks);
+		counter(stream->nonce_counter);
+		stream->keystream_used=(uint8_t)(offset%BLOCKSIZE_BYTE);
+	}
+	return CTR_OK;
+}
+/**
+ * Starts a counter mode stream at position 0.
+ * @param stream the stream to be initialized
+ * @param key provides the 96 bit (12 byte) key
+ * @param nonce the nonce
+ * @param nonce_length the length of the nonce in bits
+ * @return Returns 0, if the stream was initialized
+ */
+uint8_t ctr_stream_init(CTR_STREAM *stream, uint8_t const *key, uint8_t const *nonce, uint8_t const nonce_length) {
+    if (nonce_length != (BLOCKSIZE / 2)) return INVALID_NONCE_LENGTH;
+
+    int i;
+    bksq_key_expand(key,&stream->ks);
+    for(i=0;i<6;i++)
+    	stream->nonce[i]=nonce[i];
+    return ctr_stream_seek(stream,0);
+}
+/**
+ * Encrypts/Decrypts the next |length| bytes of a counter mode stream; any length is allowed.
+ * Note that operation happens \e in place, so input data is overwritten by output!
+ * @param stream the stream
+ * @param data a pointer to the data
+ * @param length the length of the data in bytes
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ctr_stream_update(CTR_STREAM *stream, uint8_t *data, size_t length) {
+	size_t i;
+	size_t nblocks;
+	//Rest of the current keystream block:
+	while(length>0 && stream->keystream_used<BLOCKSIZE_BYTE){
+		*data++^=stream->keystream[stream->keystream_used++];
+		length--;
+	}
+	//Whole blocks:
+	nblocks=length/BLOCKSIZE_BYTE;
+	ctr_blocks(data,nblocks,stream->nonce_counter,&stream->ks);
+	data+=BLOCKSIZE_BYTE*nblocks;
+	length-=BLOCKSIZE_BYTE*nblocks;
+	//Beginning of a new keystream block:
+	if(length>0){
+		bksq_encrypt_expanded(stream->nonce_counter,stream->keystream,&stream->ks);
+		counter(stream->nonce_counter);
+		for(i=0;i<length;i++)
+			data[i]^=stream->keystream[i];
+		stream->keystream_used=(uint8_t)length;
+	}
+	return CTR_OK;
+}
+/**
+ * Ends a counter mode stream and wipes its key material.
+ * @param stream the stream
+ * @return Returns 0, if successful
+ */
+uint8_t ctr_stream_final(CTR_STREAM *stream) {
+	volatile uint8_t *p=(volatile uint8_t *)stream;
+	size_t i;
+	for(i=0;i<sizeof(CTR_STREAM);i++)
+		p[i]=0;
+	return CTR_OK;
+}
+/**
+ * Encrypts/Decrypts the next segments of a counter mode stream, as one ctr_stream_update() on their concatenation.
+ * Note that operation happens \e in place, in every segment!
+ * @param stream the stream
+ * @param iov the segments, each of any length
+ * @param iovcnt the number of segments
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ctr_stream_updatev(CTR_STREAM *stream, struct iovec const *iov, int const iovcnt) {
+	int i;
+	for(i=0;i<iovcnt;i++)
+		ctr_stream_update(stream,(uint8_t *)iov[i].iov_base,iov[i].iov_len);
+	return CTR_OK;
+}
+
+/**
+ * Encrypts/Decrypts scattered data in counter mode, without gathering it: the keystream continues across the
+ * segment boundaries, so the result is that of ctr() on the concatenation of the segments.
+ * Unlike ctr(), the total length does not have to be a multiple of the blocklength.
+ * Note that operation happens \e in place, in every segment!
+ * @param iov the segments, each of any length
+ * @param iovcnt the number of segments
+ * @param key provides the 96 bit (12 byte) key
+ * @param nonce the nonce
+ * @param nonce_length the length of the nonce in bits
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ctrv(struct iovec const *iov, int const iovcnt, uint8_t const *key, uint8_t const *nonce, uint8_t const nonce_length) {
+	CTR_STREAM stream;
+	uint8_t ret=ctr_stream_init(&stream,key,nonce,nonce_length);
+	if (ret != CTR_OK) return ret;
+	ctr_stream_updatev(&stream,iov,iovcnt);
+	return ctr_stream_final(&stream);
+}
+
+//One chunk of ctr_parallel(): its first counter block is computed directly from the chunk's position:
+typedef struct {
+    uint8_t const *in; ///< the whole input
+    uint8_t *data; ///< the whole output (the same as |in| for ctr_parallel())
+    size_t nblocks; ///< the number of blocks of the whole data
+    size_t chunk_blocks; ///< the number of blocks per chunk (the last chunk may be shorter)
+    uint8_t nonce_counter[12]; ///< the first counter block of the whole data
+    BKSQ_KEY_SCHEDULE const *ks; ///< the expanded key
+} CTR_PARALLEL_JOB;
+void ctr_parallel_job(void *arg, int index){
+	CTR_PARALLEL_JOB *job=(CTR_PARALLEL_JOB *)arg;
+	size_t first=(size_t)index*job->chunk_blocks;
+	size_t nblocks=job->nblocks-first<job->chunk_blocks ? job->nblocks-first : job->chunk_blocks;
+	uint8_t nonce_counter[12];
+	memcpy(nonce_counter,job->nonce_counter,12);
+	counter_add(nonce_counter,first);
+	ctr_blocks_to(job->in+12*first,job->data+12*first,nblocks,nonce_counter,job->ks);
+}
+/**
+ * Counter mode like ctr_expanded(), but the data is split into chunks that are encrypted by the threads of |pool|.
+ * The output is the same as that of ctr(). Messages shorter than two chunks of |min_chunk_length| stay on the calling thread.
+ * @param ctx The encryption/decryption context; ctx.key is not used
+ * @param ks the expanded key, see bksq_key_expand()
+ * @param pool the worker threads, see bksq_pool_create()
+ * @param min_chunk_length the minimum length of a chunk in bits
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ctr_parallel_expanded(CONTEXT const ctx, BKSQ_KEY_SCHEDULE const *ks, BKSQ_THREAD_POOL *pool, uint32_t const min_chunk_length) {
+    // sanity checks
+    if ((ctx.data_length % BLOCKSIZE) != 0) return INVALID_DATA_LENGTH;
+    if (ctx.nonce_length != (BLOCKSIZE / 2)) return INVALID_NONCE_LENGTH;
+
+    CTR_PARALLEL_JOB job;
+    size_t min_chunk_blocks=(min_chunk_length+BLOCKSIZE-1)/BLOCKSIZE;
+    size_t nchunks=(size_t)(pool->nthreads+1)*CHUNKS_PER_THREAD;
+    int i;
+    job.in=ctx.data;
+    job.data=ctx.data;
+    job.nblocks=ctx.data_length/BLOCKSIZE;
+    job.ks=ks;
+    if(min_chunk_blocks==0)
+    	min_chunk_blocks=1;
+    if(job.nblocks/min_chunk_blocks<nchunks)
+    	nchunks=job.nblocks/min_chunk_blocks;
+    if(nchunks<2)
+    	return ctr_expanded(ctx,ks);
+    job.chunk_blocks=(job.nblocks+nchunks-1)/nchunks;
+    for(i=0;i<6;i++)
+    	job.nonce_counter[i]=ctx.nonce[i];
+    for(i=6;i<12;i++)
+    	job.nonce_counter[i]=0;
+    bksq_pool_run(pool,ctr_parallel_job,&job,(int)((job.nblocks+job.chunk_blocks-1)/job.chunk_blocks));
+    return CTR_OK;
+}
+/**
+ * Counter mode on the threads of |pool|, see ctr_parallel_expanded().
+ * @param ctx The encryption/decryption context.
+ * @param pool the worker threads, see bksq_pool_create()
+ * @param min_chunk_length the minimum length of a chunk in bits
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ctr_parallel(CONTEXT const ctx, BKSQ_THREAD_POOL *pool, uint32_t const min_chunk_length) {
+    BKSQ_KEY_SCHEDULE ks;
+    bksq_key_expand(ctx.key,&ks);
+    return ctr_parallel_expanded(ctx,&ks,pool,min_chunk_length);
+}
+
+//One step of the Davies-Meyer-construction, H_i = E_{x_i}(H_{i-1}) ^ H_{i-1}, with the block x_i already expanded:
+void dm_compress_expanded(uint8_t *hash, BKSQ_KEY_SCHEDULE const *ks){
+	int j;
+	uint8_t temp_cipher[12];
+	bksq_encrypt_blocks_expanded(hash,temp_cipher,1,ks);
+	for(j=0;j<12;j++)
+		hash[j]=hash[j]^temp_cipher[j];
+}
+//One step of the Davies-Meyer-construction with the block x_i given as bytes:
+void dm_compress(uint8_t *hash, uint8_t const *block){
+	BKSQ_KEY_SCHEDULE ks;
+	bksq_key_expand(block,&ks);
+	dm_compress_expanded(hash,&ks);
+}
+
+/**
+ * Starts an incremental Davies-Meyer-hash with H0 full of zeros.
+ * @param ctx the hash state to be initialized
+ * @return Returns 0, if successful
+ */
+uint8_t dm_init(DM_CTX *ctx) {
+	int i;
+	for(i=0;i<12;i++)
+		ctx->hash[i]=0;
+	ctx->buffer_length=0;
+	return DM_OK;
+}
+/**
+ * Continues a Davies-Meyer-hash from a chaining value saved with dm_final() after whole blocks.
+ * @param ctx the hash state to be initialized
+ * @param hash the chaining value to continue from
+ * @return Returns 0, if successful
+ */
+uint8_t dm_init_chaining(DM_CTX *ctx, uint8_t const *hash) {
+	int i;
+	for(i=0;i<12;i++)
+		ctx->hash[i]=hash[i];
+	ctx->buffer_length=0;
+	return DM_OK;
+}
+/**
+ * Feeds the next |length| bytes into an incremental Davies-Meyer-hash; a partial block is kept until it is completed.
+ * @param ctx the hash state
+ * @param data a pointer to the data
+ * @param length the length of the data in bytes
+ * @return Returns 0, if successful
+ */
+uint8_t dm_update(DM_CTX *ctx, uint8_t const *data, size_t length) {
+	//Completing a buffered partial block:
+	if(ctx->buffer_length>0){
+		while(length>0 && ctx->buffer_length<12){
+			ctx->buffer[ctx->buffer_length++]=*data++;
+			length--;
+		}
+		if(ctx->buffer_length<12)
+			return DM_OK;
+		dm_compress(ctx->hash,ctx->buffer);
+		ctx->buffer_length=0;
+	}
+	//The plaintext x_i is the key of the i-th encryption, taken directly from the input:
+	for(;length>=12;length-=12){
+		dm_compress(ctx->hash,data);
+		data+=12;
+	}
+	while(length>0){
+		ctx->buffer[ctx->buffer_length++]=*data++;
+		length--;
+	}
+	return DM_OK;
+}
+/**
+ * Ends an incremental Davies-Meyer-hash.
+ * @param ctx the hash state
+ * @param hash a pointer to an array for receiving the hash, must be of size |BLOCKSIZE_BYTE| bytes
+ * @return Returns 0, if hashing successful; INVALID_DATA_LENGTH if the data did not end on a block boundary
+ */
+uint8_t dm_final(DM_CTX *ctx, uint8_t *hash) {
+	int i;
+	if (ctx->buffer_length != 0) return INVALID_DATA_LENGTH;
+	for(i=0;i<12;i++)
+		hash[i]=ctx->hash[i];
+	return DM_OK;
+}
+
+/**
+ * hashes given data using the Davies-Meyer-construction
+ * @param data a pointer to the data to be hashed
+ * @param data_length The length of the data in bits
+ * @param hash a pointer to an array for receiving the hash, must be of size |BLOCKSIZE_BYTE| bytes
+ * @return Returns 0, if hashing successful
+ */
+uint8_t dmhash(uint8_t const *data, uint32_t const data_length, uint8_t * hash) {
+    // sanity checks
+    if ((data_length % BLOCKSIZE) != 0) return INVALID_DATA_LENGTH;
+    
+	// TODO: put your code for hashing here
+	DM_CTX ctx;
+	uint8_t ret;
+	BKSQ_INSTRUMENT_START(start);
+	dm_init(&ctx);
+	dm_update(&ctx,data,data_length/8);
+	ret=dm_final(&ctx,hash);
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_DMHASH,start,data_length/BLOCKSIZE,data_length/8);
+	return ret;
+}
+
+/**
+ * Feeds the next segments into an incremental Davies-Meyer-hash, as one dm_update() on their concatenation.
+ * @param ctx the hash state
+ * @param iov the segments, each of any length
+ * @param iovcnt the number of segments
+ * @return Returns 0, if successful
+ */
+uint8_t dm_updatev(DM_CTX *ctx, struct iovec const *iov, int const iovcnt) {
+	int i;
+	for(i=0;i<iovcnt;i++)
+		dm_update(ctx,(uint8_t const *)iov[i].iov_base,iov[i].iov_len);
+	return DM_OK;
+}
+
+/**
+ * hashes scattered data like dmhash() on the concatenation of the segments, without gathering it:
+ * blocks that straddle a segment boundary are completed in the hash state.
+ * @param iov the segments, each of any length; the total length must be a multiple of the blocklength
+ * @param iovcnt the number of segments
+ * @param hash a pointer to an array for receiving the hash, must be of size |BLOCKSIZE_BYTE| bytes
+ * @return Returns 0, if hashing successful; INVALID_DATA_LENGTH if the data did not end on a block boundary
+ */
+uint8_t dmhashv(struct iovec const *iov, int const iovcnt, uint8_t *hash) {
+	DM_CTX ctx;
+	dm_init(&ctx);
+	dm_updatev(&ctx,iov,iovcnt);
+	return dm_final(&ctx,hash);
+}
+
+/*
+	Multi-buffer Davies-Meyer: DM_MANY_LANES messages advance in lock-step, one block each per step.
+	Since the message blocks are the keys, every lane has a key of its own, and the key schedule runs inside the
+	SIMD kernels, in step with the rounds: round_key_evolution is the prefix XOR of the columns, i.e. shifts by 3, 6
+	and 9 bytes, plus the S-Box of the bytes 10, 11 and 9 (and the round constant) spread to every column.
+	The hashes are kept in 16 byte slots; the bytes 12 to 15 are don't cares.
+*/
+static const uint8_t simd_key_select[16] = {10, 11, 9, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80};
+static const uint8_t simd_key_spread[16] = {0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0x80, 0x80, 0x80, 0x80};
+#ifdef BKSQ_X86_SIMD
+//One Davies-Meyer step of every lane with SSSE3:
+__attribute__((target("ssse3")))
+void dm_compress_lanes_ssse3(uint8_t hash[][16], uint8_t const * const blocks[]){
+	uint8_t buffer[16];
+	__m128i key[DM_MANY_LANES];
+	__m128i state[DM_MANY_LANES];
+	__m128i permutation=_mm_loadu_si128((__m128i const *)simd_permutation);
+	__m128i key_select=_mm_loadu_si128((__m128i const *)simd_key_select);
+	__m128i key_spread=_mm_loadu_si128((__m128i const *)simd_key_spread);
+	__m128i f;
+	int l,t;
+	for(l=0;l<DM_MANY_LANES;l++){
+		simd_load_block(blocks[l],buffer);
+		key[l]=_mm_loadu_si128((__m128i const *)buffer);
+		//Theta inverse and key whitening, moved through the theta of the 1st round (see ttable_first_step):
+		state[l]=_mm_xor_si128(_mm_loadu_si128((__m128i const *)hash[l]),ssse3_theta(key[l]));
+	}
+	for(t=1;t<11;t++)
+		for(l=0;l<DM_MANY_LANES;l++){
+			f=_mm_xor_si128(_mm_shuffle_epi8(ssse3_S_box(key[l]),key_select),_mm_cvtsi32_si128(round_constant[t]));
+			key[l]=_mm_xor_si128(_mm_xor_si128(key[l],_mm_slli_si128(key[l],3)),_mm_xor_si128(_mm_slli_si128(key[l],6),_mm_slli_si128(key[l],9)));
+			key[l]=_mm_xor_si128(key[l],_mm_shuffle_epi8(f,key_spread));
+			state[l]=_mm_xor_si128(ssse3_S_box(_mm_shuffle_epi8(state[l],permutation)),key[l]);
+			if(t<10)
+				state[l]=ssse3_theta(state[l]);
+		}
+	for(l=0;l<DM_MANY_LANES;l++)
+		_mm_storeu_si128((__m128i *)hash[l],_mm_xor_si128(_mm_loadu_si128((__m128i const *)hash[l]),state[l]));
+}
+//One Davies-Meyer step of every lane with AVX2, two lanes per register:
+__attribute__((target("avx2")))
+void dm_compress_lanes_avx2(uint8_t hash[][16], uint8_t const * const blocks[]){
+	uint8_t buffer[16*DM_MANY_LANES];
+	__m256i key[DM_MANY_LANES/2];
+	__m256i state[DM_MANY_LANES/2];
+	__m256i permutation=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_permutation));
+	__m256i key_select=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_key_select));
+	__m256i key_spread=_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *)simd_key_spread));
+	__m256i f;
+	int l,t;
+	for(l=0;l<DM_MANY_LANES;l++)
+		simd_load_block(blocks[l],buffer+16*l);
+	for(l=0;l<DM_MANY_LANES/2;l++){
+		key[l]=_mm256_loadu_si256((__m256i const *)(buffer+32*l));
+		state[l]=_mm256_xor_si256(_mm256_loadu_si256((__m256i const *)hash[2*l]),avx2_theta(key[l]));
+	}
+	for(t=1;t<11;t++)
+		for(l=0;l<DM_MANY_LANES/2;l++){
+			f=_mm256_xor_si256(_mm256_shuffle_epi8(avx2_S_box(key[l]),key_select),_mm256_set_epi64x(0,round_constant[t],0,round_constant[t]));
+			key[l]=_mm256_xor_si256(_mm256_xor_si256(key[l],_mm256_slli_si256(key[l],3)),_mm256_xor_si256(_mm256_slli_si256(key[l],6),_mm256_slli_si256(key[l],9)));
+			key[l]=_mm256_xor_si256(key[l],_mm256_shuffle_epi8(f,key_spread));
+			state[l]=_mm256_xor_si256(avx2_S_box(_mm256_shuffle_epi8(state[l],permutation)),key[l]);
+			if(t<10)
+				state[l]=avx2_theta(state[l]);
+		}
+	for(l=0;l<DM_MANY_LANES/2;l++)
+		_mm256_storeu_si256((__m256i *)hash[2*l],_mm256_xor_si256(_mm256_loadu_si256((__m256i const *)hash[2*l]),state[l]));
+}
+//The key schedule in constant time, with the S-Box of the SIMD kernels as in dm_compress_lanes_ssse3(); theta of the
+//round keys is arithmetic only:
+__attribute__((target("ssse3")))
+uint8_t bksq_key_expand_ssse3(uint8_t const *key, BKSQ_KEY_SCHEDULE *ks){
+	uint8_t buffer[16];
+	__m128i key_select=_mm_loadu_si128((__m128i const *)simd_key_select);
+	__m128i key_spread=_mm_loadu_si128((__m128i const *)simd_key_spread);
+	__m128i k,f;
+	int t;
+	BKSQ_INSTRUMENT_START(start);
+	simd_load_block(key,buffer);
+	memcpy(ks->round_key[0],buffer,12);
+	k=_mm_loadu_si128((__m128i const *)buffer);
+	BKSQ_INSTRUMENT_START(evolution);
+	for(t=1;t<11;t++){
+		f=_mm_xor_si128(_mm_shuffle_epi8(ssse3_S_box(k),key_select),_mm_cvtsi32_si128(round_constant[t]));
+		k=_mm_xor_si128(_mm_xor_si128(k,_mm_slli_si128(k,3)),_mm_xor_si128(_mm_slli_si128(k,6),_mm_slli_si128(k,9)));
+		k=_mm_xor_si128(k,_mm_shuffle_epi8(f,key_spread));
+		_mm_storeu_si128((__m128i *)buffer,k);
+		memcpy(ks->round_key[t],buffer,12);
+	}
+	BKSQ_INSTRUMENT_STOP_CALLS(BKSQ_STAGE_ROUND_KEY_EVOLUTION,evolution,10,10,120);
+	for(t=0;t<10;t++)
+		theta_key_words(ks->round_key[t],ks->theta_round_key[t]);
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_KEY_EXPAND,start,1,12);
+	return BKSQ_ENCRYPT_OK;
+}
+//A single block in constant time, one lane of the SSSE3 kernel (the AVX2 one would only fill half a register):
+__attribute__((target("ssse3")))
+uint8_t bksq_encrypt_expanded_ssse3(uint8_t const *plain, uint8_t *cyphertext, BKSQ_KEY_SCHEDULE const *ks){
+	uint8_t buffer[16];
+	uint8_t theta_key[12];
+	__m128i permutation=_mm_loadu_si128((__m128i const *)simd_permutation);
+	__m128i state,round_key;
+	int t;
+	ttable_unpack(ks->theta_round_key[0],theta_key);
+	simd_load_block(theta_key,buffer);
+	round_key=_mm_loadu_si128((__m128i const *)buffer);
+	simd_load_block(plain,buffer);
+	state=_mm_xor_si128(_mm_loadu_si128((__m128i const *)buffer),round_key);
+	for(t=1;t<11;t++){
+		simd_load_block(ks->round_key[t],buffer);
+		state=_mm_xor_si128(ssse3_S_box(_mm_shuffle_epi8(state,permutation)),_mm_loadu_si128((__m128i const *)buffer));
+		if(t<10)
+			state=ssse3_theta(state);
+	}
+	_mm_storeu_si128((__m128i *)buffer,state);
+	memcpy(cyphertext,buffer,12);
+	return BKSQ_ENCRYPT_OK;
+}
+#endif
+//One round of the key schedule on packed round keys, together with the theta of the round key: round_key_evolution
+//XORs f = (S(val[10])^rc, S(val[11]), S(val[9])) into the first column and then runs the prefix XOR of the columns.
+//Both are linear but for the S-Box, so theta of the round key evolves the same way with theta(f), which is what the
+//T-tables hold for the three S-Box bytes; theta of (rc,0,0) is (3rc,2rc,2rc):
+void ttable_key_step(uint32_t *key, uint32_t *theta_key, int t){
+	uint8_t b9=(uint8_t)key[3];
+	uint8_t b10=(uint8_t)(key[3]>>8);
+	uint8_t b11=(uint8_t)(key[3]>>16);
+	uint8_t rc=round_constant[t];
+	uint8_t rc2=xtime(rc);
+	key[0]^=(uint32_t)(sbox_table[b10]^rc)|((uint32_t)sbox_table[b11]<<8)|((uint32_t)sbox_table[b9]<<16);
+	key[1]^=key[0];
+	key[2]^=key[1];
+	key[3]^=key[2];
+	theta_key[0]^=ttable[0][b10]^ttable[1][b11]^ttable[2][b9]^(uint32_t)(rc^rc2)^((uint32_t)rc2<<8)^((uint32_t)rc2<<16);
+	theta_key[1]^=theta_key[0];
+	theta_key[2]^=theta_key[1];
+	theta_key[3]^=theta_key[2];
+}
+//One Davies-Meyer step of every lane without SIMD, with the T-table engine. As in the SIMD kernels, the lanes run
+//in lock-step and the key schedule runs in step with the rounds: every round evolves the packed round keys of all
+//lanes and then applies the round to all states, so the lookups of eight independent chains overlap instead of
+//waiting on each other, and no lane expands a whole BKSQ_KEY_SCHEDULE first:
+void dm_compress_lanes_scalar(uint8_t hash[][16], uint8_t const * const blocks[]){
+	uint32_t key[DM_MANY_LANES][4];
+	uint32_t theta_key[DM_MANY_LANES][4];
+	uint32_t state[2][DM_MANY_LANES][4];
+	uint8_t last_key[12];
+	uint8_t temp[12];
+	int j,l,t;
+	for(l=0;l<DM_MANY_LANES;l++){
+		ttable_pack(blocks[l],key[l]);
+		theta_key_words(blocks[l],theta_key[l]);
+		ttable_first_step(hash[l],theta_key[l],state[0][l]);
+	}
+	for(t=1;t<10;t++){
+		for(l=0;l<DM_MANY_LANES;l++)
+			ttable_key_step(key[l],theta_key[l],t);
+		for(l=0;l<DM_MANY_LANES;l++)
+			ttable_round(state[(t-1)&1][l],theta_key[l],state[t&1][l]);
+	}
+	for(l=0;l<DM_MANY_LANES;l++){
+		ttable_key_step(key[l],theta_key[l],10);
+		ttable_unpack(key[l],last_key);
+		ttable_final_round(state[1][l],last_key,temp);
+		for(j=0;j<12;j++)
+			hash[l][j]^=temp[j];
+	}
+}
+//One Davies-Meyer step of every lane with the reference cypher:
+void dm_compress_lanes_reference(uint8_t hash[][16], uint8_t const * const blocks[]){
+	BKSQ_KEY_SCHEDULE ks;
+	uint8_t temp[12];
+	int j,l;
+	for(l=0;l<DM_MANY_LANES;l++){
+		bksq_key_expand_table(blocks[l],&ks);
+		bksq_encrypt_expanded_reference(hash[l],temp,&ks);
+		for(j=0;j<12;j++)
+			hash[l][j]^=temp[j];
+	}
+}
+
+/*
+	Backend registry: every implementation of the cypher registers its kernels in bksq_backends[]. On first use,
+	bksq_backend_probe() asks the CPU (cpuid, through __builtin_cpu_supports) which backends it can run, checks each
+	of them against known answers (the test vectors of main.c for the cypher, the Davies-Meyer-hash and the HMAC)
+	and times its kernels. The fastest backend that passes becomes the current one, unless the environment variable
+	BKSQ_BACKEND names another one (-DBKSQ_TTABLE names ttable); bksq_backend_select() switches later.
+	The reference and the T-table backends look up the S-Box (and the T-tables) by the data, so their timing depends
+	on it through the caches. The single block kernel and the key schedule of ttable, bitslice, ssse3 and avx2 are the
+	table ones, which are ten times faster for one block than the setup of the SIMD and bitsliced kernels, so none of
+	them is constant-time either. ssse3-ct and avx2-ct run everything, the key schedule and single blocks included,
+	with the SIMD S-Box; they are picked only on request: with BKSQ_BACKEND_POLICY=ct in the environment or
+	bksq_backend_select_constant_time().
+*/
+//The reference cypher for every block:
+uint8_t bksq_encrypt_blocks_reference(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	uint8_t temp[12];
+	for(;nblocks>0;nblocks--){
+		bksq_encrypt_expanded_reference(in,temp,ks);
+		memcpy(out,temp,12);
+		in+=12;
+		out+=12;
+	}
+	return BKSQ_ENCRYPT_OK;
+}
+//The T-table engine for every block:
+uint8_t bksq_encrypt_blocks_ttable(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	uint8_t temp[12];
+	for(;nblocks>0;nblocks--){
+		bksq_encrypt_expanded_ttable(in,temp,ks);
+		memcpy(out,temp,12);
+		in+=12;
+		out+=12;
+	}
+	return BKSQ_ENCRYPT_OK;
+}
+//The bitsliced kernel for the full groups of BITSLICE_LANES blocks, the T-table engine for the rest:
+uint8_t bksq_encrypt_blocks_bitslice_ttable(uint8_t const *in, uint8_t *out, size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	size_t full=nblocks-nblocks%BITSLICE_LANES;
+	if(full>0)
+		bksq_encrypt_blocks_bitslice(in,out,full,ks);
+	return bksq_encrypt_blocks_ttable(in+12*full,out+12*full,nblocks-full,ks);
+}
+int bksq_backend_portable(void){
+	return 1;
+}
+#ifdef BKSQ_X86_SIMD
+int bksq_backend_has_ssse3(void){
+	return __builtin_cpu_supports("ssse3");
+}
+int bksq_backend_has_avx2(void){
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+static BKSQ_BACKEND bksq_backends[] = {
+	{"reference", bksq_key_expand_table, bksq_encrypt_expanded_reference, bksq_encrypt_blocks_reference, dm_compress_lanes_reference, bksq_backend_portable, 0, 0, 0.0},
+	{"ttable", bksq_key_expand_table, bksq_encrypt_expanded_ttable, bksq_encrypt_blocks_ttable, dm_compress_lanes_scalar, bksq_backend_portable, 0, 0, 0.0},
+	{"bitslice", bksq_key_expand_table, bksq_encrypt_expanded_ttable, bksq_encrypt_blocks_bitslice_ttable, dm_compress_lanes_scalar, bksq_backend_portable, 0, 0, 0.0},
+#ifdef BKSQ_X86_SIMD
+	{"ssse3", bksq_key_expand_table, bksq_encrypt_expanded_ttable, bksq_encrypt_blocks_ssse3, dm_compress_lanes_ssse3, bksq_backend_has_ssse3, 0, 0, 0.0},
+	{"avx2", bksq_key_expand_table, bksq_encrypt_expanded_ttable, bksq_encrypt_blocks_avx2, dm_compress_lanes_avx2, bksq_backend_has_avx2, 0, 0, 0.0},
+	{"ssse3-ct", bksq_key_expand_ssse3, bksq_encrypt_expanded_ssse3, bksq_encrypt_blocks_ssse3, dm_compress_lanes_ssse3, bksq_backend_has_ssse3, 1, 0, 0.0},
+	{"avx2-ct", bksq_key_expand_ssse3, bksq_encrypt_expanded_ssse3, bksq_encrypt_blocks_avx2, dm_compress_lanes_avx2, bksq_backend_has_avx2, 1, 0, 0.0},
+#endif
+};
+#define BKSQ_BACKENDS ((int)(sizeof(bksq_backends)/sizeof(bksq_backends[0]))) ///< number of registered backends
+#ifdef BKSQ_INSTRUMENT
+typedef char bksq_kernel_stages_fit[BKSQ_BACKENDS<=BKSQ_KERNEL_STAGES ? 1 : -1]; ///< every backend has its kernel stage
+#endif
+static BKSQ_BACKEND const *bksq_backend_active = NULL; ///< the current backend, NULL before the probe
+static BKSQ_BACKEND const *bksq_backend_preferred = NULL; ///< the default: the fastest backend, under BKSQ_BACKEND_POLICY=ct the fastest constant-time one
+static BKSQ_BACKEND const *bksq_backend_fastest_constant_time = NULL; ///< the fastest constant-time backend, NULL if none is usable
+static pthread_once_t bksq_backend_once = PTHREAD_ONCE_INIT;
+//Known answers, the test vectors of main.c:
+static const uint8_t backend_kat_key[12] = {0xFF, 0xFE, 0xFD, 0xFC, 0xFB, 0xFA, 0xF9, 0xF8, 0xF7, 0xF6, 0xF5, 0xF4};
+static const uint8_t backend_kat_plain[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t backend_kat_cypher[12] = {0x89, 0xf3, 0x73, 0x81, 0x95, 0x6f, 0xc5, 0xb5, 0xa7, 0xed, 0x1f, 0xa7};
+static const uint8_t backend_kat_message[144] = {0x56, 0x2b, 0x8b, 0x39, 0x18, 0xd0, 0x49, 0x03, 0xc5, 0x01, 0x76, 0x16, 0xe8, 0xd8, 0xa9, 0x96, 0x46, 0xa8, 0xeb, 0x4b, 0x38, 0x47, 0x5f, 0xda, 0x18, 0xaa, 0xc7, 0x82, 0x9c, 0x0a, 0x3f, 0xba, 0x53, 0x71, 0xe3, 0x33, 0x09, 0x8e, 0x6b, 0x3f, 0x6d, 0xe3, 0xa7, 0x06, 0xca, 0xa1, 0xd1, 0xf4, 0xdc, 0xe0, 0xbc, 0xe8, 0x8a, 0x83, 0x2f, 0x54, 0xe5, 0x3b, 0xce, 0x2c, 0x0a, 0x51, 0x39, 0xfb, 0x9e, 0x27, 0x4e, 0xdd, 0x3a, 0x23, 0xe6, 0x40, 0xc4, 0x1c, 0x2c, 0x49, 0x90, 0xdb, 0x86, 0x6b, 0xf5, 0x26, 0x52, 0xe9, 0x84, 0x35, 0xdb, 0x75, 0xb8, 0x02, 0x09, 0x5c, 0x30, 0x6b, 0xa8, 0xb9, 0x65, 0xde, 0xde, 0x9e, 0x06, 0x50, 0x2b, 0x95, 0xab, 0xb0, 0xfc, 0xbc, 0xf7, 0x32, 0x66, 0xdf, 0xf4, 0xd5, 0x8b, 0xe0, 0xfc, 0x5a, 0xd0, 0x2f, 0x0d, 0xda, 0x6e, 0xe5, 0x31, 0xaa, 0x34, 0xf3, 0x46, 0x99, 0x2d, 0xb4, 0x2a, 0x0b, 0x4e, 0x9c, 0xce, 0x5c, 0x37, 0x35, 0x52, 0x66, 0x8c, 0x39};
+static const uint8_t backend_kat_hash[12] = {0xb7, 0x41, 0x17, 0xd9, 0x98, 0xf8, 0xc7, 0xb9, 0xa9, 0xc5, 0x7c, 0x47};
+static const uint8_t backend_kat_hmac_key[12] = {0x6f, 0x68, 0x20, 0x73, 0x6f, 0x20, 0x73, 0x65, 0x63, 0x72, 0x65, 0x74};
+static const uint8_t backend_kat_mac[12] = {0x6f, 0x93, 0x2a, 0x40, 0xba, 0xdd, 0x79, 0xca, 0xf4, 0x1d, 0xb0, 0xb1};
+//Davies-Meyer steps over |nblocks| blocks with the single block kernel of |backend| only:
+void bksq_backend_dm(BKSQ_BACKEND const *backend, uint8_t *hash, uint8_t const *data, size_t nblocks){
+	BKSQ_KEY_SCHEDULE ks;
+	uint8_t temp[12];
+	int j;
+	for(;nblocks>0;nblocks--){
+		backend->key_expand(data,&ks);
+		backend->encrypt(hash,temp,&ks);
+		for(j=0;j<12;j++)
+			hash[j]^=temp[j];
+		data+=12;
+	}
+}
+//Checks the kernels of |backend| against the known answers; returns 1 if all of them are right.
+//The probe runs before there is a current backend, so everything goes through the kernels of |backend| directly:
+int bksq_backend_self_test(BKSQ_BACKEND const *backend){
+	BKSQ_KEY_SCHEDULE ks;
+	BKSQ_KEY_SCHEDULE table_ks;
+	uint8_t in[12*BACKEND_SELF_TEST_BLOCKS];
+	uint8_t out[12*BACKEND_SELF_TEST_BLOCKS];
+	uint8_t expected[DM_MANY_LANES][16];
+	uint8_t hash[DM_MANY_LANES][16];
+	uint8_t const *blocks[DM_MANY_LANES];
+	uint8_t pad[12];
+	int i,j,l;
+	//The key schedule, the same as the table one since schedules outlive a switch of the backend:
+	backend->key_expand(backend_kat_key,&ks);
+	bksq_key_expand_table(backend_kat_key,&table_ks);
+	if(memcmp(&ks,&table_ks,sizeof(ks))!=0)
+		return 0;
+	//The cypher, one block and many; block i of the many is the plaintext plus i in every byte:
+	backend->encrypt(backend_kat_plain,out,&ks);
+	if(memcmp(out,backend_kat_cypher,12)!=0)
+		return 0;
+	for(i=0;i<12*BACKEND_SELF_TEST_BLOCKS;i++)
+		in[i]=(uint8_t)(backend_kat_plain[i%12]+i/12);
+	backend->encrypt_blocks(in,out,BACKEND_SELF_TEST_BLOCKS,&ks);
+	for(i=0;i<BACKEND_SELF_TEST_BLOCKS;i++){
+		backend->encrypt(in+12*i,pad,&ks);
+		if(memcmp(out+12*i,pad,12)!=0)
+			return 0;
+	}
+	//The Davies-Meyer-hash, serial and in lanes; the odd lanes hash the blocks above, so that mixed up lanes show:
+	memset(hash,0,sizeof(hash));
+	bksq_backend_dm(backend,hash[0],backend_kat_message,12);
+	if(memcmp(hash[0],backend_kat_hash,12)!=0)
+		return 0;
+	memset(hash,0,sizeof(hash));
+	memset(expected,0,sizeof(expected));
+	for(l=1;l<DM_MANY_LANES;l+=2)
+		bksq_backend_dm(backend,expected[l],in+12*l,12);
+	for(i=0;i<12;i++){
+		for(l=0;l<DM_MANY_LANES;l++)
+			blocks[l]=(l%2==0 ? backend_kat_message : in+12*l)+12*i;
+		backend->dm_compress_lanes(hash,blocks);
+	}
+	for(l=0;l<DM_MANY_LANES;l++)
+		if(memcmp(hash[l],l%2==0 ? backend_kat_hash : expected[l],12)!=0)
+			return 0;
+	//The HMAC, inner hash over ipad^key and the message, outer hash over opad^key and the inner hash:
+	memset(hash,0,sizeof(hash));
+	for(j=0;j<12;j++)
+		pad[j]=54^backend_kat_hmac_key[j];
+	bksq_backend_dm(backend,hash[0],pad,1);
+	bksq_backend_dm(backend,hash[0],backend_kat_message,12);
+	for(j=0;j<12;j++)
+		pad[j]=92^backend_kat_hmac_key[j];
+	bksq_backend_dm(backend,hash[1],pad,1);
+	bksq_backend_dm(backend,hash[1],hash[0],1);
+	return memcmp(hash[1],backend_kat_mac,12)==0;
+}
+//Nanoseconds since |start|:
+uint64_t bksq_backend_elapsed_ns(struct timespec const *start){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (uint64_t)(now.tv_sec-start->tv_sec)*1000000000u+(uint64_t)now.tv_nsec-(uint64_t)start->tv_nsec;
+}
+//MB/s of |backend| on as many bytes with the multi-block kernel (counter mode) as with the single block kernel (the
+//hashes): BACKEND_CALIBRATION_BLOCKS blocks in one call, BACKEND_CALIBRATION_SINGLE blocks one by one, scaled up.
+//Every round is timed on its own and the fastest one counts, so that a preemption during the run does not demote a backend:
+double bksq_backend_calibrate(BKSQ_BACKEND const *backend){
+	BKSQ_KEY_SCHEDULE ks;
+	uint8_t buffer[12*BACKEND_CALIBRATION_BLOCKS];
+	struct timespec start,call;
+	uint64_t best_blocks=UINT64_MAX;
+	uint64_t best_single=UINT64_MAX;
+	uint64_t ns;
+	int i;
+	memset(buffer,0,sizeof(buffer));
+	backend->key_expand(backend_kat_key,&ks);
+	//One round untimed, to have the tables and the code in the caches:
+	backend->encrypt_blocks(buffer,buffer,BACKEND_CALIBRATION_BLOCKS,&ks);
+	backend->encrypt(buffer,buffer,&ks);
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	do{
+		clock_gettime(CLOCK_MONOTONIC,&call);
+		backend->encrypt_blocks(buffer,buffer,BACKEND_CALIBRATION_BLOCKS,&ks);
+		ns=bksq_backend_elapsed_ns(&call);
+		if(ns>0&&ns<best_blocks)
+			best_blocks=ns;
+		clock_gettime(CLOCK_MONOTONIC,&call);
+		for(i=0;i<BACKEND_CALIBRATION_SINGLE;i++)
+			backend->encrypt(buffer+12*i,buffer+12*i,&ks);
+		ns=bksq_backend_elapsed_ns(&call);
+		if(ns>0&&ns<best_single)
+			best_single=ns;
+	}while(bksq_backend_elapsed_ns(&start)<BACKEND_CALIBRATION_NS);
+	return 2*12.0*BACKEND_CALIBRATION_BLOCKS*1e3/(best_blocks+(double)best_single*BACKEND_CALIBRATION_BLOCKS/BACKEND_CALIBRATION_SINGLE);
+}
+//The usable backend called |name|, or NULL:
+BKSQ_BACKEND const *bksq_backend_find(char const *name){
+	int b;
+	for(b=0;b<BKSQ_BACKENDS;b++)
+		if(strcmp(bksq_backends[b].name,name)==0)
+			return bksq_backends[b].usable ? &bksq_backends[b] : NULL;
+	return NULL;
+}
+//Runs once, on the first use of a backend: probes, self-tests and calibrates all backends and picks one:
+void bksq_backend_probe(void){
+	BKSQ_BACKEND const *chosen=NULL;
+	char const *name=getenv("BKSQ_BACKEND");
+	char const *policy=getenv("BKSQ_BACKEND_POLICY");
+	int b;
+	//The reference backend is the specification; should even it fail, main.c reports it:
+	bksq_backend_preferred=&bksq_backends[0];
+	for(b=0;b<BKSQ_BACKENDS;b++){
+		bksq_backends[b].usable=bksq_backends[b].supported()&&bksq_backend_self_test(&bksq_backends[b]);
+		if(!bksq_backends[b].usable)
+			continue;
+		bksq_backends[b].throughput=bksq_backend_calibrate(&bksq_backends[b]);
+		if(bksq_backends[b].throughput>bksq_backend_preferred->throughput)
+			bksq_backend_preferred=&bksq_backends[b];
+		if(bksq_backends[b].constant_time&&(bksq_backend_fastest_constant_time==NULL||bksq_backends[b].throughput>bksq_backend_fastest_constant_time->throughput))
+			bksq_backend_fastest_constant_time=&bksq_backends[b];
+	}
+	//Constant time only on request; without a constant-time backend the fastest one stays:
+	if(policy!=NULL&&strcmp(policy,"ct")==0&&bksq_backend_fastest_constant_time!=NULL)
+		bksq_backend_preferred=bksq_backend_fastest_constant_time;
+#ifdef BKSQ_TTABLE
+	if(name==NULL)
+		name="ttable";
+#endif
+	if(name!=NULL)
+		chosen=bksq_backend_find(name);
+	__atomic_store_n(&bksq_backend_active,chosen!=NULL ? chosen : bksq_backend_preferred,__ATOMIC_RELEASE);
+}
+BKSQ_BACKEND const *bksq_backend_at(int index){
+	return index>=0 && index<BKSQ_BACKENDS ? &bksq_backends[index] : NULL;
+}
+int bksq_backend_index(BKSQ_BACKEND const *backend){
+	return (int)(backend-bksq_backends);
+}
+//The current backend, probed on the first call:
+BKSQ_BACKEND const *bksq_backend_current(void){
+	BKSQ_BACKEND const *backend=__atomic_load_n(&bksq_backend_active,__ATOMIC_ACQUIRE);
+	if(backend==NULL){
+		pthread_once(&bksq_backend_once,bksq_backend_probe);
+		backend=__atomic_load_n(&bksq_backend_active,__ATOMIC_ACQUIRE);
+	}
+	return backend;
+}
+/**
+ * Makes the backend |name| the current one for all threads, e.g. to compare backends or to rule one out.
+ * @param name "reference", "ttable", "bitslice", "ssse3", "avx2", "ssse3-ct" or "avx2-ct"; NULL for the default,
+ *        the fastest backend (the fastest constant-time one with BKSQ_BACKEND_POLICY=ct in the environment)
+ * @return Returns 0, if the backend is in use now; BACKEND_UNAVAILABLE if it is unknown, not supported by the CPU
+ *         or failed its self-test, then the current backend stays
+ */
+uint8_t bksq_backend_select(char const *name) {
+    BKSQ_BACKEND const *backend;
+    pthread_once(&bksq_backend_once, bksq_backend_probe);
+    backend = name == NULL ? bksq_backend_preferred : bksq_backend_find(name);
+    if (backend == NULL) return BACKEND_UNAVAILABLE;
+    __atomic_store_n(&bksq_backend_active, backend, __ATOMIC_RELEASE);
+    return BKSQ_ENCRYPT_OK;
+}
+/**
+ * Makes the fastest constant-time backend the current one for all threads, see bksq_backend_constant_time().
+ * @return Returns 0, if it is in use now; BACKEND_UNAVAILABLE if the CPU has none, then the current backend stays
+ */
+uint8_t bksq_backend_select_constant_time(void) {
+    pthread_once(&bksq_backend_once, bksq_backend_probe);
+    if (bksq_backend_fastest_constant_time == NULL) return BACKEND_UNAVAILABLE;
+    __atomic_store_n(&bksq_backend_active, bksq_backend_fastest_constant_time, __ATOMIC_RELEASE);
+    return BKSQ_ENCRYPT_OK;
+}
+/**
+ * @return the name of the current backend
+ */
+char const *bksq_backend_name(void) {
+    return bksq_backend_current()->name;
+}
+/**
+ * @return whether the current backend is constant-time, i.e. neither its kernels nor its key schedule index a table
+ *         by the blocks or the keys
+ */
+int bksq_backend_constant_time(void) {
+    return bksq_backend_current()->constant_time;
+}
+/**
+ * Prints every backend with its state (selected, ok, failed self-test or not supported by the CPU), whether it is
+ * constant-time and its throughput in the calibration run.
+ * @param f the file to print to, e.g. stdout
+ */
+void bksq_backend_report(FILE *f) {
+    BKSQ_BACKEND const *current = bksq_backend_current();
+    char const *state;
+    int b;
+    fprintf(f, "%-10s %-10s %-10s %12s\n", "backend", "state", "const-time", "MB/s");
+    for (b = 0; b < BKSQ_BACKENDS; b++) {
+        if (&bksq_backends[b] == current) state = "selected";
+        else if (bksq_backends[b].usable) state = "ok";
+        else if (bksq_backends[b].supported()) state = "failed";
+        else state = "no cpu";
+        if (bksq_backends[b].usable) fprintf(f, "%-10s %-10s %-10s %12.3f\n", bksq_backends[b].name, state, bksq_backends[b].constant_time ? "yes" : "no", bksq_backends[b].throughput);
+        else fprintf(f, "%-10s %-10s %-10s %12s\n", bksq_backends[b].name, state, bksq_backends[b].constant_time ? "yes" : "no", "-");
+    }
+}
+//One Davies-Meyer step of every lane, H = E_{blocks[l]}(H) ^ H, with the kernel of the current backend:
+void dm_compress_lanes(uint8_t hash[][16], uint8_t const * const blocks[]){
+	BKSQ_BACKEND const *backend=bksq_backend_current();
+	BKSQ_INSTRUMENT_START(start);
+	backend->dm_compress_lanes(hash,blocks);
+	BKSQ_INSTRUMENT_STOP_KERNEL(backend,start,DM_MANY_LANES);
+}
+
+/**
+ * Hashes |n| independent messages like dmhash(), DM_MANY_LANES of them at a time in lock-step, which hides the
+ * latency of the serial chain of each message. A lane whose message ends takes the next message right away.
+ * @param msgs the messages
+ * @param data_lengths the lengths of the messages in bits; each must be a multiple of the blocklength
+ * @param hashes receives the hash of every message
+ * @param n the number of messages
+ * @return Returns 0, if hashing successful; INVALID_DATA_LENGTH if a length is no multiple of the blocklength, then nothing is hashed
+ */
+uint8_t dmhash_many(uint8_t const * const msgs[], uint32_t const data_lengths[], uint8_t hashes[][12], size_t n) {
+	static const uint8_t idle_block[12] = {0};
+	uint8_t hash[DM_MANY_LANES][16];
+	uint8_t const *blocks[DM_MANY_LANES];
+	size_t message[DM_MANY_LANES];
+	uint32_t left[DM_MANY_LANES];
+	size_t next=0;
+	size_t i;
+	int active=0;
+	int l;
+	for(i=0;i<n;i++)
+		if ((data_lengths[i] % BLOCKSIZE) != 0) return INVALID_DATA_LENGTH;
+	memset(hash,0,sizeof(hash));
+	for(l=0;l<DM_MANY_LANES;l++){
+		left[l]=0;
+		blocks[l]=idle_block;
+	}
+	do{
+		//Lanes without a message take the next one; empty messages are done right away:
+		for(l=0;l<DM_MANY_LANES;l++){
+			while(left[l]==0 && next<n){
+				if(data_lengths[next]==0){
+					memset(hashes[next++],0,12);
+					continue;
+				}
+				message[l]=next;
+				blocks[l]=msgs[next];
+				left[l]=data_lengths[next++]/BLOCKSIZE;
+				memset(hash[l],0,16);
+				active++;
+			}
+		}
+		if(active==0)
+			break;
+		dm_compress_lanes(hash,blocks);
+		for(l=0;l<DM_MANY_LANES;l++){
+			if(left[l]==0)
+				continue;
+			blocks[l]+=12;
+			if(--left[l]==0){
+				memcpy(hashes[message[l]],hash[l],12);
+				blocks[l]=idle_block;
+				active--;
+			}
+		}
+	}while(active>0 || next<n);
+	return DM_OK;
+}
+
+//One job of dmhash_tree(): hashes the leaves index*leaves_per_job,... each from the chaining value after the leaf block:
+typedef struct {
+    uint8_t const *data; ///< the whole data
+    size_t length; ///< the length of the whole data in bytes
+    size_t leaf_length; ///< the length of a leaf in bytes (the last leaf may be shorter)
+    size_t nleaves; ///< the number of leaves
+    size_t leaves_per_job; ///< the number of leaves per job
+    uint8_t leaf_chaining[12]; ///< the chaining value after the block DM_TREE_LEAF
+    uint8_t (*digests)[12]; ///< receives the digests of the leaves
+} DM_TREE_JOB;
+void dm_tree_job(void *arg, int index){
+	DM_TREE_JOB *job=(DM_TREE_JOB *)arg;
+	size_t leaf=(size_t)index*job->leaves_per_job;
+	size_t end=leaf+job->leaves_per_job<job->nleaves ? leaf+job->leaves_per_job : job->nleaves;
+	size_t offset;
+	DM_CTX ctx;
+	for(;leaf<end;leaf++){
+		offset=leaf*job->leaf_length;
+		dm_init_chaining(&ctx,job->leaf_chaining);
+		dm_update(&ctx,job->data+offset,job->length-offset<job->leaf_length ? job->length-offset : job->leaf_length);
+		dm_final(&ctx,job->digests[leaf]);
+	}
+}
+//The chaining value after the single block {domain,0,...,0}:
+void dm_tree_chaining(uint8_t domain, uint8_t *hash){
+	uint8_t block[12]={0};
+	block[0]=domain;
+	memset(hash,0,12);
+	dm_compress(hash,block);
+}
+
+/**
+ * Hashes data as a tree, so that the leaves can be hashed in parallel: the data is split into leaves of |leaf_length| bytes,
+ * every leaf is hashed with the Davies-Meyer-construction behind a block starting with DM_TREE_LEAF, and every |fanout|
+ * digests of a level are hashed together behind a block starting with DM_TREE_NODE, up to the single root.
+ * The root is always an inner node, even for a single leaf. The digest depends on |leaf_length| and |fanout| and differs from dmhash().
+ * @param data a pointer to the data to be hashed
+ * @param length the length of the data in bytes; must be a multiple of the blocklength
+ * @param leaf_length the length of a leaf in bytes; must be a positive multiple of the blocklength
+ * @param fanout the number of children of an inner node, at least 2
+ * @param hash a pointer to an array for receiving the hash, must be of size |BLOCKSIZE_BYTE| bytes
+ * @param pool the worker threads hashing the leaves, see bksq_pool_create(); NULL to hash them on the calling thread
+ * @return Returns 0, if hashing successful; INVALID_DATA_LENGTH for bad lengths or fanout; OUT_OF_MEMORY
+ */
+uint8_t dmhash_tree(uint8_t const *data, size_t const length, size_t const leaf_length, int const fanout, uint8_t *hash, BKSQ_THREAD_POOL *pool) {
+    // sanity checks
+    if ((length % BLOCKSIZE_BYTE) != 0) return INVALID_DATA_LENGTH;
+    if (leaf_length == 0 || (leaf_length % BLOCKSIZE_BYTE) != 0 || fanout < 2) return INVALID_DATA_LENGTH;
+
+    DM_TREE_JOB job;
+    DM_CTX ctx;
+    uint8_t node_chaining[12];
+    size_t count;
+    size_t children;
+    size_t i;
+    size_t njobs;
+    job.data=data;
+    job.length=length;
+    job.leaf_length=leaf_length;
+    job.nleaves=length==0 ? 1 : (length+leaf_length-1)/leaf_length;
+    job.digests=(uint8_t (*)[12])malloc(job.nleaves*12);
+    if (job.digests == NULL) return OUT_OF_MEMORY;
+    dm_tree_chaining(DM_TREE_LEAF,job.leaf_chaining);
+    dm_tree_chaining(DM_TREE_NODE,node_chaining);
+
+    //The leaves, CHUNKS_PER_THREAD jobs per thread:
+    njobs=pool!=NULL ? (size_t)(pool->nthreads+1)*CHUNKS_PER_THREAD : 1;
+    if (njobs > job.nleaves) njobs=job.nleaves;
+    job.leaves_per_job=(job.nleaves+njobs-1)/njobs;
+    njobs=(job.nleaves+job.leaves_per_job-1)/job.leaves_per_job;
+    if (njobs > 1) bksq_pool_run(pool,dm_tree_job,&job,(int)njobs);
+    else dm_tree_job(&job,0);
+
+    //The inner nodes, level by level; node i overwrites the digest i, whose children are already hashed:
+    count=job.nleaves;
+    do {
+        for(i=0;i*fanout<count;i++){
+            children=count-i*fanout<(size_t)fanout ? count-i*fanout : (size_t)fanout;
+            dm_init_chaining(&ctx,node_chaining);
+            dm_update(&ctx,job.digests[i*fanout],12*children);
+            dm_final(&ctx,job.digests[i]);
+        }
+        count=i;
+    } while (count > 1);
+    memcpy(hash,job.digests[0],12);
+    free(job.digests);
+    return DM_OK;
+}
+
+/**
+ * Expands a HMAC key, i.e. hashes the blocks ipad^key and opad^key once per key.
+ * @param key the key to be used for computing HMAC
+ * @param key_length the length of the key in bits
+ * @param hks receives the expanded HMAC key
+ * @return Returns 0, if the expansion was successful
+ */
+uint8_t hmac_key_expand(uint8_t const *key, uint32_t const key_length, HMAC_KEY_SCHEDULE *hks) {
+	if (key_length != BLOCKSIZE) return INVALID_KEY_LENGTH; //Checking whether the key is of appropriate size.
+	
+	int i;
+	uint8_t pad[12];
+	DM_CTX ctx;
+	for(i=0;i<12;i++)
+		pad[i]=54^key[i];
+	dm_init(&ctx);
+	dm_update(&ctx,pad,12);
+	dm_final(&ctx,hks->inner_state);
+	for(i=0;i<12;i++)
+		pad[i]=92^key[i];
+	dm_init(&ctx);
+	dm_update(&ctx,pad,12);
+	dm_final(&ctx,hks->outer_state);
+	return HMAC_OK;
+}
+
+/**
+ * Starts an incremental HMAC; data fed with hmac_update() is hashed directly, without copies.
+ * @param ctx the HMAC state to be initialized
+ * @param hks the expanded key, see hmac_key_expand()
+ * @return Returns 0, if successful
+ */
+uint8_t hmac_init(HMAC_CTX *ctx, HMAC_KEY_SCHEDULE const *hks) {
+	int i;
+	dm_init_chaining(&ctx->inner,hks->inner_state);
+	for(i=0;i<12;i++)
+		ctx->outer_state[i]=hks->outer_state[i];
+	return HMAC_OK;
+}
+/**
+ * Feeds the next |length| bytes into an incremental HMAC.
+ * @param ctx the HMAC state
+ * @param data a pointer to the data
+ * @param length the length of the data in bytes
+ * @return Returns 0, if successful
+ */
+uint8_t hmac_update(HMAC_CTX *ctx, uint8_t const *data, size_t length) {
+	return dm_update(&ctx->inner,data,length);
+}
+/**
+ * Feeds the next segments into an incremental HMAC, as one hmac_update() on their concatenation.
+ * @param ctx the HMAC state
+ * @param iov the segments, each of any length
+ * @param iovcnt the number of segments
+ * @return Returns 0, if successful
+ */
+uint8_t hmac_updatev(HMAC_CTX *ctx, struct iovec const *iov, int const iovcnt) {
+	return dm_updatev(&ctx->inner,iov,iovcnt);
+}
+/**
+ * Ends an incremental HMAC: finishes the inner hash and runs the single remaining block of the outer hash.
+ * @param ctx the HMAC state
+ * @param tag a pointer to an array for receiving the MAC, must be of size |BLOCKSIZE_BYTE| bytes
+ * @return Returns 0, if MACing successful; INVALID_DATA_LENGTH if the data did not end on a block boundary
+ */
+uint8_t hmac_final(HMAC_CTX *ctx, uint8_t *tag) {
+	uint8_t inner_hash[12];
+	DM_CTX outer;
+	uint8_t ret=dm_final(&ctx->inner,inner_hash);
+	if (ret != DM_OK) return ret;
+	dm_init_chaining(&outer,ctx->outer_state);
+	dm_update(&outer,inner_hash,12);
+	return dm_final(&outer,tag);
+}
+
+/**
+ * computes a HMAC like hmac(), but with an expanded key
+ * @param data a pointer to the data to be hashed
+ * @param data_length the length of the data in bits
+ * @param hks the expanded key, see hmac_key_expand()
+ * @param tag a pointer to an array for receiving the MAC, must be of size |BLOCKSIZE_BYTE| bytes
+ * @param data_prefix either NULL or a pointer to a single block which is prepended to data
+ * @param data_prefix_length the length of |data_prefix| in bits, i.e. |BLOCKSIZE|; callers passing the prefix
+ *        together with the data in one buffer may pass |BLOCKSIZE|+|data_length| (only the first block is read)
+ * @return Returns 0, if MACing successful
+ */
+uint8_t hmac_expanded(uint8_t const *data, uint32_t const data_length, HMAC_KEY_SCHEDULE const *hks, uint8_t * tag, uint8_t const * data_prefix, uint32_t const data_prefix_length) {
+	HMAC_CTX ctx;
+	uint8_t ret;
+	if (data_prefix != NULL && data_prefix_length != BLOCKSIZE && data_prefix_length != BLOCKSIZE + data_length) return INVALID_DATA_LENGTH;
+	BKSQ_INSTRUMENT_START(start);
+	hmac_init(&ctx,hks);
+	if(data_prefix!=NULL)
+		hmac_update(&ctx,data_prefix,12);
+	hmac_update(&ctx,data,data_length/8);
+	ret=hmac_final(&ctx,tag);
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_HMAC,start,data_length/BLOCKSIZE,data_length/8);
+	return ret;
 }
 
 /**
@@ -492,46 +2890,94 @@ uint8_t hmac(uint8_t const *data, uint32_t const data_length, uint8_t const *key
     
 	// TODO: put your code for MACing here
 	
-	if (key_length != BLOCKSIZE) return INVALID_KEY_LENGTH; //Checking whether the key is of appropriate size.
-	
-	int n;
-	if(data_length>data_prefix_length)
-		n=data_length/8+12;
-	else
-		n=data_prefix_length/8+12;
-		
-	uint8_t first_input[n];
-	
-	int i;
-	
-	if(data_prefix==NULL){
-		n=data_length/8;
-		for(i=12;i<n+12;i++)
-			first_input[i]=data[i-12];
-	}
-	else{
-		n=data_prefix_length/8;
-		for(i=12;i<n+12;i++)
-			first_input[i]=data_prefix[i-12];
-	}
-	
-	uint8_t second_input[24];
-	uint8_t ipad[12];
-	uint8_t opad[12];
-	uint8_t temp[12];
-	for(i=0;i<12;i++){
-		ipad[i]=54;
-		opad[i]=92;
-	}
-	for(i=0;i<12;i++)
-		first_input[i]=ipad[i]^key[i];
-	dmhash(first_input,8*n+12*8,temp);
-	for(i=0;i<12;i++)
-		second_input[i]=opad[i]^key[i];
-	for(i=12;i<24;i++)
-		second_input[i]=temp[i-12];
-	dmhash(second_input,24*8,tag);	
-    return HMAC_OK;
+	HMAC_KEY_SCHEDULE hks;
+	uint8_t ret=hmac_key_expand(key,key_length,&hks);
+	if (ret != HMAC_OK) return ret;
+	return hmac_expanded(data,data_length,&hks,tag,data_prefix,data_prefix_length);
+}
+
+/**
+ * computes a HMAC like hmac() on the concatenation of the segments, without gathering them: any number of
+ * headers and fragments takes the place of the single |data_prefix| block of hmac().
+ * @param iov the segments, each of any length; the total length must be a multiple of the blocklength
+ * @param iovcnt the number of segments
+ * @param key the key to be used for computing HMAC
+ * @param key_length the length of the key in bits
+ * @param tag a pointer to an array for receiving the MAC, must be of size |BLOCKSIZE_BYTE| bytes
+ * @return Returns 0, if MACing successful; INVALID_DATA_LENGTH if the data did not end on a block boundary
+ */
+uint8_t hmacv(struct iovec const *iov, int const iovcnt, uint8_t const *key, uint32_t const key_length, uint8_t *tag) {
+	HMAC_KEY_SCHEDULE hks;
+	HMAC_CTX ctx;
+	uint8_t ret=hmac_key_expand(key,key_length,&hks);
+	if (ret != HMAC_OK) return ret;
+	hmac_init(&ctx,&hks);
+	hmac_updatev(&ctx,iov,iovcnt);
+	return hmac_final(&ctx,tag);
+}
+
+/**
+ * computes a HMAC over the tree digest of dmhash_tree(), so that the leaves are hashed in parallel:
+ * the tag is hmac() of the 12 byte root digest.
+ * @param data a pointer to the data
+ * @param length the length of the data in bytes, see dmhash_tree()
+ * @param leaf_length the length of a leaf in bytes, see dmhash_tree()
+ * @param fanout the number of children of an inner node, see dmhash_tree()
+ * @param key the key to be used for computing HMAC
+ * @param key_length the length of the key in bits
+ * @param tag a pointer to an array for receiving the MAC, must be of size |BLOCKSIZE_BYTE| bytes
+ * @param pool the worker threads, see bksq_pool_create(); may be NULL
+ * @return Returns 0, if MACing successful
+ */
+uint8_t hmac_tree(uint8_t const *data, size_t const length, size_t const leaf_length, int const fanout, uint8_t const *key, uint32_t const key_length, uint8_t *tag, BKSQ_THREAD_POOL *pool) {
+	HMAC_KEY_SCHEDULE hks;
+	uint8_t digest[12];
+	uint8_t ret=hmac_key_expand(key,key_length,&hks);
+	if (ret != HMAC_OK) return ret;
+	ret=dmhash_tree(data,length,leaf_length,fanout,digest,pool);
+	if (ret != DM_OK) return ret;
+	return hmac_expanded(digest,BLOCKSIZE,&hks,tag,NULL,0);
+}
+
+/**
+ * Encrypts data in an authenticated encryption mode, namely Encrypt-then-MAC (EtM)
+ * with Counter-Mode Encryption and HMAC
+ * The structure |ctx| holds the relevant data.
+ * Note that operation happens *in place*, so input data is overwritten by output!
+ * The data is passed over only once: each batch of blocks is encrypted and MACed right away, without temporaries.
+ * @param ctx The encryption context as with ctr(); ctx.key is not used
+ * @param ks the expanded encryption key, see bksq_key_expand()
+ * @param hks the expanded MAC key, see hmac_key_expand()
+ * @param tag a buffer to receive the authentication tag
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ae_enc_expanded(CONTEXT const ctx, BKSQ_KEY_SCHEDULE const *ks, HMAC_KEY_SCHEDULE const *hks, uint8_t *tag) {
+    // sanity checks
+    if ((ctx.data_length % BLOCKSIZE) != 0) return INVALID_DATA_LENGTH;
+    if (ctx.nonce_length != (BLOCKSIZE / 2)) return INVALID_NONCE_LENGTH;
+
+	size_t n=ctx.data_length/BLOCKSIZE;
+	size_t i;
+	size_t lanes;
+	uint8_t nonce_counter[12];
+	HMAC_CTX mac;
+	BKSQ_INSTRUMENT_START(start);
+    for(i=0;i<6;i++)
+    	nonce_counter[i]=ctx.nonce[i];
+    for(i=6;i<12;i++)
+    	nonce_counter[i]=0;
+    //MAC over the first counter block followed by the ciphertext:
+    hmac_init(&mac,hks);
+    hmac_update(&mac,nonce_counter,12);
+    //Single pass: every batch of ciphertext is MACed right after it is produced, while it is still in the cache:
+    for(i=0;i<n;i+=lanes){
+    	lanes=(n-i)<MULTIBLOCK_BATCH ? n-i : MULTIBLOCK_BATCH;
+    	ctr_blocks(ctx.data+12*i,lanes,nonce_counter,ks);
+    	hmac_update(&mac,ctx.data+12*i,12*lanes);
+    }
+    hmac_final(&mac,tag);
+    BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_AE_ENC,start,n,12*n);
+    return CTR_OK | HMAC_OK; 
 }
 
 /**
@@ -546,19 +2992,343 @@ uint8_t hmac(uint8_t const *data, uint32_t const data_length, uint8_t const *key
 uint8_t ae_enc(CONTEXT const ctx, uint8_t *tag) {
 
     // TODO: put your code for EtM here
-	ctr(ctx);
-	int n=ctx.data_length/8+12;
-	uint8_t temp[n];
+	BKSQ_KEY_SCHEDULE ks;
+	HMAC_KEY_SCHEDULE hks;
+	bksq_key_expand(ctx.key,&ks);
+	hmac_key_expand(ctx.key,BLOCKSIZE,&hks);
+	return ae_enc_expanded(ctx,&ks,&hks,tag);
+}
+
+//Compares two tags in constant time; returns 0 if they are equal:
+uint8_t tag_compare(uint8_t const *tag1, uint8_t const *tag2){
+	uint8_t diff=0;
+	int i;
+	for(i=0;i<12;i++)
+		diff|=tag1[i]^tag2[i];
+	return diff;
+}
+
+/**
+ * Decrypts data encrypted with ae_enc_expanded(). The tag is verified first, over the first counter block
+ * and the ciphertext as in ae_enc(); the counter mode runs only if it matches, so a forged message costs one MAC pass.
+ * Note that operation happens *in place*, so input data is overwritten by output!
+ * @param ctx The decryption context as with ctr(); ctx.key is not used
+ * @param ks the expanded encryption key, see bksq_key_expand()
+ * @param hks the expanded MAC key, see hmac_key_expand()
+ * @param tag the authentication tag to be verified
+ * @return Returns 0, if the tag matched and the data was decrypted; INVALID_TAG if the data was left untouched
+ */
+uint8_t ae_dec_expanded(CONTEXT const ctx, BKSQ_KEY_SCHEDULE const *ks, HMAC_KEY_SCHEDULE const *hks, uint8_t const *tag) {
+    // sanity checks
+    if ((ctx.data_length % BLOCKSIZE) != 0) return INVALID_DATA_LENGTH;
+    if (ctx.nonce_length != (BLOCKSIZE / 2)) return INVALID_NONCE_LENGTH;
+
 	int i;
 	uint8_t nonce_counter[12];
+	uint8_t expected_tag[12];
+	HMAC_CTX mac;
+	BKSQ_INSTRUMENT_START(start);
     for(i=0;i<6;i++)
     	nonce_counter[i]=ctx.nonce[i];
     for(i=6;i<12;i++)
     	nonce_counter[i]=0;
-    for(i=0;i<12;i++)
-    	temp[i]=nonce_counter[i];
-    for(i=12;i<n;i++)
-    	temp[i]=ctx.data[i-12];
-    hmac(ctx.data,ctx.data_length,ctx.key,12*8,tag,temp,n*8);
-    return CTR_OK | HMAC_OK; 
+    hmac_init(&mac,hks);
+    hmac_update(&mac,nonce_counter,12);
+    hmac_update(&mac,ctx.data,ctx.data_length/8);
+    hmac_final(&mac,expected_tag);
+    if (tag_compare(tag,expected_tag) != 0) {
+    	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_AE_DEC,start,ctx.data_length/BLOCKSIZE,ctx.data_length/8);
+    	return INVALID_TAG;
+    }
+    ctr_blocks(ctx.data,ctx.data_length/BLOCKSIZE,nonce_counter,ks);
+    BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_AE_DEC,start,ctx.data_length/BLOCKSIZE,ctx.data_length/8);
+    return AE_DEC_OK;
+}
+
+/**
+ * Decrypts data encrypted with ae_enc(), verifying the tag before any decryption.
+ * Note that operation happens *in place*, so input data is overwritten by output!
+ * @param ctx The decryption context as with ctr()
+ * @param tag the authentication tag to be verified
+ * @return Returns 0, if the tag matched and the data was decrypted; INVALID_TAG if the data was left untouched
+ */
+uint8_t ae_dec(CONTEXT const ctx, uint8_t const *tag) {
+	BKSQ_KEY_SCHEDULE ks;
+	HMAC_KEY_SCHEDULE hks;
+	bksq_key_expand(ctx.key,&ks);
+	hmac_key_expand(ctx.key,BLOCKSIZE,&hks);
+	return ae_dec_expanded(ctx,&ks,&hks,tag);
+}
+
+//One record of ae_dec_batch(); consecutive records under the same key share one key expansion:
+typedef struct {
+    CONTEXT const *ctxs; ///< the records
+    uint8_t const (*tags)[12]; ///< their tags
+    uint8_t *results; ///< receives the result of every record
+    size_t nrecords; ///< the number of records
+    size_t records_per_job; ///< the number of consecutive records per job
+} AE_DEC_BATCH_JOB;
+void ae_dec_batch_job(void *arg, int index){
+	AE_DEC_BATCH_JOB *job=(AE_DEC_BATCH_JOB *)arg;
+	BKSQ_KEY_SCHEDULE ks;
+	HMAC_KEY_SCHEDULE hks;
+	uint8_t const *key=NULL;
+	size_t i=(size_t)index*job->records_per_job;
+	size_t end=i+job->records_per_job<job->nrecords ? i+job->records_per_job : job->nrecords;
+	for(;i<end;i++){
+		if(key==NULL || memcmp(key,job->ctxs[i].key,12)!=0){
+			key=job->ctxs[i].key;
+			bksq_key_expand(key,&ks);
+			hmac_key_expand(key,BLOCKSIZE,&hks);
+		}
+		job->results[i]=ae_dec_expanded(job->ctxs[i],&ks,&hks,job->tags[i]);
+	}
+}
+/**
+ * Decrypts a batch of records encrypted with ae_enc(). Every record is verified before it is decrypted;
+ * with a thread pool, the records are verified and decrypted on several threads at once.
+ * @param ctxs the decryption contexts of the records
+ * @param tags the authentication tags of the records
+ * @param results receives ae_dec()'s return value for every record
+ * @param n the number of records
+ * @param pool the worker threads, see bksq_pool_create(); NULL to work on the calling thread only
+ * @return Returns 0, if all records were verified and decrypted; otherwise the first error found
+ */
+uint8_t ae_dec_batch(CONTEXT const ctxs[], uint8_t const tags[][12], uint8_t results[], size_t n, BKSQ_THREAD_POOL *pool) {
+	AE_DEC_BATCH_JOB job;
+	size_t njobs;
+	size_t i;
+	job.ctxs=ctxs;
+	job.tags=tags;
+	job.results=results;
+	job.nrecords=n;
+	if(n==0)
+		return AE_DEC_OK;
+	njobs=pool==NULL ? 1 : (size_t)(pool->nthreads+1)*CHUNKS_PER_THREAD;
+	if(njobs>n)
+		njobs=n;
+	job.records_per_job=(n+njobs-1)/njobs;
+	njobs=(n+job.records_per_job-1)/job.records_per_job;
+	if(pool==NULL)
+		ae_dec_batch_job(&job,0);
+	else
+		bksq_pool_run(pool,ae_dec_batch_job,&job,(int)njobs);
+	for(i=0;i<n;i++)
+		if(results[i]!=AE_DEC_OK)
+			return results[i];
+	return AE_DEC_OK;
+}
+
+#define AE_BATCH_KEY_SLOTS (2*AE_BATCH_RECORDS) ///< slots of the hash table of the distinct keys in ae_enc_batch_records(), a power of two
+//The slot of a 12 byte key in that table, a multiplicative hash of its three words:
+size_t ae_enc_batch_key_slot(uint8_t const *key){
+	uint32_t w[3];
+	memcpy(w,key,12);
+	return (size_t)(((w[0]*0x9e3779b1u)^(w[1]*0x85ebca77u)^(w[2]*0xc2b2ae3du))>>16)&(AE_BATCH_KEY_SLOTS-1);
+}
+//XORs the gathered keystream blocks of ae_enc_batch_records() into their records:
+void ae_enc_batch_flush(uint8_t *keystream, uint8_t * const dest[], size_t nblocks, BKSQ_KEY_SCHEDULE const *ks){
+	size_t b;
+	int j;
+	if(nblocks==0)
+		return;
+	bksq_encrypt_blocks_expanded(keystream,keystream,nblocks,ks);
+	for(b=0;b<nblocks;b++)
+		for(j=0;j<12;j++)
+			dest[b][j]^=keystream[12*b+j];
+}
+//Encrypt-then-MAC of up to AE_BATCH_RECORDS records, skipping those whose result is not AE_ENC_OK. Every distinct key
+//is expanded once for all its records, wherever they are among the |n|, and their counter blocks go through the
+//multi-block API together; then the inner hashes of the records advance in DM_MANY_LANES lanes as in dmhash_many(), and the outer too.
+//The distinct keys are found with a hash table with linear probing, and each one keeps the list of its records,
+//so that the work grows with |n| and not with |n| times the number of keys:
+void ae_enc_batch_records(CONTEXT const ctxs[], uint8_t tags[][12], uint8_t const results[], size_t n){
+	static const uint8_t idle_block[12] = {0};
+	BKSQ_KEY_SCHEDULE ks;
+	HMAC_KEY_SCHEDULE hks[AE_BATCH_RECORDS];
+	uint8_t const *keys[AE_BATCH_RECORDS];
+	size_t key_index[AE_BATCH_RECORDS];
+	size_t key_slot[AE_BATCH_KEY_SLOTS];
+	size_t key_first[AE_BATCH_RECORDS];
+	size_t key_last[AE_BATCH_RECORDS];
+	size_t record_next[AE_BATCH_RECORDS];
+	uint8_t first[AE_BATCH_RECORDS][12];
+	uint8_t inner[AE_BATCH_RECORDS][12];
+	uint8_t keystream[12*MULTIBLOCK_BATCH];
+	uint8_t *dest[MULTIBLOCK_BATCH];
+	uint8_t nonce_counter[12];
+	uint8_t hash[DM_MANY_LANES][16];
+	uint8_t const *blocks[DM_MANY_LANES];
+	size_t record[DM_MANY_LANES];
+	size_t left[DM_MANY_LANES];
+	size_t nkeys=0;
+	size_t slot;
+	size_t gathered=0;
+	size_t total=0;
+	size_t next=0;
+	size_t k,r,j;
+	int active=0;
+	int l;
+	BKSQ_INSTRUMENT_START(start);
+	//The distinct keys (slots hold the index of a key plus one, 0 is free), and the records of every key in order:
+	memset(key_slot,0,sizeof(key_slot));
+	for(r=0;r<n;r++){
+		if(results[r]!=AE_ENC_OK)
+			continue;
+		for(slot=ae_enc_batch_key_slot(ctxs[r].key);key_slot[slot]!=0 && memcmp(keys[key_slot[slot]-1],ctxs[r].key,12)!=0;slot=(slot+1)&(AE_BATCH_KEY_SLOTS-1));
+		if(key_slot[slot]==0){
+			keys[nkeys]=ctxs[r].key;
+			key_first[nkeys]=r;
+			key_slot[slot]=++nkeys;
+		}else{
+			record_next[key_last[key_slot[slot]-1]]=r;
+		}
+		k=key_slot[slot]-1;
+		key_index[r]=k;
+		key_last[k]=r;
+		record_next[r]=n;
+		total+=ctxs[r].data_length/BLOCKSIZE;
+	}
+	//Counter mode, key by key; the first counter block of every record is kept for its MAC:
+	for(k=0;k<nkeys;k++){
+		bksq_key_expand(keys[k],&ks);
+		hmac_key_expand(keys[k],BLOCKSIZE,&hks[k]);
+		for(r=key_first[k];r<n;r=record_next[r]){
+			memcpy(first[r],ctxs[r].nonce,6);
+			memset(first[r]+6,0,6);
+			memcpy(nonce_counter,first[r],12);
+			for(j=0;j<ctxs[r].data_length/BLOCKSIZE;j++){
+				if(gathered==MULTIBLOCK_BATCH){
+					ae_enc_batch_flush(keystream,dest,gathered,&ks);
+					gathered=0;
+				}
+				memcpy(keystream+12*gathered,nonce_counter,12);
+				counter(nonce_counter);
+				dest[gathered++]=ctxs[r].data+12*j;
+			}
+		}
+		ae_enc_batch_flush(keystream,dest,gathered,&ks);
+		gathered=0;
+	}
+	//Inner hashes over the first counter block and the ciphertext, from the state after ipad^key; idle lanes and the
+	//bytes 12 to 15 of every lane are hashed too, so they start defined as in dmhash_many():
+	memset(hash,0,sizeof(hash));
+	for(l=0;l<DM_MANY_LANES;l++){
+		left[l]=0;
+		blocks[l]=idle_block;
+	}
+	do{
+		for(l=0;l<DM_MANY_LANES;l++){
+			while(left[l]==0 && next<n){
+				if(results[next]!=AE_ENC_OK){
+					next++;
+					continue;
+				}
+				record[l]=next;
+				memcpy(hash[l],hks[key_index[next]].inner_state,12);
+				blocks[l]=first[next];
+				left[l]=1+ctxs[next++].data_length/BLOCKSIZE;
+				active++;
+			}
+		}
+		if(active==0)
+			break;
+		dm_compress_lanes(hash,blocks);
+		for(l=0;l<DM_MANY_LANES;l++){
+			if(left[l]==0)
+				continue;
+			r=record[l];
+			if(--left[l]==0){
+				memcpy(inner[r],hash[l],12);
+				blocks[l]=idle_block;
+				active--;
+			}else if(left[l]==ctxs[r].data_length/BLOCKSIZE){
+				blocks[l]=ctxs[r].data;
+			}else{
+				blocks[l]+=12;
+			}
+		}
+	}while(active>0 || next<n);
+	//Outer hashes, one block each, from the state after opad^key:
+	for(r=0;r<n;){
+		for(l=0;l<DM_MANY_LANES;l++){
+			while(r<n && results[r]!=AE_ENC_OK)
+				r++;
+			record[l]=r;
+			if(r<n){
+				memcpy(hash[l],hks[key_index[r]].outer_state,12);
+				blocks[l]=inner[r++];
+			}else{
+				blocks[l]=idle_block;
+			}
+		}
+		if(record[0]>=n)
+			break;
+		dm_compress_lanes(hash,blocks);
+		for(l=0;l<DM_MANY_LANES;l++)
+			if(record[l]<n)
+				memcpy(tags[record[l]],hash[l],12);
+	}
+	BKSQ_INSTRUMENT_STOP(BKSQ_STAGE_AE_ENC,start,total,12*total);
+}
+//The records of ae_enc_batch():
+typedef struct {
+    CONTEXT const *ctxs; ///< the records
+    uint8_t (*tags)[12]; ///< receives their tags
+    uint8_t const *results; ///< AE_ENC_OK for every record to be encrypted
+    size_t nrecords; ///< the number of records
+    size_t records_per_job; ///< the number of consecutive records per job
+} AE_ENC_BATCH_JOB;
+void ae_enc_batch_job(void *arg, int index){
+	AE_ENC_BATCH_JOB *job=(AE_ENC_BATCH_JOB *)arg;
+	size_t i=(size_t)index*job->records_per_job;
+	size_t end=i+job->records_per_job<job->nrecords ? i+job->records_per_job : job->nrecords;
+	size_t count;
+	for(;i<end;i+=count){
+		count=end-i<AE_BATCH_RECORDS ? end-i : AE_BATCH_RECORDS;
+		ae_enc_batch_records(job->ctxs+i,job->tags+i,job->results+i,count);
+	}
+}
+/**
+ * Encrypts a batch of records like ae_enc() on each of them, but with the fixed cost per record amortized:
+ * the records are taken in groups of AE_BATCH_RECORDS, and within a group all records under the same key share
+ * one key expansion and one HMAC key expansion, whether they are consecutive or not; the counter blocks of a key
+ * are encrypted together, and the HMACs of DM_MANY_LANES records run in lock-step in the SIMD lanes. With a thread
+ * pool, the records are spread over several threads. Made for many small records, e.g. network packets.
+ * Note that operation happens *in place*, so input data is overwritten by output!
+ * @param ctxs the encryption contexts of the records, as with ae_enc()
+ * @param tags receives the authentication tag of every record
+ * @param results receives ae_enc()'s return value for every record; a record with an error is left untouched
+ * @param n the number of records
+ * @param pool the worker threads, see bksq_pool_create(); NULL to work on the calling thread only
+ * @return Returns 0, if all records were encrypted; otherwise the first error found
+ */
+uint8_t ae_enc_batch(CONTEXT const ctxs[], uint8_t tags[][12], uint8_t results[], size_t n, BKSQ_THREAD_POOL *pool) {
+	AE_ENC_BATCH_JOB job;
+	size_t njobs;
+	size_t i;
+	uint8_t ret=AE_ENC_OK;
+	for(i=0;i<n;i++){
+		results[i]=AE_ENC_OK;
+		if ((ctxs[i].data_length % BLOCKSIZE) != 0) results[i]=INVALID_DATA_LENGTH;
+		else if (ctxs[i].nonce_length != (BLOCKSIZE / 2)) results[i]=INVALID_NONCE_LENGTH;
+		if(ret==AE_ENC_OK)
+			ret=results[i];
+	}
+	job.ctxs=ctxs;
+	job.tags=tags;
+	job.results=results;
+	job.nrecords=n;
+	if(n==0)
+		return AE_ENC_OK;
+	njobs=pool==NULL ? 1 : (size_t)(pool->nthreads+1)*CHUNKS_PER_THREAD;
+	if(njobs>n)
+		njobs=n;
+	job.records_per_job=(n+njobs-1)/njobs;
+	njobs=(n+job.records_per_job-1)/job.records_per_job;
+	if(pool==NULL)
+		ae_enc_batch_job(&job,0);
+	else
+		bksq_pool_run(pool,ae_enc_batch_job,&job,(int)njobs);
+	return ret;
 }
@@ -0,0 +1,293 @@
+/** \file bench.c */
+
+/**
+ * Benchmark of the primitives in abgabe.c: cycles per byte and MB/s of bksq_encrypt, ctr, dmhash, dmhash_many, hmac, ae_enc and ae_enc_batch
+ * (with ae_enc_records, ae_enc() on the same records one by one, to compare with)
+ * for message sizes from 12 bytes up to 1 GiB, with the key setup measured separately.
+ *
+ * Usage: bksq_bench [--max-bytes N] [--min-time SECONDS] [--json FILE]
+ *
+ * The results are printed as a table and, with --json, written as JSON, so that CI can compare them with a baseline.
+ * Cycles are read with rdtsc on x86 (reference cycles of the TSC); elsewhere only the time is reported.
+ * Built with -DBKSQ_INSTRUMENT (make bksq_profile), the per-stage counters of abgabe.c are reported as well.
+ * The backends of abgabe.c are listed first, with their calibration throughput and the one the results are for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "abgabe.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define READ_CYCLES() __rdtsc() ///< the time stamp counter
+#define HAVE_CYCLES 1
+#else
+#define READ_CYCLES() 0
+#define HAVE_CYCLES 0
+#endif
+
+#define DEFAULT_MAX_BYTES (16u * 1024 * 1024) ///< without --max-bytes the largest message is 16 MiB
+#define LARGEST_MESSAGE ((size_t) 12 * 89478485) ///< the largest multiple of the blocksize not above 1 GiB
+#define BENCH_RECORDS 64 ///< number of records dmhash_many() and ae_enc_batch() get at once
+#define CONTEXT_MAX_BYTES ((size_t) 12 * 44739242) ///< the largest message whose length in bits fits into uint32_t
+
+/**
+ * One measurement.
+ */
+typedef struct {
+    char const *name; ///< the primitive
+    size_t bytes; ///< the message size (0 for key setup)
+    uint64_t iterations; ///< the number of calls
+    double seconds; ///< the total time
+    uint64_t cycles; ///< the total number of TSC cycles
+} RESULT;
+
+static RESULT results[256];
+static int nresults = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * The operation to be measured; |arg| points to a BENCH_ARG.
+ */
+typedef struct {
+    uint8_t *data;
+    size_t bytes;
+    uint8_t key[12];
+    uint8_t nonce[6];
+    uint8_t out[12];
+} BENCH_ARG;
+
+static void run_bksq_encrypt(BENCH_ARG *a) {
+    bksq_encrypt(a->data, a->out, a->key);
+}
+
+static void run_key_expand(BENCH_ARG *a) {
+    BKSQ_KEY_SCHEDULE ks;
+    bksq_key_expand(a->key, &ks);
+    a->out[0] ^= ks.round_key[10][0];
+}
+
+static void run_hmac_key_expand(BENCH_ARG *a) {
+    HMAC_KEY_SCHEDULE hks;
+    hmac_key_expand(a->key, BLOCKSIZE, &hks);
+    a->out[0] ^= hks.outer_state[0];
+}
+
+static void run_ctr(BENCH_ARG *a) {
+    if (a->bytes <= CONTEXT_MAX_BYTES) {
+        CONTEXT ctx = {.data = a->data, .data_length = (uint32_t) (a->bytes * 8), .key = a->key, .nonce = a->nonce, .nonce_length = 6 * 8};
+        ctr(ctx);
+    } else {
+        CTR_STREAM stream;
+        ctr_stream_init(&stream, a->key, a->nonce, 6 * 8);
+        ctr_stream_update(&stream, a->data, a->bytes);
+        ctr_stream_final(&stream);
+    }
+}
+
+static void run_dmhash(BENCH_ARG *a) {
+    if (a->bytes <= CONTEXT_MAX_BYTES) {
+        dmhash(a->data, (uint32_t) (a->bytes * 8), a->out);
+    } else {
+        DM_CTX ctx;
+        dm_init(&ctx);
+        dm_update(&ctx, a->data, a->bytes);
+        dm_final(&ctx, a->out);
+    }
+}
+
+static void run_hmac(BENCH_ARG *a) {
+    if (a->bytes <= CONTEXT_MAX_BYTES) {
+        hmac(a->data, (uint32_t) (a->bytes * 8), a->key, BLOCKSIZE, a->out, NULL, 0);
+    } else {
+        HMAC_KEY_SCHEDULE hks;
+        HMAC_CTX ctx;
+        hmac_key_expand(a->key, BLOCKSIZE, &hks);
+        hmac_init(&ctx, &hks);
+        hmac_update(&ctx, a->data, a->bytes);
+        hmac_final(&ctx, a->out);
+    }
+}
+
+//The data as BENCH_RECORDS records of equal length, hashed with dmhash_many():
+static void run_dmhash_many(BENCH_ARG *a) {
+    uint8_t const *msgs[BENCH_RECORDS];
+    uint32_t lengths[BENCH_RECORDS];
+    uint8_t hashes[BENCH_RECORDS][12];
+    size_t record = a->bytes / BENCH_RECORDS / 12 * 12;
+    int i;
+    for (i = 0; i < BENCH_RECORDS; i++) {
+        msgs[i] = a->data + i * record;
+        lengths[i] = (uint32_t) (record * 8);
+    }
+    dmhash_many(msgs, lengths, hashes, BENCH_RECORDS);
+    a->out[0] ^= hashes[0][0];
+}
+
+static void run_ae_enc(BENCH_ARG *a) {
+    CONTEXT ctx = {.data = a->data, .data_length = (uint32_t) (a->bytes * 8), .key = a->key, .nonce = a->nonce, .nonce_length = 6 * 8};
+    ae_enc(ctx, a->out);
+}
+
+//The data as BENCH_RECORDS records of equal length under one key, encrypted one by one with ae_enc(), as ae_enc_batch() gets them:
+static void run_ae_enc_records(BENCH_ARG *a) {
+    size_t record = a->bytes / BENCH_RECORDS / 12 * 12;
+    int i;
+    for (i = 0; i < BENCH_RECORDS; i++) {
+        CONTEXT ctx = {.data = a->data + i * record, .data_length = (uint32_t) (record * 8), .key = a->key, .nonce = a->nonce, .nonce_length = 6 * 8};
+        ae_enc(ctx, a->out);
+    }
+}
+
+//The data as BENCH_RECORDS records of equal length under one key, encrypted with ae_enc_batch():
+static void run_ae_enc_batch(BENCH_ARG *a) {
+    CONTEXT ctxs[BENCH_RECORDS];
+    uint8_t tags[BENCH_RECORDS][12];
+    uint8_t results[BENCH_RECORDS];
+    size_t record = a->bytes / BENCH_RECORDS / 12 * 12;
+    int i;
+    for (i = 0; i < BENCH_RECORDS; i++) {
+        CONTEXT ctx = {.data = a->data + i * record, .data_length = (uint32_t) (record * 8), .key = a->key, .nonce = a->nonce, .nonce_length = 6 * 8};
+        ctxs[i] = ctx;
+    }
+    ae_enc_batch(ctxs, tags, results, BENCH_RECORDS, NULL);
+    a->out[0] ^= tags[0][0];
+}
+
+/**
+ * Calls |op| until at least |min_time| seconds have passed and records the result.
+ */
+static void measure(char const *name, void (*op)(BENCH_ARG *), BENCH_ARG *a, size_t bytes, double min_time) {
+    RESULT *r = &results[nresults++];
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    uint64_t i;
+    double start = now();
+    uint64_t start_cycles = READ_CYCLES();
+    double elapsed;
+
+    a->bytes = bytes;
+    do {
+        for (i = 0; i < batch; i++) op(a);
+        iterations += batch;
+        elapsed = now() - start;
+        if (batch < (1u << 20)) batch *= 2;
+    } while (elapsed < min_time);
+
+    r->name = name;
+    r->bytes = bytes;
+    r->iterations = iterations;
+    r->seconds = elapsed;
+    r->cycles = READ_CYCLES() - start_cycles;
+}
+
+static void print_result(FILE *f, RESULT const *r, int json, int last) {
+    double per_call = r->seconds / r->iterations;
+    double cycles_per_call = (double) r->cycles / r->iterations;
+    if (json) {
+        fprintf(f, "    {\"primitive\": \"%s\", \"bytes\": %zu, \"iterations\": %llu, \"ns_per_call\": %.1f", r->name, r->bytes, (unsigned long long) r->iterations, per_call * 1e9);
+        if (HAVE_CYCLES) fprintf(f, ", \"cycles_per_call\": %.1f", cycles_per_call);
+        if (r->bytes > 0) {
+            fprintf(f, ", \"mb_per_s\": %.3f", r->bytes / per_call / 1e6);
+            if (HAVE_CYCLES) fprintf(f, ", \"cycles_per_byte\": %.2f", cycles_per_call / r->bytes);
+        }
+        fprintf(f, "}%s\n", last ? "" : ",");
+    } else if (r->bytes > 0) {
+        fprintf(f, "%-16s %12zu %14.2f %12.3f\n", r->name, r->bytes, HAVE_CYCLES ? cycles_per_call / r->bytes : 0.0, r->bytes / per_call / 1e6);
+    } else {
+        fprintf(f, "%-16s %12s %14.0f %12s  (cycles per call)\n", r->name, "-", HAVE_CYCLES ? cycles_per_call : 0.0, "-");
+    }
+}
+
+/**
+ *  Runs all benchmarks and prints the results
+ */
+int main(int argc, char** argv) {
+    size_t max_bytes = DEFAULT_MAX_BYTES;
+    double min_time = 0.2;
+    char const *json_path = NULL;
+    size_t bytes;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-bytes") == 0 && i + 1 < argc) max_bytes = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) min_time = atof(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [--max-bytes N] [--min-time SECONDS] [--json FILE]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (max_bytes > LARGEST_MESSAGE) max_bytes = LARGEST_MESSAGE;
+
+    BENCH_ARG a;
+    memset(&a, 0, sizeof(a));
+    for (i = 0; i < 12; i++) a.key[i] = (uint8_t) (0xf0 + i);
+    for (i = 0; i < 6; i++) a.nonce[i] = (uint8_t) i;
+    a.data = (uint8_t *) calloc(max_bytes < 12 ? 12 : max_bytes, 1);
+    if (a.data == NULL) {
+        fprintf(stderr, "cannot allocate %zu bytes\n", max_bytes);
+        return EXIT_FAILURE;
+    }
+
+    bksq_backend_report(stdout);
+    printf("\n");
+
+    // key setup on its own
+    measure("key_expand", run_key_expand, &a, 0, min_time);
+    measure("hmac_key_expand", run_hmac_key_expand, &a, 0, min_time);
+    measure("bksq_encrypt", run_bksq_encrypt, &a, 12, min_time);
+
+    // modes, from one block up to max_bytes in steps of 16
+    for (bytes = 12; bytes <= max_bytes; bytes *= 16) {
+        measure("ctr", run_ctr, &a, bytes, min_time);
+        measure("dmhash", run_dmhash, &a, bytes, min_time);
+        if (bytes >= 12 * BENCH_RECORDS && bytes <= CONTEXT_MAX_BYTES) measure("dmhash_many", run_dmhash_many, &a, bytes, min_time);
+        measure("hmac", run_hmac, &a, bytes, min_time);
+        if (bytes <= CONTEXT_MAX_BYTES) measure("ae_enc", run_ae_enc, &a, bytes, min_time);
+        if (bytes >= 12 * BENCH_RECORDS && bytes <= CONTEXT_MAX_BYTES) measure("ae_enc_records", run_ae_enc_records, &a, bytes, min_time);
+        if (bytes >= 12 * BENCH_RECORDS && bytes <= CONTEXT_MAX_BYTES) measure("ae_enc_batch", run_ae_enc_batch, &a, bytes, min_time);
+    }
+    if (bytes / 16 < max_bytes) {
+        measure("ctr", run_ctr, &a, max_bytes / 12 * 12, min_time);
+        measure("dmhash", run_dmhash, &a, max_bytes / 12 * 12, min_time);
+        measure("hmac", run_hmac, &a, max_bytes / 12 * 12, min_time);
+        if (max_bytes <= CONTEXT_MAX_BYTES) measure("ae_enc", run_ae_enc, &a, max_bytes / 12 * 12, min_time);
+    }
+
+    printf("%-16s %12s %14s %12s\n", "primitive", "bytes", "cycles/byte", "MB/s");
+    for (i = 0; i < nresults; i++) print_result(stdout, &results[i], 0, 0);
+#ifdef BKSQ_INSTRUMENT
+    printf("\n");
+    bksq_instrument_dump(stdout, 0);
+#endif
+
+    if (json_path != NULL) {
+        FILE *f = fopen(json_path, "w");
+        if (f == NULL) {
+            fprintf(stderr, "cannot write %s\n", json_path);
+            return EXIT_FAILURE;
+        }
+        fprintf(f, "{\n  \"cycles\": \"%s\",\n  \"backend\": \"%s\",\n  \"results\": [\n", HAVE_CYCLES ? "tsc" : "none", bksq_backend_name());
+        for (i = 0; i < nresults; i++) print_result(f, &results[i], 1, i == nresults - 1);
+        fprintf(f, "  ]");
+#ifdef BKSQ_INSTRUMENT
+        fprintf(f, ",\n  \"instrument\": ");
+        bksq_instrument_dump(f, 1);
+#endif
+        fprintf(f, "\n}\n");
+        fclose(f);
+    }
+
+    free(a.data);
+    return (EXIT_SUCCESS);
+}
@@ -0,0 +1,314 @@
+/** \file bksq.hpp */
+
+/**
+ * Header-only C++20 engine for BKSQ and its modes, bit-exact with abgabe.c.
+ *
+ * All tables (S-Box, inverse S-Box, the T-tables of theta and the round constants) are generated constexpr
+ * from the GF(2^8) arithmetic, so there is no startup cost and no table needs to be checked at runtime.
+ * The rounds of Cipher::encrypt are unrolled at compile time, and everything works on std::array values
+ * and std::span views without heap allocation. Even the encryption itself can run at compile time.
+ */
+
+#ifndef BKSQ_HPP
+#define BKSQ_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+
+namespace bksq {
+
+/**
+ * 96 bits tagged with what they are. Blocks and keys are distinct types, so one is never passed for the other by accident;
+ * where a mode really uses one as the other (the message blocks are the keys of Davies-Meyer) the conversion is explicit.
+ */
+template <typename Tag>
+struct Bytes : std::array<std::uint8_t, 12> {
+    template <typename Other>
+    constexpr explicit operator Bytes<Other>() const noexcept {
+        return {static_cast<std::array<std::uint8_t, 12> const&>(*this)};
+    }
+
+    friend constexpr bool operator==(Bytes const&, Bytes const&) noexcept = default;
+
+    template <typename Other>
+    friend bool operator==(Bytes const&, Bytes<Other> const&) = delete;
+};
+
+struct BlockTag;
+struct KeyTag;
+
+using Block = Bytes<BlockTag>; ///< a 96 bit block
+using Key = Bytes<KeyTag>; ///< a 96 bit key
+using Nonce = std::array<std::uint8_t, 6>; ///< a 48 bit nonce, the first half of every counter block
+
+inline constexpr std::size_t block_size = 12; ///< the blocksize in bytes
+
+namespace detail {
+
+using Words = std::array<std::uint32_t, 4>; ///< a block as four column words, byte 3*w+k in bits 8*k..8*k+7 of word w
+
+// GF(2^8) with the polynomial 283, as multiply() in abgabe.c
+constexpr std::uint8_t xtime(std::uint8_t val) {
+    return static_cast<std::uint8_t>((val << 1) ^ ((val >> 7) * 27));
+}
+
+constexpr std::uint8_t gf_multiply(std::uint8_t a, std::uint8_t b) {
+    std::uint8_t res = 0;
+    for (int i = 0; i < 8; i++) {
+        if (b & 1) res ^= a;
+        a = xtime(a);
+        b >>= 1;
+    }
+    return res;
+}
+
+// the inverse as a^254, 0 for 0 like extended_gcd()
+constexpr std::uint8_t gf_inverse(std::uint8_t a) {
+    std::uint8_t res = 1;
+    for (int i = 0; i < 254; i++) res = gf_multiply(res, a);
+    return res;
+}
+
+constexpr std::uint8_t affine_mapping(std::uint8_t val) {
+    std::uint8_t res = 0;
+    for (int i = 0; i < 8; i++) {
+        int bit = ((val >> i) ^ (val >> ((i + 4) % 8)) ^ (val >> ((i + 5) % 8)) ^ (val >> ((i + 6) % 8)) ^ (val >> ((i + 7) % 8)) ^ (0x63 >> i)) & 1;
+        res |= static_cast<std::uint8_t>(bit << i);
+    }
+    return res;
+}
+
+constexpr std::array<std::uint8_t, 256> make_sbox() {
+    std::array<std::uint8_t, 256> res{};
+    for (int i = 0; i < 256; i++) res[i] = affine_mapping(gf_inverse(static_cast<std::uint8_t>(i)));
+    return res;
+}
+
+inline constexpr std::array<std::uint8_t, 256> sbox = make_sbox();
+
+constexpr std::array<std::uint8_t, 256> make_inverse_sbox() {
+    std::array<std::uint8_t, 256> res{};
+    for (int i = 0; i < 256; i++) res[sbox[i]] = static_cast<std::uint8_t>(i);
+    return res;
+}
+
+inline constexpr std::array<std::uint8_t, 256> inverse_sbox = make_inverse_sbox();
+
+// ttable[k][x]: the column theta produces from the byte S(x) in row k of a column, see ttable in abgabe.c
+constexpr std::array<std::array<std::uint32_t, 256>, 3> make_ttable() {
+    std::array<std::array<std::uint32_t, 256>, 3> res{};
+    for (int k = 0; k < 3; k++) {
+        for (int x = 0; x < 256; x++) {
+            std::uint32_t column = 0;
+            for (int r = 0; r < 3; r++) column |= static_cast<std::uint32_t>(gf_multiply(sbox[x], r == k ? 3 : 2)) << (8 * r);
+            res[k][x] = column;
+        }
+    }
+    return res;
+}
+
+inline constexpr std::array<std::array<std::uint32_t, 256>, 3> ttable = make_ttable();
+
+// the round constants multiply(1,exponent(2,t)), index 0 unused
+constexpr std::array<std::uint8_t, 11> make_round_constants() {
+    std::array<std::uint8_t, 11> res{};
+    std::uint8_t power = 1;
+    for (int t = 1; t < 11; t++) {
+        power = xtime(power);
+        res[t] = power;
+    }
+    return res;
+}
+
+inline constexpr std::array<std::uint8_t, 11> round_constant = make_round_constants();
+
+static_assert(sbox[0x00] == 0x63 && sbox[0x53] == 0xed && inverse_sbox[0x63] == 0x00, "S-Box");
+static_assert(ttable[0][0] == 0xc6c6a5 && ttable[0][1] == 0xf8f884, "T-tables");
+static_assert(round_constant[1] == 0x02 && round_constant[8] == 0x1b && round_constant[10] == 0x6c, "round constants");
+
+constexpr Words pack(Block const& val) {
+    Words res{};
+    for (int i = 0; i < 4; i++) res[i] = val[3 * i] | (static_cast<std::uint32_t>(val[3 * i + 1]) << 8) | (static_cast<std::uint32_t>(val[3 * i + 2]) << 16);
+    return res;
+}
+
+constexpr std::uint8_t byte(Words const& val, int i) {
+    return static_cast<std::uint8_t>(val[i / 3] >> (8 * (i % 3)));
+}
+
+// theta of a round key in column words: every byte of a column gets 2*(a^b^c) added
+constexpr Words theta_words(Block const& val) {
+    Words res{};
+    for (int i = 0; i < 4; i++) {
+        std::uint8_t column = xtime(val[3 * i] ^ val[3 * i + 1] ^ val[3 * i + 2]);
+        res[i] = static_cast<std::uint32_t>(val[3 * i] ^ column) | (static_cast<std::uint32_t>(val[3 * i + 1] ^ column) << 8) | (static_cast<std::uint32_t>(val[3 * i + 2] ^ column) << 16);
+    }
+    return res;
+}
+
+constexpr Block round_key_evolution(Block const& val, int t) {
+    Block res{};
+    res[0] = val[0] ^ sbox[val[10]] ^ round_constant[t];
+    res[1] = val[1] ^ sbox[val[11]];
+    res[2] = val[2] ^ sbox[val[9]];
+    for (int i = 3; i < 12; i++) res[i] = val[i] ^ res[i - 3];
+    return res;
+}
+
+// theta(Permutation(S_box(val))) ^ round_key, see ttable_round()
+constexpr Words round(Words const& val, Words const& round_key) {
+    return {
+        ttable[0][byte(val, 0)] ^ ttable[1][byte(val, 10)] ^ ttable[2][byte(val, 8)] ^ round_key[0],
+        ttable[0][byte(val, 3)] ^ ttable[1][byte(val, 1)] ^ ttable[2][byte(val, 11)] ^ round_key[1],
+        ttable[0][byte(val, 6)] ^ ttable[1][byte(val, 4)] ^ ttable[2][byte(val, 2)] ^ round_key[2],
+        ttable[0][byte(val, 9)] ^ ttable[1][byte(val, 7)] ^ ttable[2][byte(val, 5)] ^ round_key[3],
+    };
+}
+
+// Permutation(S_box(val)) ^ round_key, the last round without theta
+constexpr Block final_round(Words const& val, Block const& round_key) {
+    constexpr int permutation[12] = {0, 10, 8, 3, 1, 11, 6, 4, 2, 9, 7, 5};
+    Block res{};
+    for (int i = 0; i < 12; i++) res[i] = sbox[byte(val, permutation[i])] ^ round_key[i];
+    return res;
+}
+
+constexpr void xor_into(std::span<std::uint8_t> data, Block const& val) {
+    for (std::size_t i = 0; i < data.size(); i++) data[i] ^= val[i];
+}
+
+} // namespace detail
+
+/**
+ * BKSQ with an expanded key. |Rounds| may be lowered for reduced-round experiments; the default is the full cipher.
+ */
+template <std::size_t Rounds = 10>
+class Cipher {
+    static_assert(Rounds >= 1 && Rounds <= 10, "BKSQ has at most 10 rounds");
+
+public:
+    /**
+     * Expands |key| into all round keys.
+     */
+    constexpr explicit Cipher(Key const& key) noexcept {
+        round_key_[0] = static_cast<Block>(key);
+        for (std::size_t t = 1; t <= Rounds; t++) round_key_[t] = detail::round_key_evolution(round_key_[t - 1], static_cast<int>(t));
+        for (std::size_t t = 0; t < Rounds; t++) theta_round_key_[t] = detail::theta_words(round_key_[t]);
+    }
+
+    /**
+     * Encrypts a single block.
+     */
+    constexpr Block encrypt(Block const& plain) const noexcept {
+        // theta inverse and key whitening, moved through the theta of the 1st round
+        detail::Words state = detail::pack(plain);
+        for (int i = 0; i < 4; i++) state[i] ^= theta_round_key_[0][i];
+        return rounds(state, std::make_index_sequence<Rounds - 1>{});
+    }
+
+    /**
+     * Counter mode in place on data of any length, with the counter block nonce || 48 bit counter starting at 0.
+     * Gives the same output as ctr() in abgabe.c on whole blocks and as a CTR_STREAM otherwise.
+     */
+    constexpr void ctr(std::span<std::uint8_t> data, Nonce const& nonce) const noexcept {
+        Block counter{};
+        for (std::size_t i = 0; i < 6; i++) counter[i] = nonce[i];
+        for (std::size_t offset = 0; offset < data.size(); offset += block_size) {
+            detail::xor_into(data.subspan(offset, std::min(block_size, data.size() - offset)), encrypt(counter));
+            for (std::size_t i = 11; i >= 6; i--) {
+                if (++counter[i] != 0) break;
+            }
+        }
+    }
+
+private:
+    template <std::size_t... T>
+    constexpr Block rounds(detail::Words state, std::index_sequence<T...>) const noexcept {
+        // 1st to (Rounds-1)th round, each with the theta of the following round; unrolled by the fold expression
+        ((state = detail::round(state, theta_round_key_[T + 1])), ...);
+        return detail::final_round(state, round_key_[Rounds]);
+    }
+
+    std::array<Block, Rounds + 1> round_key_{};
+    std::array<detail::Words, Rounds> theta_round_key_{};
+};
+
+/**
+ * Counter mode with an unexpanded key, see Cipher::ctr().
+ */
+constexpr void ctr(std::span<std::uint8_t> data, Key const& key, Nonce const& nonce) noexcept {
+    Cipher<>(key).ctr(data, nonce);
+}
+
+/**
+ * The Davies-Meyer-hash of dmhash(), continued from the chaining value |hash|.
+ * @return the hash, or nothing if the length of |data| is not a multiple of the blocksize
+ */
+constexpr std::optional<Block> dmhash(std::span<std::uint8_t const> data, Block hash = {}) noexcept {
+    if (data.size() % block_size != 0) return std::nullopt;
+    for (std::size_t offset = 0; offset < data.size(); offset += block_size) {
+        Block block{};
+        for (std::size_t i = 0; i < block_size; i++) block[i] = data[offset + i];
+        Block cipher = Cipher<>(static_cast<Key>(block)).encrypt(hash);
+        for (std::size_t i = 0; i < block_size; i++) hash[i] ^= cipher[i];
+    }
+    return hash;
+}
+
+/**
+ * The HMAC of hmac() with a 96 bit key.
+ * @return the tag, or nothing if the length of |data| is not a multiple of the blocksize
+ */
+constexpr std::optional<Block> hmac(std::span<std::uint8_t const> data, Key const& key) noexcept {
+    Block pad{};
+    for (std::size_t i = 0; i < block_size; i++) pad[i] = 54 ^ key[i];
+    std::optional<Block> inner = dmhash(data, *dmhash(pad));
+    if (!inner) return std::nullopt;
+    for (std::size_t i = 0; i < block_size; i++) pad[i] = 92 ^ key[i];
+    return dmhash(*inner, *dmhash(pad));
+}
+
+/**
+ * Authenticated encryption of ae_enc() in place: counter mode, then the HMAC over the first counter block and the ciphertext.
+ * @return the tag, or nothing (and the data untouched) if the length of |data| is not a multiple of the blocksize
+ */
+constexpr std::optional<Block> ae_enc(std::span<std::uint8_t> data, Key const& key, Nonce const& nonce) noexcept {
+    if (data.size() % block_size != 0) return std::nullopt;
+    Block pad{};
+    Block counter{};
+    for (std::size_t i = 0; i < 6; i++) counter[i] = nonce[i];
+    ctr(data, key, nonce);
+    for (std::size_t i = 0; i < block_size; i++) pad[i] = 54 ^ key[i];
+    Block inner = *dmhash(data, *dmhash(counter, *dmhash(pad)));
+    for (std::size_t i = 0; i < block_size; i++) pad[i] = 92 ^ key[i];
+    return dmhash(inner, *dmhash(pad));
+}
+
+/**
+ * Authenticated decryption of ae_dec() in place: the data is only decrypted if the tag matches (compared in constant time).
+ * @return whether the tag matched
+ */
+constexpr bool ae_dec(std::span<std::uint8_t> data, Key const& key, Nonce const& nonce, Block const& tag) noexcept {
+    if (data.size() % block_size != 0) return false;
+    Block pad{};
+    Block counter{};
+    std::uint8_t diff = 0;
+    for (std::size_t i = 0; i < 6; i++) counter[i] = nonce[i];
+    for (std::size_t i = 0; i < block_size; i++) pad[i] = 54 ^ key[i];
+    Block inner = *dmhash(data, *dmhash(counter, *dmhash(pad)));
+    for (std::size_t i = 0; i < block_size; i++) pad[i] = 92 ^ key[i];
+    Block expected = *dmhash(inner, *dmhash(pad));
+    for (std::size_t i = 0; i < block_size; i++) diff |= expected[i] ^ tag[i];
+    if (diff != 0) return false;
+    ctr(data, key, nonce);
+    return true;
+}
+
+} // namespace bksq
+
+#endif
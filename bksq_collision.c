@@ -0,0 +1,458 @@
+/** \file bksq_collision.c */
+
+/*
+	Collision search on the Davies-Meyer-hash truncated to |bits| bits, with the parallel collision search of
+	van Oorschot and Wiener: f maps a |bits| bit value x to the first |bits| bits of dmhash() of the block
+	salt || x (4 + 8 bytes, big endian). Every thread walks x, f(x), f(f(x)), ... from random starts until it hits a
+	distinguished point, i.e. a value whose lowest |dp_bits| bits are zero, and inserts the pair (point, start) into a
+	table shared by all threads. Two walks that end in the same point have merged, and walking both again from their
+	starts finds the two different preimages with the same image. The table holds only the distinguished points,
+	about 2^(bits/2 - dp_bits) of them instead of the 2^(bits/2) images of a birthday table.
+
+	Each thread advances DM_MANY_LANES walks in lock-step with dm_compress_lanes(). Insertion into the table is
+	lock-free: an empty slot is claimed with a compare-and-swap and published after its start is written. The table
+	can be saved to a checkpoint file while the search runs, and a later search with the same parameters resumes from it.
+
+	Like main.c, this file expects abgabe.c to be included before it.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BKSQ_COLLISION_NOT_FOUND 9 ///< bksq_collision_search(): |max_evaluations| reached without a collision
+#define BKSQ_COLLISION_MAX_WALK 20 ///< walks longer than this many times 2^dp_bits are given up (they are caught in a cycle)
+#define BKSQ_COLLISION_FLUSH 64 ///< lock-step rounds between two updates of the shared evaluation counter
+#define BKSQ_COLLISION_BUSY UINT64_MAX ///< slot key while the slot is being written
+#define BKSQ_COLLISION_MAGIC "BKSQDP01" ///< the first 8 bytes of a checkpoint file
+
+/**
+ * A collision of the truncated hash, and the statistics of the search, see bksq_collision_search().
+ */
+typedef struct {
+    uint8_t block[2][12]; ///< the two different blocks salt || x with the same truncated hash
+    uint64_t hash; ///< their truncated hash
+    uint64_t evaluations; ///< the number of evaluations of f in this run
+    uint64_t resumed_evaluations; ///< the number of evaluations of f before the checkpoint this run resumed from
+    uint64_t distinguished_points; ///< the number of distinguished points in the table
+    double seconds; ///< the time of this run
+} BKSQ_COLLISION;
+
+/**
+ * The parameters of bksq_collision_search().
+ */
+typedef struct {
+    int bits; ///< the number of hash bits that have to collide, 8 to 64
+    int dp_bits; ///< the number of zero bits of a distinguished point, 1 to |bits|-1; 0 for |bits|/4
+    uint32_t salt; ///< the first 4 bytes of every block, different salts give different collisions
+    int nthreads; ///< the number of searching threads
+    uint64_t max_evaluations; ///< the search stops after about this many evaluations of f (in total); 0 for no limit
+    char const *checkpoint_path; ///< the checkpoint file, read at the start if it exists; may be NULL
+    double checkpoint_interval; ///< the time in seconds between two checkpoints; 0 to write one at the end only
+    double report_interval; ///< the time in seconds between two calls of |report|
+    void (*report)(BKSQ_COLLISION const *progress); ///< called with the statistics so far; may be NULL
+} BKSQ_COLLISION_PARAMS;
+
+//A slot of the table of distinguished points; the point d is stored as (d >> dp_bits) + 1, 0 marks an empty slot:
+typedef struct {
+    uint64_t key; ///< the compacted distinguished point, 0 or BKSQ_COLLISION_BUSY
+    uint64_t start; ///< the start of the walk that ended in it
+} BKSQ_COLLISION_SLOT;
+
+//The state shared by the threads of bksq_collision_search():
+typedef struct {
+    BKSQ_COLLISION_PARAMS params; ///< the parameters, with |dp_bits| filled in
+    uint64_t value_mask; ///< the lowest |bits| bits
+    uint64_t dp_mask; ///< the lowest |dp_bits| bits
+    uint64_t max_walk; ///< the length from which on a walk is given up
+    uint64_t seed; ///< makes the starts of this run differ from those of the runs before
+    BKSQ_COLLISION_SLOT *table; ///< the distinguished points
+    uint64_t table_mask; ///< the number of slots minus one
+    uint64_t count; ///< the number of distinguished points in the table
+    uint64_t evaluations; ///< the number of evaluations of f so far
+    int stop; ///< set when the threads have to stop
+    int found; ///< set by the thread that found the collision
+    uint8_t error; ///< the first error, or 0
+    BKSQ_COLLISION *result; ///< receives the collision
+} BKSQ_COLLISION_SEARCH;
+
+//Worker thread of bksq_collision_search():
+typedef struct {
+    BKSQ_COLLISION_SEARCH *search;
+    uint64_t index;
+} BKSQ_COLLISION_WORKER;
+
+//The finalizer of splitmix64, to spread starts and table positions:
+static uint64_t bksq_collision_mix(uint64_t x){
+	x^=x>>30;
+	x*=0xbf58476d1ce4e5b9ULL;
+	x^=x>>27;
+	x*=0x94d049bb133111ebULL;
+	return x^(x>>31);
+}
+//The block salt || x, hashed by f:
+static void bksq_collision_block(uint8_t *block, uint32_t salt, uint64_t x){
+	int i;
+	for(i=0;i<4;i++)
+		block[i]=(uint8_t)(salt>>(24-8*i));
+	for(i=0;i<8;i++)
+		block[4+i]=(uint8_t)(x>>(56-8*i));
+}
+//The first |bits| bits of a hash:
+static uint64_t bksq_collision_truncate(uint8_t const *hash, int bits){
+	uint64_t v=0;
+	int i;
+	for(i=0;i<8;i++)
+		v=(v<<8)|hash[i];
+	return bits==64 ? v : v>>(64-bits);
+}
+//f(x), one evaluation on the calling thread:
+static uint64_t bksq_collision_f(BKSQ_COLLISION_SEARCH *s, uint64_t x){
+	uint8_t block[12];
+	uint8_t hash[12]={0};
+	bksq_collision_block(block,s->params.salt,x);
+	dm_compress(hash,block);
+	return bksq_collision_truncate(hash,s->params.bits);
+}
+
+/*
+	Inserts the distinguished point |dp| reached from |start|. Returns 0 if it was inserted, 1 if the table holds
+	it already from another start, which is then stored in |other_start|, 2 if it holds it from the same start,
+	and -1 if the table is full.
+*/
+static int bksq_collision_insert(BKSQ_COLLISION_SEARCH *s, uint64_t dp, uint64_t start, uint64_t *other_start){
+	uint64_t key=(dp>>s->params.dp_bits)+1;
+	uint64_t i=bksq_collision_mix(key)&s->table_mask;
+	uint64_t probes;
+	uint64_t k;
+	BKSQ_COLLISION_SLOT *slot;
+	if(__atomic_load_n(&s->count,__ATOMIC_RELAXED)>=(s->table_mask+1)/4*3)
+		return -1;
+	for(probes=0;probes<=s->table_mask;probes++,i=(i+1)&s->table_mask){
+		slot=&s->table[i];
+		k=__atomic_load_n(&slot->key,__ATOMIC_ACQUIRE);
+		if(k==0 && __atomic_compare_exchange_n(&slot->key,&k,BKSQ_COLLISION_BUSY,0,__ATOMIC_ACQUIRE,__ATOMIC_ACQUIRE)){
+			slot->start=start;
+			__atomic_fetch_add(&s->count,1,__ATOMIC_RELAXED);
+			__atomic_store_n(&slot->key,key,__ATOMIC_RELEASE);
+			return 0;
+		}
+		//If another thread claimed the slot first, the failed compare-and-swap loaded its key into k.
+		//A slot being written is published within a few instructions:
+		while(k==BKSQ_COLLISION_BUSY)
+			k=__atomic_load_n(&slot->key,__ATOMIC_ACQUIRE);
+		if(k==key){
+			*other_start=slot->start;
+			return slot->start==start ? 2 : 1;
+		}
+	}
+	return -1;
+}
+
+//The length of the walk from |start| to the first distinguished point, or 0 if it is caught in a cycle:
+static uint64_t bksq_collision_walk_length(BKSQ_COLLISION_SEARCH *s, uint64_t start){
+	uint64_t x=start;
+	uint64_t length;
+	for(length=1;length<=s->max_walk;length++){
+		x=bksq_collision_f(s,x);
+		if((x&s->dp_mask)==0)
+			return length;
+	}
+	return 0;
+}
+/*
+	Walks two merging walks again, the longer one first by the difference of the lengths, until their next values
+	are equal; returns 1 and the two preimages if the walks are different, 0 if one start lies on the other walk.
+*/
+static int bksq_collision_locate(BKSQ_COLLISION_SEARCH *s, uint64_t a, uint64_t length_a, uint64_t b, uint64_t length_b, uint64_t *preimage_a, uint64_t *preimage_b){
+	uint64_t evaluations=0;
+	uint64_t fa;
+	uint64_t fb;
+	int ret=0;
+	for(;length_a>length_b;length_a--,evaluations++)
+		a=bksq_collision_f(s,a);
+	for(;length_b>length_a;length_b--,evaluations++)
+		b=bksq_collision_f(s,b);
+	for(;a!=b && length_a>0;length_a--){
+		fa=bksq_collision_f(s,a);
+		fb=bksq_collision_f(s,b);
+		evaluations+=2;
+		if(fa==fb){
+			*preimage_a=a;
+			*preimage_b=b;
+			ret=1;
+			break;
+		}
+		a=fa;
+		b=fb;
+	}
+	__atomic_fetch_add(&s->evaluations,evaluations,__ATOMIC_RELAXED);
+	return ret;
+}
+
+//Records an error and stops the search:
+static void bksq_collision_fail(BKSQ_COLLISION_SEARCH *s, uint8_t error){
+	uint8_t none=0;
+	__atomic_compare_exchange_n(&s->error,&none,error,0,__ATOMIC_RELAXED,__ATOMIC_RELAXED);
+	__atomic_store_n(&s->stop,1,__ATOMIC_RELEASE);
+}
+//A walk of one lane ended in the distinguished point |dp|:
+static void bksq_collision_point(BKSQ_COLLISION_SEARCH *s, uint64_t dp, uint64_t start, uint64_t length){
+	uint64_t other_start;
+	uint64_t other_length;
+	uint64_t a;
+	uint64_t b;
+	int expected=0;
+	switch(bksq_collision_insert(s,dp,start,&other_start)){
+		case 1:
+			other_length=bksq_collision_walk_length(s,other_start);
+			if(other_length==0 || !bksq_collision_locate(s,start,length,other_start,other_length,&a,&b))
+				break;
+			if(!__atomic_compare_exchange_n(&s->found,&expected,1,0,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED))
+				break;
+			bksq_collision_block(s->result->block[0],s->params.salt,a);
+			bksq_collision_block(s->result->block[1],s->params.salt,b);
+			s->result->hash=bksq_collision_f(s,a);
+			__atomic_store_n(&s->stop,1,__ATOMIC_RELEASE);
+			break;
+		case -1:
+			bksq_collision_fail(s,OUT_OF_MEMORY);
+			break;
+		default:
+			break;
+	}
+}
+//Searching thread: DM_MANY_LANES walks in lock-step, each restarted from a fresh start after a distinguished point:
+static void *bksq_collision_worker(void *arg){
+	BKSQ_COLLISION_WORKER *w=(BKSQ_COLLISION_WORKER *)arg;
+	BKSQ_COLLISION_SEARCH *s=w->search;
+	uint8_t hash[DM_MANY_LANES][16];
+	uint8_t block[DM_MANY_LANES][12];
+	uint8_t const *blocks[DM_MANY_LANES];
+	uint64_t start[DM_MANY_LANES];
+	uint64_t x[DM_MANY_LANES];
+	uint64_t length[DM_MANY_LANES];
+	uint64_t walks=0;
+	uint64_t total;
+	int round;
+	int l;
+	for(l=0;l<DM_MANY_LANES;l++){
+		blocks[l]=block[l];
+		length[l]=s->max_walk+1;
+	}
+	while(!__atomic_load_n(&s->stop,__ATOMIC_ACQUIRE)){
+		for(round=0;round<BKSQ_COLLISION_FLUSH;round++){
+			for(l=0;l<DM_MANY_LANES;l++){
+				//A new walk for every lane that reached a distinguished point or gave up:
+				if(length[l]>s->max_walk){
+					start[l]=bksq_collision_mix(s->seed^bksq_collision_mix((w->index<<40)^walks++))&s->value_mask;
+					x[l]=start[l];
+					length[l]=0;
+				}
+				bksq_collision_block(block[l],s->params.salt,x[l]);
+			}
+			memset(hash,0,sizeof(hash));
+			dm_compress_lanes(hash,blocks);
+			for(l=0;l<DM_MANY_LANES;l++){
+				x[l]=bksq_collision_truncate(hash[l],s->params.bits);
+				length[l]++;
+				if((x[l]&s->dp_mask)==0){
+					bksq_collision_point(s,x[l],start[l],length[l]);
+					length[l]=s->max_walk+1;
+				}
+			}
+		}
+		total=__atomic_add_fetch(&s->evaluations,BKSQ_COLLISION_FLUSH*DM_MANY_LANES,__ATOMIC_RELAXED);
+		if(s->params.max_evaluations!=0 && total>=s->params.max_evaluations)
+			__atomic_store_n(&s->stop,1,__ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/*
+	Checkpoint file: the magic, then bits, dp_bits, salt, the number of runs, the number of evaluations and the
+	number of points as 64 bit words in host byte order, then every point and its start.
+*/
+static uint8_t bksq_collision_save(BKSQ_COLLISION_SEARCH *s, uint64_t runs, uint64_t evaluations){
+	char tmp_path[4096];
+	uint64_t header[6];
+	uint64_t entry[2];
+	uint64_t i;
+	uint64_t k;
+	FILE *f;
+	int ok;
+	if(snprintf(tmp_path,sizeof(tmp_path),"%s.tmp",s->params.checkpoint_path)>=(int)sizeof(tmp_path))
+		return FILE_ERROR;
+	f=fopen(tmp_path,"wb");
+	if(f==NULL)
+		return FILE_ERROR;
+	header[0]=(uint64_t)s->params.bits;
+	header[1]=(uint64_t)s->params.dp_bits;
+	header[2]=s->params.salt;
+	header[3]=runs;
+	header[4]=evaluations;
+	header[5]=0;
+	ok=fwrite(BKSQ_COLLISION_MAGIC,1,8,f)==8 && fwrite(header,8,6,f)==6;
+	//Points inserted meanwhile are either complete or skipped, the table is never locked:
+	for(i=0;i<=s->table_mask && ok;i++){
+		k=__atomic_load_n(&s->table[i].key,__ATOMIC_ACQUIRE);
+		if(k==0 || k==BKSQ_COLLISION_BUSY)
+			continue;
+		entry[0]=(k-1)<<s->params.dp_bits;
+		entry[1]=s->table[i].start;
+		ok=fwrite(entry,8,2,f)==2;
+		header[5]++;
+	}
+	ok=ok && fseek(f,8+5*8,SEEK_SET)==0 && fwrite(&header[5],8,1,f)==1;
+	if(fclose(f)!=0 || !ok || rename(tmp_path,s->params.checkpoint_path)!=0){
+		remove(tmp_path);
+		return FILE_ERROR;
+	}
+	return 0;
+}
+//Reads the header of a checkpoint; returns 0 if it belongs to the parameters:
+static uint8_t bksq_collision_load_header(FILE *f, BKSQ_COLLISION_PARAMS const *params, uint64_t header[6]){
+	char magic[8];
+	if(fread(magic,1,8,f)!=8 || memcmp(magic,BKSQ_COLLISION_MAGIC,8)!=0 || fread(header,8,6,f)!=6)
+		return FILE_ERROR;
+	if(header[0]!=(uint64_t)params->bits || header[1]!=(uint64_t)params->dp_bits || header[2]!=params->salt)
+		return FILE_ERROR;
+	return 0;
+}
+
+static double bksq_collision_elapsed(struct timespec const *start){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (double)(now.tv_sec-start->tv_sec)+(now.tv_nsec-start->tv_nsec)*1e-9;
+}
+
+/**
+ * Searches a collision of dmhash() truncated to |params->bits| bits with distinguished points on |params->nthreads|
+ * threads, see above. The calling thread only reports the progress and writes the checkpoints.
+ * About 1.25 * 2^(bits/2) evaluations are needed, plus about 2^dp_bits per thread and lane at the end.
+ * @param params the parameters, see BKSQ_COLLISION_PARAMS
+ * @param result receives the collision and the statistics of the search
+ * @return Returns 0, if a collision was found (even if the last checkpoint failed); BKSQ_COLLISION_NOT_FOUND if |max_evaluations| was reached first;
+ *         INVALID_DATA_LENGTH if |bits| or |dp_bits| are out of range; FILE_ERROR if the checkpoint could not be read
+ *         or written, or belongs to other parameters; OUT_OF_MEMORY if the table is full; THREAD_ERROR
+ */
+uint8_t bksq_collision_search(BKSQ_COLLISION_PARAMS const *params, BKSQ_COLLISION *result) {
+    BKSQ_COLLISION_SEARCH s;
+    BKSQ_COLLISION_WORKER *workers;
+    pthread_t *threads;
+    FILE *checkpoint=NULL;
+    uint64_t header[6]={0};
+    uint64_t entry[2];
+    uint64_t expected;
+    uint64_t slots;
+    uint64_t unused;
+    struct timespec start;
+    struct timespec tick={0,20000000};
+    double now;
+    double next_report;
+    double next_checkpoint;
+    uint8_t ret;
+    uint64_t n;
+    int started;
+    int i;
+
+    s.params=*params;
+    if (s.params.dp_bits == 0) s.params.dp_bits=s.params.bits/4;
+    if (s.params.bits < 8 || s.params.bits > 64 || s.params.dp_bits < 1 || s.params.dp_bits >= s.params.bits) return INVALID_DATA_LENGTH;
+    if (s.params.nthreads < 1) s.params.nthreads=1;
+
+    //Resuming: the table has to hold the saved points as well
+    if (s.params.checkpoint_path != NULL) {
+        checkpoint=fopen(s.params.checkpoint_path,"rb");
+        if (checkpoint == NULL && errno != ENOENT) return FILE_ERROR;
+        if (checkpoint != NULL && bksq_collision_load_header(checkpoint,&s.params,header) != 0) {
+            fclose(checkpoint);
+            return FILE_ERROR;
+        }
+    }
+    expected=((uint64_t)1<<(s.params.bits/2))>>s.params.dp_bits;
+    for(slots=1024;slots<8*expected || slots<4*header[5];slots*=2);
+
+    s.value_mask=s.params.bits==64 ? ~(uint64_t)0 : ((uint64_t)1<<s.params.bits)-1;
+    s.dp_mask=((uint64_t)1<<s.params.dp_bits)-1;
+    //Saturated below UINT64_MAX, so that the shift cannot overflow for large dp_bits and max_walk+1 stays a valid marker:
+    s.max_walk=s.params.dp_bits>=59 ? UINT64_MAX-1 : (uint64_t)BKSQ_COLLISION_MAX_WALK<<s.params.dp_bits;
+    s.seed=bksq_collision_mix(header[3]+1+((uint64_t)s.params.salt<<32));
+    s.table=(BKSQ_COLLISION_SLOT *)calloc(slots,sizeof(BKSQ_COLLISION_SLOT));
+    s.table_mask=slots-1;
+    s.count=0;
+    s.evaluations=0;
+    s.stop=0;
+    s.found=0;
+    s.error=0;
+    s.result=result;
+    workers=(BKSQ_COLLISION_WORKER *)malloc(s.params.nthreads*sizeof(BKSQ_COLLISION_WORKER));
+    threads=(pthread_t *)malloc(s.params.nthreads*sizeof(pthread_t));
+    if (s.table == NULL || workers == NULL || threads == NULL) {
+        if (checkpoint != NULL) fclose(checkpoint);
+        free(s.table);
+        free(workers);
+        free(threads);
+        return OUT_OF_MEMORY;
+    }
+    ret=0;
+    for(n=0;n<header[5] && checkpoint!=NULL;n++){
+    	if(fread(entry,8,2,checkpoint)!=2){
+    		ret=FILE_ERROR;
+    		break;
+    	}
+    	bksq_collision_insert(&s,entry[0],entry[1],&unused);
+    }
+    if (checkpoint != NULL) fclose(checkpoint);
+    memset(result,0,sizeof(BKSQ_COLLISION));
+    result->resumed_evaluations=header[4];
+    if (ret != 0) {
+        free(s.table);
+        free(workers);
+        free(threads);
+        return ret;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    for(started=0;started<s.params.nthreads;started++){
+    	workers[started].search=&s;
+    	workers[started].index=(uint64_t)started;
+    	if(pthread_create(&threads[started],NULL,bksq_collision_worker,&workers[started])!=0){
+    		bksq_collision_fail(&s,THREAD_ERROR);
+    		break;
+    	}
+    }
+
+    next_report=s.params.report_interval;
+    next_checkpoint=s.params.checkpoint_interval;
+    while(!__atomic_load_n(&s.stop,__ATOMIC_ACQUIRE)){
+    	nanosleep(&tick,NULL);
+    	now=bksq_collision_elapsed(&start);
+    	if(s.params.report!=NULL && s.params.report_interval>0 && now>=next_report){
+    		result->evaluations=__atomic_load_n(&s.evaluations,__ATOMIC_RELAXED);
+    		result->distinguished_points=__atomic_load_n(&s.count,__ATOMIC_RELAXED);
+    		result->seconds=now;
+    		s.params.report(result);
+    		next_report=now+s.params.report_interval;
+    	}
+    	if(s.params.checkpoint_path!=NULL && s.params.checkpoint_interval>0 && now>=next_checkpoint){
+    		if(bksq_collision_save(&s,header[3]+1,header[4]+__atomic_load_n(&s.evaluations,__ATOMIC_RELAXED))!=0)
+    			bksq_collision_fail(&s,FILE_ERROR);
+    		next_checkpoint=now+s.params.checkpoint_interval;
+    	}
+    }
+    for(i=0;i<started;i++)
+    	pthread_join(threads[i],NULL);
+
+    result->evaluations=s.evaluations;
+    result->distinguished_points=s.count;
+    result->seconds=bksq_collision_elapsed(&start);
+    ret=s.error;
+    if (ret == 0 && s.params.checkpoint_path != NULL) ret=bksq_collision_save(&s,header[3]+1,header[4]+s.evaluations);
+    if (s.found) ret=0;
+    else if (ret == 0) ret=BKSQ_COLLISION_NOT_FOUND;
+    free(s.table);
+    free(workers);
+    free(threads);
+    return ret;
+}
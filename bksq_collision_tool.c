@@ -0,0 +1,102 @@
+/** \file bksq_collision_tool.c */
+
+/**
+ * bksq-collide: finds a collision of the truncated Davies-Meyer-hash with bksq_collision_search().
+ *
+ * Usage: bksq-collide -b BITS [-d DPBITS] [-s SALT] [-t THREADS] [-m MAXEVALS] [-c CHECKPOINT [-i SECONDS]] [-r SECONDS]
+ *
+ * BITS is the number of hash bits that have to collide, DPBITS the number of zero bits of a distinguished point
+ * (default: BITS/4), SALT (hex, 4 bytes) the first 4 bytes of every block and THREADS the number of searching threads
+ * (default: the number of CPUs). With CHECKPOINT the table of distinguished points is saved every SECONDS seconds
+ * (default: 60) and at the end, and a search with the same BITS, DPBITS and SALT resumes from it.
+ * The progress is reported on stderr every SECONDS seconds of -r (default: 1, 0 for none).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "abgabe.c"
+#include "bksq_collision.c"
+
+static int usage(char const *name) {
+    fprintf(stderr, "usage: %s -b BITS [-d DPBITS] [-s SALT] [-t THREADS] [-m MAXEVALS] [-c CHECKPOINT [-i SECONDS]] [-r SECONDS]\n", name);
+    return EXIT_FAILURE;
+}
+
+static void report(BKSQ_COLLISION const *progress) {
+    fprintf(stderr, "%14llu evaluations %10llu points %8.1f s %12.0f evaluations/s\n",
+            (unsigned long long) (progress->resumed_evaluations + progress->evaluations),
+            (unsigned long long) progress->distinguished_points, progress->seconds,
+            progress->seconds > 0 ? progress->evaluations / progress->seconds : 0.0);
+}
+
+static void print_hex(char const *label, uint8_t const *data, size_t length) {
+    size_t i;
+    printf("%s", label);
+    for (i = 0; i < length; i++) printf("%02x", data[i]);
+    printf("\n");
+}
+
+/**
+ *  Parses the arguments, runs bksq_collision_search() and prints the collision
+ */
+int main(int argc, char** argv) {
+    BKSQ_COLLISION_PARAMS params;
+    BKSQ_COLLISION result;
+    uint8_t hash[12];
+    uint8_t ret;
+    int i;
+
+    memset(&params, 0, sizeof(params));
+    params.nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    params.checkpoint_interval = 60;
+    params.report_interval = 1;
+    params.report = report;
+    for (i = 1; i < argc; i++) {
+        if (i + 1 >= argc) return usage(argv[0]);
+        if (strcmp(argv[i], "-b") == 0) params.bits = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0) params.dp_bits = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0) params.salt = (uint32_t) strtoul(argv[++i], NULL, 16);
+        else if (strcmp(argv[i], "-t") == 0) params.nthreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0) params.max_evaluations = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-c") == 0) params.checkpoint_path = argv[++i];
+        else if (strcmp(argv[i], "-i") == 0) params.checkpoint_interval = atof(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0) params.report_interval = atof(argv[++i]);
+        else return usage(argv[0]);
+    }
+    if (params.bits == 0) return usage(argv[0]);
+
+    ret = bksq_collision_search(&params, &result);
+    report(&result);
+
+    switch (ret) {
+        case DM_OK:
+            print_hex("block 1:   ", result.block[0], 12);
+            print_hex("block 2:   ", result.block[1], 12);
+            dmhash(result.block[0], BLOCKSIZE, hash);
+            print_hex("dmhash 1:  ", hash, 12);
+            dmhash(result.block[1], BLOCKSIZE, hash);
+            print_hex("dmhash 2:  ", hash, 12);
+            printf("%d bits:   %0*llx\n", params.bits, (params.bits + 3) / 4, (unsigned long long) result.hash);
+            return (EXIT_SUCCESS);
+        case BKSQ_COLLISION_NOT_FOUND:
+            fprintf(stderr, "%s: no collision within %llu evaluations\n", argv[0], (unsigned long long) params.max_evaluations);
+            break;
+        case INVALID_DATA_LENGTH:
+            fprintf(stderr, "%s: BITS must be 8 to 64 and DPBITS 1 to BITS-1\n", argv[0]);
+            break;
+        case FILE_ERROR:
+            fprintf(stderr, "%s: %s: cannot read or write the checkpoint, or it belongs to other parameters\n", argv[0], params.checkpoint_path);
+            break;
+        case OUT_OF_MEMORY:
+            fprintf(stderr, "%s: the table of distinguished points is full or too large, use more DPBITS\n", argv[0]);
+            break;
+        default:
+            fprintf(stderr, "%s: cannot start the threads\n", argv[0]);
+            break;
+    }
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,203 @@
+/** \file bksq_file.c */
+
+/*
+	Encryption of files at rest, directly on memory mappings of the files: the data never passes through a userspace buffer.
+	The file is mapped in windows of BKSQ_FILE_WINDOW bytes, so files larger than the RAM work as well, and every
+	window is split by counter range between the threads of a BKSQ_THREAD_POOL.
+
+	Like main.c, this file expects abgabe.c to be included before it.
+*/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BKSQ_FILE_CTR 0 ///< bksq_file(): counter mode, the output has the length of the input
+#define BKSQ_FILE_AE_ENC 1 ///< bksq_file(): authenticated encryption as ae_enc(), the tag is appended to the output
+#define BKSQ_FILE_AE_DEC 2 ///< bksq_file(): authenticated decryption as ae_dec(), the tag at the end of the input is verified first
+
+#define BKSQ_FILE_WINDOW ((size_t)12*65536*128) ///< bytes mapped at once (96 MiB): a multiple of the blocksize and of every page size up to 64 KiB
+#define BKSQ_FILE_MIN_CHUNK (12*4096) ///< a window is only split between the threads into chunks of at least this many bytes
+
+//Maps |length| bytes of |fd| at |offset| for one sequential pass; returns NULL on failure:
+static uint8_t *bksq_file_map(int fd, off_t offset, size_t length, int writable){
+	void *p=mmap(NULL,length,writable ? PROT_READ|PROT_WRITE : PROT_READ,MAP_SHARED|MAP_POPULATE,fd,offset);
+	if(p==MAP_FAILED)
+		return NULL;
+	madvise(p,length,MADV_SEQUENTIAL);
+	return (uint8_t *)p;
+}
+
+//Counter mode over one window from |in| to |out| (which may be the same); |offset| is the byte position of the window in the file:
+static void bksq_file_ctr_window(uint8_t const *in, uint8_t *out, size_t length, uint64_t offset, uint8_t const *nonce, BKSQ_KEY_SCHEDULE const *ks, BKSQ_THREAD_POOL *pool){
+	CTR_PARALLEL_JOB job;
+	size_t nchunks;
+	size_t i;
+	uint8_t keystream[12];
+	job.in=in;
+	job.data=out;
+	job.nblocks=length/12;
+	job.ks=ks;
+	for(i=0;i<6;i++)
+		job.nonce_counter[i]=nonce[i];
+	for(i=6;i<12;i++)
+		job.nonce_counter[i]=0;
+	counter_add(job.nonce_counter,offset/12);
+	nchunks=pool!=NULL ? (size_t)(pool->nthreads+1)*CHUNKS_PER_THREAD : 1;
+	if(job.nblocks*12/BKSQ_FILE_MIN_CHUNK<nchunks)
+		nchunks=job.nblocks*12/BKSQ_FILE_MIN_CHUNK;
+	if(nchunks<2){
+		ctr_blocks_to(in,out,job.nblocks,job.nonce_counter,ks);
+	}
+	else{
+		job.chunk_blocks=(job.nblocks+nchunks-1)/nchunks;
+		bksq_pool_run(pool,ctr_parallel_job,&job,(int)((job.nblocks+job.chunk_blocks-1)/job.chunk_blocks));
+		counter_add(job.nonce_counter,job.nblocks);
+	}
+	//A partial last block (counter mode only) uses the beginning of its keystream block, as with ctr_stream_update():
+	if(length%12!=0){
+		bksq_encrypt_blocks_expanded(job.nonce_counter,keystream,1,ks);
+		for(i=0;i<length%12;i++)
+			out[12*job.nblocks+i]=in[12*job.nblocks+i]^keystream[i];
+	}
+}
+
+//Feeds |length| bytes of |fd| into |mac|, window by window:
+static uint8_t bksq_file_mac(int fd, size_t length, HMAC_CTX *mac){
+	size_t offset;
+	size_t window;
+	uint8_t *p;
+	for(offset=0;offset<length;offset+=window){
+		window=length-offset<BKSQ_FILE_WINDOW ? length-offset : BKSQ_FILE_WINDOW;
+		p=bksq_file_map(fd,(off_t)offset,window,0);
+		if(p==NULL)
+			return FILE_ERROR;
+		hmac_update(mac,p,window);
+		munmap(p,window);
+	}
+	return HMAC_OK;
+}
+
+/**
+ * Encrypts or decrypts a file with the cipher working directly on memory mappings of the files.
+ * The modes give the same output as ctr(), ae_enc() and ae_dec() on the whole content, with the 12 byte tag
+ * stored at the end of the file. Unlike those, the length is not limited to 2^32 bits, and in counter mode
+ * it does not have to be a multiple of the blocklength either.
+ * @param in_path the input file
+ * @param out_path the output file, created or truncated; NULL to work in place on the input file, which is the only
+ *        way to do so: another path to the input file is rejected before the output is truncated
+ * @param mode BKSQ_FILE_CTR, BKSQ_FILE_AE_ENC or BKSQ_FILE_AE_DEC
+ * @param key the 96 bit (12 byte) key
+ * @param nonce the 48 bit (6 byte) nonce
+ * @param pool the worker threads, see bksq_pool_create(); NULL to work on the calling thread only
+ * @return Returns 0, if successful; INVALID_TAG if the tag did not match, then no output is written;
+ *         INVALID_DATA_LENGTH if the data of an authenticated mode is not a multiple of the blocklength; FILE_ERROR
+ *         for the input file, OUTPUT_FILE_ERROR for the output file (errno tells why); SAME_FILE if |out_path| names the input file
+ */
+uint8_t bksq_file(char const *in_path, char const *out_path, int const mode, uint8_t const *key, uint8_t const *nonce, BKSQ_THREAD_POOL *pool) {
+    BKSQ_KEY_SCHEDULE ks;
+    HMAC_KEY_SCHEDULE hks;
+    HMAC_CTX mac;
+    uint8_t nonce_counter[12];
+    uint8_t tag[12];
+    uint8_t expected_tag[12];
+    struct stat st;
+    struct stat out_st;
+    size_t length;
+    size_t offset;
+    size_t window;
+    uint8_t *in;
+    uint8_t *out;
+    uint8_t ret=CTR_OK;
+    uint8_t out_error=out_path==NULL ? FILE_ERROR : OUTPUT_FILE_ERROR;
+    int i;
+    int in_fd;
+    int out_fd;
+
+    in_fd=open(in_path,out_path==NULL ? O_RDWR : O_RDONLY);
+    if (in_fd < 0) return FILE_ERROR;
+    if (fstat(in_fd,&st) != 0) {
+        close(in_fd);
+        return FILE_ERROR;
+    }
+    //O_TRUNC on the output would destroy the input before it is read, under any path or hard link to it:
+    if (out_path != NULL && stat(out_path,&out_st) == 0 && out_st.st_dev == st.st_dev && out_st.st_ino == st.st_ino) {
+        close(in_fd);
+        return SAME_FILE;
+    }
+    length=(size_t)st.st_size;
+    if (mode == BKSQ_FILE_AE_DEC) {
+        if (length < 12) {
+            close(in_fd);
+            return INVALID_DATA_LENGTH;
+        }
+        length-=12;
+    }
+    if (mode != BKSQ_FILE_CTR && (length % 12) != 0) {
+        close(in_fd);
+        return INVALID_DATA_LENGTH;
+    }
+
+    bksq_key_expand(key,&ks);
+    for(i=0;i<6;i++)
+    	nonce_counter[i]=nonce[i];
+    for(i=6;i<12;i++)
+    	nonce_counter[i]=0;
+    if (mode != BKSQ_FILE_CTR) {
+        hmac_key_expand(key,BLOCKSIZE,&hks);
+        hmac_init(&mac,&hks);
+        hmac_update(&mac,nonce_counter,12);
+    }
+
+    //Verify before decrypt: the ciphertext is MACed in a first pass, and nothing is written unless the tag matches:
+    if (mode == BKSQ_FILE_AE_DEC) {
+        if (bksq_file_mac(in_fd,length,&mac) != HMAC_OK || pread(in_fd,tag,12,(off_t)length) != 12) {
+            close(in_fd);
+            return FILE_ERROR;
+        }
+        hmac_final(&mac,expected_tag);
+        if (tag_compare(tag,expected_tag) != 0) {
+            close(in_fd);
+            return INVALID_TAG;
+        }
+    }
+
+    if (out_path == NULL) {
+        out_fd=in_fd;
+    } else {
+        out_fd=open(out_path,O_RDWR|O_CREAT|O_TRUNC,0666);
+        if (out_fd < 0 || ftruncate(out_fd,(off_t)length) != 0) {
+            if (out_fd >= 0) close(out_fd);
+            close(in_fd);
+            return OUTPUT_FILE_ERROR;
+        }
+    }
+
+    for(offset=0;offset<length && ret==CTR_OK;offset+=window){
+    	window=length-offset<BKSQ_FILE_WINDOW ? length-offset : BKSQ_FILE_WINDOW;
+    	in=bksq_file_map(in_fd,(off_t)offset,window,out_path==NULL);
+    	out=out_path==NULL ? in : bksq_file_map(out_fd,(off_t)offset,window,1);
+    	if (in == NULL || out == NULL) {
+    		ret=in == NULL ? FILE_ERROR : out_error;
+    	} else {
+    		bksq_file_ctr_window(in,out,window,offset,nonce,&ks,pool);
+    		//Encrypt-then-MAC on the window just written, while it is still mapped:
+    		if (mode == BKSQ_FILE_AE_ENC)
+    			hmac_update(&mac,out,window);
+    	}
+    	if (out != NULL && out != in) munmap(out,window);
+    	if (in != NULL) munmap(in,window);
+    }
+
+    if (ret == CTR_OK && mode == BKSQ_FILE_AE_ENC) {
+        hmac_final(&mac,tag);
+        if (pwrite(out_fd,tag,12,(off_t)length) != 12) ret=out_error;
+    }
+    if (ret == CTR_OK && mode == BKSQ_FILE_AE_DEC && out_path == NULL) {
+        if (ftruncate(out_fd,(off_t)length) != 0) ret=FILE_ERROR;
+    }
+    if (out_fd != in_fd) close(out_fd);
+    close(in_fd);
+    return ret;
+}
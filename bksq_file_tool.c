@@ -0,0 +1,105 @@
+/** \file bksq_file_tool.c */
+
+/**
+ * bksq-file: encrypts files at rest with bksq_file().
+ *
+ * Usage: bksq-file ctr|enc|dec -k KEY -n NONCE [-t THREADS] INPUT [OUTPUT]
+ *
+ * KEY (12 bytes) and NONCE (6 bytes) are given in hex. ctr en- and decrypts in counter mode, enc appends the
+ * authentication tag, dec verifies and removes it. Without OUTPUT the input file is changed in place.
+ * THREADS is the number of worker threads besides the main thread (default: one less than the number of CPUs).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "abgabe.c"
+#include "bksq_file.c"
+
+//Parses exactly |length| bytes of hex; returns 0 on success:
+static int parse_hex(char const *hex, uint8_t *res, size_t length) {
+    size_t i;
+    unsigned int byte;
+    if (strlen(hex) != 2 * length) return 1;
+    for (i = 0; i < length; i++) {
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return 1;
+        res[i] = (uint8_t) byte;
+    }
+    return 0;
+}
+
+static int usage(char const *name) {
+    fprintf(stderr, "usage: %s ctr|enc|dec -k KEY -n NONCE [-t THREADS] INPUT [OUTPUT]\n", name);
+    return EXIT_FAILURE;
+}
+
+/**
+ *  Parses the arguments and runs bksq_file()
+ */
+int main(int argc, char** argv) {
+    uint8_t key[12];
+    uint8_t nonce[6];
+    int have_key = 0;
+    int have_nonce = 0;
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    int mode;
+    char const *paths[2] = {NULL, NULL};
+    int npaths = 0;
+    BKSQ_THREAD_POOL pool;
+    uint8_t ret;
+    int i;
+
+    if (argc < 2) return usage(argv[0]);
+    if (strcmp(argv[1], "ctr") == 0) mode = BKSQ_FILE_CTR;
+    else if (strcmp(argv[1], "enc") == 0) mode = BKSQ_FILE_AE_ENC;
+    else if (strcmp(argv[1], "dec") == 0) mode = BKSQ_FILE_AE_DEC;
+    else return usage(argv[0]);
+
+    for (i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            if (parse_hex(argv[++i], key, 12) != 0) return usage(argv[0]);
+            have_key = 1;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            if (parse_hex(argv[++i], nonce, 6) != 0) return usage(argv[0]);
+            have_nonce = 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (npaths < 2) {
+            paths[npaths++] = argv[i];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (!have_key || !have_nonce || npaths == 0) return usage(argv[0]);
+    if (nthreads < 0) nthreads = 0;
+
+    if (bksq_pool_create(&pool, nthreads) != 0) {
+        fprintf(stderr, "%s: cannot start %d threads\n", argv[0], nthreads);
+        return EXIT_FAILURE;
+    }
+    ret = bksq_file(paths[0], paths[1], mode, key, nonce, &pool);
+    bksq_pool_destroy(&pool);
+
+    switch (ret) {
+        case CTR_OK:
+            return (EXIT_SUCCESS);
+        case INVALID_TAG:
+            fprintf(stderr, "%s: %s: authentication failed, nothing was written\n", argv[0], paths[0]);
+            break;
+        case INVALID_DATA_LENGTH:
+            fprintf(stderr, "%s: %s: the length must be a multiple of 12 bytes for enc and dec\n", argv[0], paths[0]);
+            break;
+        case SAME_FILE:
+            fprintf(stderr, "%s: %s and %s are the same file, leave out OUTPUT to work in place\n", argv[0], paths[0], paths[1]);
+            break;
+        case OUTPUT_FILE_ERROR:
+            perror(paths[1]);
+            break;
+        default:
+            perror(paths[0]);
+            break;
+    }
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,370 @@
+/** \file bksq_keycache.c */
+
+/*
+	A cache of expanded keys for services with many keys: it maps a raw 96 bit key to its BKSQ_KEY_SCHEDULE and its
+	HMAC_KEY_SCHEDULE, so ctr(), hmac(), ae_enc() and ae_dec() on a known key skip the ten round_key_evolution()
+	steps of the cipher key and the two Davies-Meyer steps of the HMAC key.
+
+	The cache is split into KEY_CACHE_SHARDS shards by a keyed fingerprint of the key (a hash with a random secret
+	of the cache, so that the shards and buckets of given keys cannot be predicted from outside). Every shard has a
+	lock of its own, a fixed number of entries, chained buckets and an LRU list; when it is full, the least recently
+	used entry is wiped and reused, so the memory is bounded by the capacity given to key_cache_create().
+	A miss expands the key outside the lock. The schedules are copied out under the lock, so an entry can be evicted
+	at any time.
+
+	Like main.c, this file expects abgabe.c to be included before it.
+*/
+
+#include <sys/random.h>
+#include <time.h>
+
+#define KEY_CACHE_SHARDS 16 ///< number of independently locked parts of a key cache
+#define KEY_CACHE_NONE (-1) ///< end of a bucket chain or of the LRU list
+
+//An entry of a key cache; the raw key is round_key[0] of |ks|:
+typedef struct {
+    BKSQ_KEY_SCHEDULE ks; ///< the expanded cipher key
+    HMAC_KEY_SCHEDULE hks; ///< the expanded HMAC key
+    uint64_t fingerprint; ///< the keyed fingerprint of the key
+    int32_t chain; ///< the next entry in the same bucket
+    int32_t newer; ///< the next more recently used entry
+    int32_t older; ///< the next less recently used entry
+} KEY_CACHE_ENTRY;
+
+//A shard of a key cache:
+typedef struct {
+    pthread_mutex_t lock; ///< protects the shard
+    KEY_CACHE_ENTRY *entries; ///< |capacity| entries, the first |used| of them in use
+    int32_t *buckets; ///< the first entry of every bucket
+    uint32_t bucket_mask; ///< the number of buckets minus one
+    int32_t capacity; ///< the number of entries
+    int32_t used; ///< the number of entries in use
+    int32_t newest; ///< the most recently used entry
+    int32_t oldest; ///< the least recently used entry, evicted next
+    uint64_t hits; ///< see KEY_CACHE_STATS
+    uint64_t misses; ///< see KEY_CACHE_STATS
+    uint64_t evictions; ///< see KEY_CACHE_STATS
+} KEY_CACHE_SHARD;
+
+/**
+ * A cache of expanded keys, see key_cache_create(); safe to use from any number of threads.
+ */
+typedef struct {
+    KEY_CACHE_SHARD shard[KEY_CACHE_SHARDS]; ///< the shards
+    uint64_t secret[2]; ///< the key of the fingerprint
+} BKSQ_KEY_CACHE;
+
+/**
+ * The counters of a key cache, summed over the shards, see key_cache_stats().
+ */
+typedef struct {
+    uint64_t hits; ///< the lookups that found their key
+    uint64_t misses; ///< the lookups that had to expand their key
+    uint64_t evictions; ///< the entries that were wiped to make room
+    uint64_t entries; ///< the number of keys in the cache
+    uint64_t capacity; ///< the number of keys the cache can hold
+} KEY_CACHE_STATS;
+
+//Wipes key material the compiler must not optimize away:
+static void key_cache_wipe(void *p, size_t length){
+	volatile uint8_t *v=(volatile uint8_t *)p;
+	size_t i;
+	for(i=0;i<length;i++)
+		v[i]=0;
+}
+//The keyed fingerprint: the key in two words, each mixed with a secret word by multiply and xorshift:
+static uint64_t key_cache_fingerprint(BKSQ_KEY_CACHE const *c, uint8_t const *key){
+	uint64_t a=0;
+	uint64_t b=0;
+	int i;
+	for(i=0;i<8;i++)
+		a|=(uint64_t)key[i]<<(8*i);
+	for(i=8;i<12;i++)
+		b|=(uint64_t)key[i]<<(8*(i-8));
+	a^=c->secret[0];
+	b^=c->secret[1];
+	a*=0x9e3779b97f4a7c15ULL;
+	b=(b^(a>>29))*0xbf58476d1ce4e5b9ULL;
+	a^=b^(b>>32);
+	a*=0x94d049bb133111ebULL;
+	return a^(a>>31);
+}
+
+//Moves entry |e| to the front of the LRU list (|e| is unlinked):
+static void key_cache_push_newest(KEY_CACHE_SHARD *s, int32_t e){
+	s->entries[e].older=s->newest;
+	s->entries[e].newer=KEY_CACHE_NONE;
+	if(s->newest!=KEY_CACHE_NONE)
+		s->entries[s->newest].newer=e;
+	s->newest=e;
+	if(s->oldest==KEY_CACHE_NONE)
+		s->oldest=e;
+}
+//Takes entry |e| out of the LRU list:
+static void key_cache_unlink(KEY_CACHE_SHARD *s, int32_t e){
+	KEY_CACHE_ENTRY *entry=&s->entries[e];
+	if(entry->newer!=KEY_CACHE_NONE)
+		s->entries[entry->newer].older=entry->older;
+	else
+		s->newest=entry->older;
+	if(entry->older!=KEY_CACHE_NONE)
+		s->entries[entry->older].newer=entry->newer;
+	else
+		s->oldest=entry->newer;
+}
+//Finds the entry of |key|, or KEY_CACHE_NONE. Called with the lock held:
+static int32_t key_cache_find(KEY_CACHE_SHARD *s, uint64_t fingerprint, uint8_t const *key){
+	int32_t e=s->buckets[(fingerprint>>32)&s->bucket_mask];
+	for(;e!=KEY_CACHE_NONE;e=s->entries[e].chain)
+		if(s->entries[e].fingerprint==fingerprint && memcmp(s->entries[e].ks.round_key[0],key,12)==0)
+			return e;
+	return KEY_CACHE_NONE;
+}
+//The link in the bucket chain that points to entry |e|:
+static int32_t *key_cache_link(KEY_CACHE_SHARD *s, int32_t e){
+	int32_t *link=&s->buckets[(s->entries[e].fingerprint>>32)&s->bucket_mask];
+	while(*link!=e)
+		link=&s->entries[*link].chain;
+	return link;
+}
+//Takes entry |e| out of its bucket and the LRU list and wipes it. Called with the lock held:
+static void key_cache_drop(KEY_CACHE_SHARD *s, int32_t e){
+	*key_cache_link(s,e)=s->entries[e].chain;
+	key_cache_unlink(s,e);
+	key_cache_wipe(&s->entries[e],sizeof(KEY_CACHE_ENTRY));
+}
+//Frees the least recently used entry for reuse. Called with the lock held:
+static int32_t key_cache_evict(KEY_CACHE_SHARD *s){
+	int32_t e=s->oldest;
+	key_cache_drop(s,e);
+	s->evictions++;
+	return e;
+}
+
+/**
+ * Creates a key cache for up to |capacity| keys; all memory is allocated here.
+ * @param c the cache to be initialized
+ * @param capacity the number of keys, at least KEY_CACHE_SHARDS; rounded up to a multiple of KEY_CACHE_SHARDS
+ * @return Returns 0, if successful; INVALID_DATA_LENGTH if |capacity| is too small or too large; OUT_OF_MEMORY
+ */
+uint8_t key_cache_create(BKSQ_KEY_CACHE *c, size_t const capacity) {
+    if (capacity < KEY_CACHE_SHARDS || capacity / KEY_CACHE_SHARDS >= INT32_MAX / 2) return INVALID_DATA_LENGTH;
+
+    KEY_CACHE_SHARD *s;
+    int32_t per_shard=(int32_t)((capacity+KEY_CACHE_SHARDS-1)/KEY_CACHE_SHARDS);
+    uint32_t nbuckets;
+    struct timespec now;
+    int i;
+    int j;
+    if (getrandom(c->secret,sizeof(c->secret),0) != (ssize_t)sizeof(c->secret)) {
+        //No entropy: a secret that still differs from run to run
+        clock_gettime(CLOCK_REALTIME,&now);
+        c->secret[0]=(uint64_t)now.tv_nsec*0x9e3779b97f4a7c15ULL^(uint64_t)(uintptr_t)c;
+        c->secret[1]=(uint64_t)now.tv_sec*0xbf58476d1ce4e5b9ULL^(uint64_t)(uintptr_t)&now;
+    }
+    for(nbuckets=1;nbuckets<(uint32_t)per_shard;nbuckets*=2);
+    for(i=0;i<KEY_CACHE_SHARDS;i++){
+    	s=&c->shard[i];
+    	s->entries=(KEY_CACHE_ENTRY *)malloc(per_shard*sizeof(KEY_CACHE_ENTRY));
+    	s->buckets=(int32_t *)malloc(nbuckets*sizeof(int32_t));
+    	if(s->entries==NULL || s->buckets==NULL){
+    		for(j=0;j<=i;j++){
+    			free(c->shard[j].entries);
+    			free(c->shard[j].buckets);
+    		}
+    		return OUT_OF_MEMORY;
+    	}
+    	for(j=0;j<(int)nbuckets;j++)
+    		s->buckets[j]=KEY_CACHE_NONE;
+    	s->bucket_mask=nbuckets-1;
+    	s->capacity=per_shard;
+    	s->used=0;
+    	s->newest=KEY_CACHE_NONE;
+    	s->oldest=KEY_CACHE_NONE;
+    	s->hits=0;
+    	s->misses=0;
+    	s->evictions=0;
+    	pthread_mutex_init(&s->lock,NULL);
+    }
+    return CTR_OK;
+}
+
+/**
+ * Looks up the expanded forms of a key; on a miss they are computed and inserted, evicting the least recently
+ * used key of the shard if it is full.
+ * @param c the cache
+ * @param key the 96 bit (12 byte) key
+ * @param ks receives the expanded cipher key, as from bksq_key_expand(); may be NULL
+ * @param hks receives the expanded HMAC key, as from hmac_key_expand() with |BLOCKSIZE| bits; may be NULL
+ * @return Returns 0, if successful
+ */
+uint8_t key_cache_get(BKSQ_KEY_CACHE *c, uint8_t const *key, BKSQ_KEY_SCHEDULE *ks, HMAC_KEY_SCHEDULE *hks) {
+	uint64_t fingerprint=key_cache_fingerprint(c,key);
+	KEY_CACHE_SHARD *s=&c->shard[fingerprint%KEY_CACHE_SHARDS];
+	KEY_CACHE_ENTRY fresh;
+	int32_t e;
+	uint32_t bucket;
+	pthread_mutex_lock(&s->lock);
+	e=key_cache_find(s,fingerprint,key);
+	if(e!=KEY_CACHE_NONE){
+		s->hits++;
+		key_cache_unlink(s,e);
+		key_cache_push_newest(s,e);
+		if(ks!=NULL)
+			*ks=s->entries[e].ks;
+		if(hks!=NULL)
+			*hks=s->entries[e].hks;
+		pthread_mutex_unlock(&s->lock);
+		return CTR_OK;
+	}
+	s->misses++;
+	pthread_mutex_unlock(&s->lock);
+
+	//The expansion runs without the lock, other keys of the shard are served meanwhile:
+	bksq_key_expand(key,&fresh.ks);
+	hmac_key_expand(key,BLOCKSIZE,&fresh.hks);
+	fresh.fingerprint=fingerprint;
+	if(ks!=NULL)
+		*ks=fresh.ks;
+	if(hks!=NULL)
+		*hks=fresh.hks;
+
+	pthread_mutex_lock(&s->lock);
+	//Another thread may have inserted the same key in the meantime:
+	if(key_cache_find(s,fingerprint,key)==KEY_CACHE_NONE){
+		e=s->used<s->capacity ? s->used++ : key_cache_evict(s);
+		s->entries[e]=fresh;
+		bucket=(uint32_t)(fingerprint>>32)&s->bucket_mask;
+		s->entries[e].chain=s->buckets[bucket];
+		s->buckets[bucket]=e;
+		key_cache_push_newest(s,e);
+	}
+	pthread_mutex_unlock(&s->lock);
+	key_cache_wipe(&fresh,sizeof(fresh));
+	return CTR_OK;
+}
+
+/**
+ * Removes a key from the cache and wipes its entry, e.g. when it is revoked.
+ * @param c the cache
+ * @param key the 96 bit (12 byte) key
+ * @return Returns 0, if successful (also if the key was not in the cache)
+ */
+uint8_t key_cache_remove(BKSQ_KEY_CACHE *c, uint8_t const *key) {
+	uint64_t fingerprint=key_cache_fingerprint(c,key);
+	KEY_CACHE_SHARD *s=&c->shard[fingerprint%KEY_CACHE_SHARDS];
+	int32_t e;
+	int32_t last;
+	pthread_mutex_lock(&s->lock);
+	e=key_cache_find(s,fingerprint,key);
+	if(e!=KEY_CACHE_NONE){
+		//The entries in use stay the first |used|: the last one moves into the gap
+		key_cache_drop(s,e);
+		last=--s->used;
+		if(last!=e){
+			*key_cache_link(s,last)=e;
+			s->entries[e]=s->entries[last];
+			if(s->entries[e].newer!=KEY_CACHE_NONE)
+				s->entries[s->entries[e].newer].older=e;
+			else
+				s->newest=e;
+			if(s->entries[e].older!=KEY_CACHE_NONE)
+				s->entries[s->entries[e].older].newer=e;
+			else
+				s->oldest=e;
+			key_cache_wipe(&s->entries[last],sizeof(KEY_CACHE_ENTRY));
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+	return CTR_OK;
+}
+
+/**
+ * Sums the counters of all shards; the hit rate is hits / (hits + misses).
+ * @param c the cache
+ * @param stats receives the counters
+ * @return Returns 0, if successful
+ */
+uint8_t key_cache_stats(BKSQ_KEY_CACHE *c, KEY_CACHE_STATS *stats) {
+	int i;
+	memset(stats,0,sizeof(KEY_CACHE_STATS));
+	for(i=0;i<KEY_CACHE_SHARDS;i++){
+		pthread_mutex_lock(&c->shard[i].lock);
+		stats->hits+=c->shard[i].hits;
+		stats->misses+=c->shard[i].misses;
+		stats->evictions+=c->shard[i].evictions;
+		stats->entries+=(uint64_t)c->shard[i].used;
+		stats->capacity+=(uint64_t)c->shard[i].capacity;
+		pthread_mutex_unlock(&c->shard[i].lock);
+	}
+	return CTR_OK;
+}
+
+/**
+ * Wipes all keys and frees the cache.
+ * @param c the cache
+ * @return Returns 0, if successful
+ */
+uint8_t key_cache_destroy(BKSQ_KEY_CACHE *c) {
+	int i;
+	for(i=0;i<KEY_CACHE_SHARDS;i++){
+		key_cache_wipe(c->shard[i].entries,(size_t)c->shard[i].capacity*sizeof(KEY_CACHE_ENTRY));
+		free(c->shard[i].entries);
+		free(c->shard[i].buckets);
+		pthread_mutex_destroy(&c->shard[i].lock);
+	}
+	key_cache_wipe(c->secret,sizeof(c->secret));
+	return CTR_OK;
+}
+
+/**
+ * ctr() with the expanded key from a key cache.
+ * @param c the cache
+ * @param ctx The encryption/decryption context as with ctr()
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t ctr_cached(BKSQ_KEY_CACHE *c, CONTEXT const ctx) {
+	BKSQ_KEY_SCHEDULE ks;
+	key_cache_get(c,ctx.key,&ks,NULL);
+	return ctr_expanded(ctx,&ks);
+}
+/**
+ * hmac() of a 96 bit key with the expanded key from a key cache.
+ * @param c the cache
+ * @param data a pointer to the data to be hashed
+ * @param data_length the length of the data in bits
+ * @param key the 96 bit (12 byte) key
+ * @param tag a pointer to an array for receiving the MAC, must be of size |BLOCKSIZE_BYTE| bytes
+ * @return Returns 0, if MACing successful
+ */
+uint8_t hmac_cached(BKSQ_KEY_CACHE *c, uint8_t const *data, uint32_t const data_length, uint8_t const *key, uint8_t *tag) {
+	HMAC_KEY_SCHEDULE hks;
+	key_cache_get(c,key,NULL,&hks);
+	return hmac_expanded(data,data_length,&hks,tag,NULL,0);
+}
+/**
+ * ae_enc() with the expanded keys from a key cache.
+ * @param c the cache
+ * @param ctx The encryption context as with ae_enc()
+ * @param tag a buffer to receive the authentication tag
+ * @return Returns 0, if encryption was successful
+ */
+uint8_t ae_enc_cached(BKSQ_KEY_CACHE *c, CONTEXT const ctx, uint8_t *tag) {
+	BKSQ_KEY_SCHEDULE ks;
+	HMAC_KEY_SCHEDULE hks;
+	key_cache_get(c,ctx.key,&ks,&hks);
+	return ae_enc_expanded(ctx,&ks,&hks,tag);
+}
+/**
+ * ae_dec() with the expanded keys from a key cache.
+ * @param c the cache
+ * @param ctx The decryption context as with ae_dec()
+ * @param tag the authentication tag to be verified
+ * @return Returns 0, if the tag matched and the data was decrypted; INVALID_TAG if the data was left untouched
+ */
+uint8_t ae_dec_cached(BKSQ_KEY_CACHE *c, CONTEXT const ctx, uint8_t const *tag) {
+	BKSQ_KEY_SCHEDULE ks;
+	HMAC_KEY_SCHEDULE hks;
+	key_cache_get(c,ctx.key,&ks,&hks);
+	return ae_dec_expanded(ctx,&ks,&hks,tag);
+}
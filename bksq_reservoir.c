@@ -0,0 +1,349 @@
+/** \file bksq_reservoir.c */
+
+/*
+	Keystream reservoir for the encryption of many small records under one key and nonce: a background thread
+	encrypts the upcoming counter blocks ahead of time into a ring, so the request path only XORs with keystream that
+	is ready, without a key schedule or a block encryption of its own. The keystream is that of a CTR_STREAM.
+
+	The ring has one producer (the background thread) and one consumer (the thread calling reservoir_xor()) and needs
+	no lock: the producer publishes the blocks up to |head|, the consumer releases the blocks below |tail|, both with
+	release/acquire ordering. The producer fills the ring up to the high watermark and then sleeps until the consumer
+	drops below the low watermark. A request that finds too little keystream in the ring (a miss) computes the rest
+	itself, and the producer skips the blocks used up that way.
+
+	Like main.c, this file expects abgabe.c to be included before it.
+*/
+
+#include <time.h>
+
+#define RESERVOIR_LATENCY_BUCKETS 252 ///< buckets of the latency histogram: 4 per power of two of nanoseconds
+
+/**
+ * The statistics of a reservoir since reservoir_init(), see reservoir_stats().
+ */
+typedef struct {
+    uint64_t requests; ///< the number of calls of reservoir_xor()
+    uint64_t hits; ///< the requests that took all their keystream from the ring
+    uint64_t misses; ///< the requests that had to compute keystream themselves
+    uint64_t bytes; ///< the number of bytes en- or decrypted
+    uint64_t produced_blocks; ///< the number of keystream blocks computed by the background thread
+    uint64_t p50_ns; ///< the median latency of reservoir_xor(), in nanoseconds (the upper bound of its histogram bucket)
+    uint64_t p99_ns; ///< the 99th percentile of the latency, in nanoseconds
+    uint64_t max_ns; ///< the highest latency, in nanoseconds
+} RESERVOIR_STATS;
+
+/**
+ * A keystream reservoir for one key and nonce, see reservoir_init(). reservoir_xor() may be called by one thread
+ * at a time only; the background thread is the producer of the ring.
+ */
+typedef struct {
+    BKSQ_KEY_SCHEDULE ks; ///< the expanded key
+    uint8_t nonce[6]; ///< the nonce, i.e. the first half of every counter block
+    uint8_t (*ring)[12]; ///< keystream block i is in ring[i % capacity] while tail <= i < head
+    size_t capacity; ///< the number of blocks in the ring
+    size_t low_watermark; ///< the producer wakes up when fewer blocks are ready
+    size_t high_watermark; ///< the producer fills the ring up to this many ready blocks
+    uint64_t head; ///< the number of the first block not yet produced (written by the producer)
+    uint64_t tail; ///< the number of the first block not yet used up (written by the consumer)
+    uint8_t keystream[12]; ///< the current keystream block of the consumer
+    uint8_t keystream_used; ///< the number of bytes of |keystream| already used; 12 if there are none left
+    int sleeping; ///< set while the producer waits for the low watermark
+    int stop; ///< makes the producer exit
+    pthread_t producer; ///< the background thread
+    int running; ///< set while |producer| is a started thread that has to be joined
+    pthread_mutex_t lock; ///< protects the sleep of the producer
+    pthread_cond_t wake; ///< signalled when the ring drops below the low watermark or the producer has to stop
+    uint64_t requests; ///< see RESERVOIR_STATS
+    uint64_t hits; ///< see RESERVOIR_STATS
+    uint64_t misses; ///< see RESERVOIR_STATS
+    uint64_t bytes; ///< see RESERVOIR_STATS
+    uint64_t produced_blocks; ///< see RESERVOIR_STATS, written by the producer
+    uint64_t latency[RESERVOIR_LATENCY_BUCKETS]; ///< the histogram of the latencies of reservoir_xor()
+    uint64_t max_ns; ///< see RESERVOIR_STATS
+} KEYSTREAM_RESERVOIR;
+
+//The counter block of keystream block |block|:
+static void reservoir_counter(KEYSTREAM_RESERVOIR const *r, uint64_t block, uint8_t nonce_counter[12]){
+	int i;
+	for(i=0;i<6;i++)
+		nonce_counter[i]=r->nonce[i];
+	for(i=6;i<12;i++)
+		nonce_counter[i]=0;
+	counter_add(nonce_counter,block);
+}
+//The number of blocks ready in the ring; after a miss the consumer may be ahead of the producer:
+static inline uint64_t reservoir_ready(uint64_t head, uint64_t tail){
+	return head>tail ? head-tail : 0;
+}
+//Computes the keystream blocks first,...,first+n-1 into |out|:
+static void reservoir_compute(KEYSTREAM_RESERVOIR const *r, uint64_t first, size_t n, uint8_t (*out)[12]){
+	uint8_t nonce_counter[MULTIBLOCK_BATCH][12];
+	size_t i;
+	size_t lanes;
+	for(;n>0;n-=lanes,first+=lanes,out+=lanes){
+		lanes=n<MULTIBLOCK_BATCH ? n : MULTIBLOCK_BATCH;
+		reservoir_counter(r,first,nonce_counter[0]);
+		for(i=1;i<lanes;i++){
+			memcpy(nonce_counter[i],nonce_counter[i-1],12);
+			counter(nonce_counter[i]);
+		}
+		bksq_encrypt_blocks_expanded(nonce_counter[0],out[0],lanes,&r->ks);
+	}
+}
+
+//Background thread: keeps between the low and the high watermark of blocks ready:
+static void *reservoir_producer(void *arg){
+	KEYSTREAM_RESERVOIR *r=(KEYSTREAM_RESERVOIR *)arg;
+	uint8_t batch[MULTIBLOCK_BATCH][12];
+	uint64_t head=r->head;
+	uint64_t tail;
+	size_t n;
+	size_t i;
+	while(!__atomic_load_n(&r->stop,__ATOMIC_ACQUIRE)){
+		tail=__atomic_load_n(&r->tail,__ATOMIC_SEQ_CST);
+		//Blocks the consumer computed itself on a miss are skipped:
+		if(head<tail)
+			head=tail;
+		if(head-tail>=r->high_watermark){
+			pthread_mutex_lock(&r->lock);
+			__atomic_store_n(&r->sleeping,1,__ATOMIC_SEQ_CST);
+			while(!__atomic_load_n(&r->stop,__ATOMIC_ACQUIRE) && reservoir_ready(head,__atomic_load_n(&r->tail,__ATOMIC_SEQ_CST))>=r->low_watermark)
+				pthread_cond_wait(&r->wake,&r->lock);
+			__atomic_store_n(&r->sleeping,0,__ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&r->lock);
+			continue;
+		}
+		n=r->high_watermark-(size_t)(head-tail);
+		if(n>MULTIBLOCK_BATCH)
+			n=MULTIBLOCK_BATCH;
+		reservoir_compute(r,head,n,batch);
+		for(i=0;i<n;i++)
+			memcpy(r->ring[(head+i)%r->capacity],batch[i],12);
+		head+=n;
+		__atomic_store_n(&r->head,head,__ATOMIC_RELEASE);
+		__atomic_fetch_add(&r->produced_blocks,n,__ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+//Sets the key and the nonce, starts at keystream position 0 and starts the producer:
+static uint8_t reservoir_start(KEYSTREAM_RESERVOIR *r, uint8_t const *key, uint8_t const *nonce){
+	int i;
+	bksq_key_expand(key,&r->ks);
+	for(i=0;i<6;i++)
+		r->nonce[i]=nonce[i];
+	r->head=0;
+	r->tail=0;
+	r->keystream_used=BLOCKSIZE_BYTE;
+	r->sleeping=0;
+	r->stop=0;
+	r->running=0;
+	if(pthread_create(&r->producer,NULL,reservoir_producer,r)!=0)
+		return THREAD_ERROR;
+	r->running=1;
+	return CTR_OK;
+}
+//Stops the producer, if it was started:
+static void reservoir_stop(KEYSTREAM_RESERVOIR *r){
+	if(!r->running)
+		return;
+	pthread_mutex_lock(&r->lock);
+	__atomic_store_n(&r->stop,1,__ATOMIC_RELEASE);
+	pthread_cond_signal(&r->wake);
+	pthread_mutex_unlock(&r->lock);
+	pthread_join(r->producer,NULL);
+	r->running=0;
+}
+
+/**
+ * Starts a keystream reservoir at position 0 of the keystream of |key| and |nonce|, and its background thread.
+ * @param r the reservoir to be initialized
+ * @param key provides the 96 bit (12 byte) key
+ * @param nonce the nonce
+ * @param nonce_length the length of the nonce in bits
+ * @param capacity the number of keystream blocks the ring holds
+ * @param low_watermark the producer resumes when fewer blocks are ready
+ * @param high_watermark the producer fills the ring up to this many blocks; 0 < low_watermark <= high_watermark <= capacity
+ * @return Returns 0, if successful; INVALID_DATA_LENGTH if the watermarks do not fit; OUT_OF_MEMORY or THREAD_ERROR
+ */
+uint8_t reservoir_init(KEYSTREAM_RESERVOIR *r, uint8_t const *key, uint8_t const *nonce, uint8_t const nonce_length, size_t const capacity, size_t const low_watermark, size_t const high_watermark) {
+    if (nonce_length != (BLOCKSIZE / 2)) return INVALID_NONCE_LENGTH;
+    if (low_watermark == 0 || low_watermark > high_watermark || high_watermark > capacity) return INVALID_DATA_LENGTH;
+
+    uint8_t ret;
+    memset(r,0,sizeof(KEYSTREAM_RESERVOIR));
+    r->ring=(uint8_t (*)[12])malloc(capacity*12);
+    if (r->ring == NULL) return OUT_OF_MEMORY;
+    r->capacity=capacity;
+    r->low_watermark=low_watermark;
+    r->high_watermark=high_watermark;
+    pthread_mutex_init(&r->lock,NULL);
+    pthread_cond_init(&r->wake,NULL);
+    ret=reservoir_start(r,key,nonce);
+    if (ret != CTR_OK) {
+        pthread_cond_destroy(&r->wake);
+        pthread_mutex_destroy(&r->lock);
+        free(r->ring);
+    }
+    return ret;
+}
+
+//The histogram bucket of a latency: exact below 8 ns, then 4 buckets per power of two:
+static int reservoir_bucket(uint64_t ns){
+	int msb;
+	if(ns<8)
+		return (int)ns;
+	msb=63-__builtin_clzll(ns);
+	return 8+(msb-3)*4+(int)((ns>>(msb-2))&3);
+}
+//The highest latency that falls into |bucket|:
+static uint64_t reservoir_bucket_max(int bucket){
+	int msb;
+	if(bucket<8)
+		return (uint64_t)bucket;
+	msb=(bucket-8)/4+3;
+	return ((uint64_t)(4+(bucket-8)%4+1)<<(msb-2))-1;
+}
+
+/**
+ * En-/Decrypts the next |length| bytes of the keystream, like ctr_stream_update(): with the keystream from the ring
+ * as far as it is ready, the rest is computed right here (a miss).
+ * Note that operation happens \e in place, so input data is overwritten by output!
+ * @param r the reservoir
+ * @param data a pointer to the data
+ * @param length the length of the data in bytes; any length is allowed
+ * @return Returns 0, if encryption/decryption was successful
+ */
+uint8_t reservoir_xor(KEYSTREAM_RESERVOIR *r, uint8_t *data, size_t length) {
+	uint8_t computed[MULTIBLOCK_BATCH][12];
+	uint8_t const *block;
+	struct timespec start;
+	struct timespec end;
+	uint64_t head;
+	uint64_t ready;
+	uint64_t ns;
+	size_t nblocks;
+	size_t from_ring;
+	size_t i;
+	size_t j;
+	size_t k;
+	size_t n;
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	r->requests++;
+	r->bytes+=length;
+	//Rest of the current keystream block:
+	while(length>0 && r->keystream_used<BLOCKSIZE_BYTE){
+		*data++^=r->keystream[r->keystream_used++];
+		length--;
+	}
+	nblocks=(length+BLOCKSIZE_BYTE-1)/BLOCKSIZE_BYTE;
+	head=__atomic_load_n(&r->head,__ATOMIC_ACQUIRE);
+	ready=reservoir_ready(head,r->tail);
+	from_ring=nblocks<ready ? nblocks : (size_t)ready;
+	if(from_ring<nblocks)
+		r->misses++;
+	else
+		r->hits++;
+	//Block by block, from the ring first; a partial last block is kept for the next request:
+	for(i=0;i<nblocks;i+=n){
+		if(i<from_ring){
+			n=from_ring-i;
+		}
+		else{
+			n=nblocks-i<MULTIBLOCK_BATCH ? nblocks-i : MULTIBLOCK_BATCH;
+			reservoir_compute(r,r->tail+i,n,computed);
+		}
+		for(j=0;j<n;j++){
+			block=i<from_ring ? r->ring[(r->tail+i+j)%r->capacity] : computed[j];
+			if(length>=BLOCKSIZE_BYTE){
+				for(k=0;k<BLOCKSIZE_BYTE;k++)
+					data[k]^=block[k];
+				data+=BLOCKSIZE_BYTE;
+				length-=BLOCKSIZE_BYTE;
+			}
+			else{
+				memcpy(r->keystream,block,BLOCKSIZE_BYTE);
+				for(r->keystream_used=0;r->keystream_used<length;r->keystream_used++)
+					data[r->keystream_used]^=r->keystream[r->keystream_used];
+			}
+		}
+	}
+	__atomic_store_n(&r->tail,r->tail+nblocks,__ATOMIC_SEQ_CST);
+	//Wake the producer when the ring runs low:
+	if(__atomic_load_n(&r->sleeping,__ATOMIC_SEQ_CST) && reservoir_ready(head,r->tail)<r->low_watermark){
+		pthread_mutex_lock(&r->lock);
+		pthread_cond_signal(&r->wake);
+		pthread_mutex_unlock(&r->lock);
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	ns=(uint64_t)((end.tv_sec-start.tv_sec)*1000000000LL+(end.tv_nsec-start.tv_nsec));
+	r->latency[reservoir_bucket(ns)]++;
+	if(ns>r->max_ns)
+		r->max_ns=ns;
+	return CTR_OK;
+}
+
+/**
+ * Drops all precomputed keystream and restarts the reservoir at position 0 of the keystream of a new key or nonce.
+ * Must be called whenever the key or the nonce changes; the statistics are kept.
+ * @param r the reservoir
+ * @param key provides the 96 bit (12 byte) key
+ * @param nonce the nonce
+ * @param nonce_length the length of the nonce in bits
+ * @return Returns 0, if successful; THREAD_ERROR if the producer could not be restarted (then every request is a miss
+ *         until the next successful reservoir_invalidate(), and reservoir_final() may still be called)
+ */
+uint8_t reservoir_invalidate(KEYSTREAM_RESERVOIR *r, uint8_t const *key, uint8_t const *nonce, uint8_t const nonce_length) {
+    if (nonce_length != (BLOCKSIZE / 2)) return INVALID_NONCE_LENGTH;
+
+    reservoir_stop(r);
+    return reservoir_start(r,key,nonce);
+}
+
+/**
+ * Reads the statistics of a reservoir; call it from the thread that calls reservoir_xor().
+ * @param r the reservoir
+ * @param stats receives the statistics
+ * @return Returns 0, if successful
+ */
+uint8_t reservoir_stats(KEYSTREAM_RESERVOIR const *r, RESERVOIR_STATS *stats) {
+	uint64_t count=0;
+	int i;
+	stats->requests=r->requests;
+	stats->hits=r->hits;
+	stats->misses=r->misses;
+	stats->bytes=r->bytes;
+	stats->produced_blocks=__atomic_load_n(&r->produced_blocks,__ATOMIC_RELAXED);
+	stats->p50_ns=0;
+	stats->p99_ns=0;
+	stats->max_ns=r->max_ns;
+	for(i=0;i<RESERVOIR_LATENCY_BUCKETS;i++){
+		count+=r->latency[i];
+		if(stats->p50_ns==0 && r->latency[i]!=0 && 2*count>=r->requests)
+			stats->p50_ns=reservoir_bucket_max(i);
+		if(stats->p99_ns==0 && r->latency[i]!=0 && 100*count>=99*r->requests)
+			stats->p99_ns=reservoir_bucket_max(i);
+	}
+	return CTR_OK;
+}
+
+/**
+ * Stops the background thread of a reservoir and wipes its key material.
+ * @param r the reservoir
+ * @return Returns 0, if successful
+ */
+uint8_t reservoir_final(KEYSTREAM_RESERVOIR *r) {
+	volatile uint8_t *p;
+	size_t i;
+	reservoir_stop(r);
+	pthread_cond_destroy(&r->wake);
+	pthread_mutex_destroy(&r->lock);
+	p=(volatile uint8_t *)r->ring;
+	for(i=0;i<r->capacity*12;i++)
+		p[i]=0;
+	free(r->ring);
+	p=(volatile uint8_t *)r;
+	for(i=0;i<sizeof(KEYSTREAM_RESERVOIR);i++)
+		p[i]=0;
+	return CTR_OK;
+}
@@ -0,0 +1,269 @@
+/** \file bksq_stream.c */
+
+/*
+	Pipelined encryption of byte streams (pipes, sockets, terminals), which can neither be mapped nor read as a whole.
+	A ring of BKSQ_STREAM_BUFFERS buffers of BKSQ_STREAM_CHUNK bytes each circulates between three threads:
+	the reader fills a buffer from the input, the calling thread encrypts it, the writer writes it to the output
+	and hands it back to the reader. So reading the next chunk, encrypting the current one and writing the
+	previous one happen at the same time. The keystream and the MAC carry over from chunk to chunk.
+
+	The I/O uses blocking read() and write() on the two threads; io_uring is not used.
+
+	Like main.c, this file expects abgabe.c to be included before it.
+*/
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BKSQ_STREAM_CTR 0 ///< bksq_stream(): counter mode as a CTR_STREAM, for data of any length
+#define BKSQ_STREAM_AE_ENC 1 ///< bksq_stream(): authenticated encryption as ae_enc(), the tag follows the ciphertext
+
+#define BKSQ_STREAM_BUFFERS 4 ///< number of buffers in the ring
+#define BKSQ_STREAM_CHUNK (12*87381) ///< size of a buffer, just below 1 MiB and a multiple of the blocklength
+
+#define BKSQ_STREAM_EMPTY 0 ///< buffer state: free for the reader
+#define BKSQ_STREAM_FILLED 1 ///< buffer state: read, to be encrypted
+#define BKSQ_STREAM_DONE 2 ///< buffer state: encrypted, to be written
+
+/**
+ * The throughput of a stream so far, see bksq_stream().
+ */
+typedef struct {
+    uint64_t bytes; ///< the number of bytes written (without the tag)
+    double seconds; ///< the time since the start of the stream
+} BKSQ_STREAM_STATS;
+
+//One buffer of the ring:
+typedef struct {
+    uint8_t *data; ///< BKSQ_STREAM_CHUNK bytes
+    size_t length; ///< the number of bytes in |data|
+    int last; ///< set on the buffer that ends the input
+    int state; ///< BKSQ_STREAM_EMPTY, BKSQ_STREAM_FILLED or BKSQ_STREAM_DONE
+} BKSQ_STREAM_BUFFER;
+
+//The state shared by the three threads of bksq_stream():
+typedef struct {
+    BKSQ_STREAM_BUFFER buffer[BKSQ_STREAM_BUFFERS]; ///< the ring
+    pthread_mutex_t lock; ///< protects the states and everything below
+    pthread_cond_t changed; ///< signalled whenever a buffer changes its state
+    int in_fd; ///< the input
+    int out_fd; ///< the output
+    uint8_t error; ///< the first error of any thread, or 0; makes all threads stop
+    uint64_t bytes; ///< the number of bytes written so far
+    struct timespec start; ///< the start of the stream
+    double report_interval; ///< see bksq_stream()
+    void (*report)(BKSQ_STREAM_STATS const *stats); ///< see bksq_stream()
+} BKSQ_STREAM;
+
+static double bksq_stream_elapsed(BKSQ_STREAM const *s){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (double)(now.tv_sec-s->start.tv_sec)+(now.tv_nsec-s->start.tv_nsec)*1e-9;
+}
+//Waits until buffer |i| is in |state| or an error occurred; returns 0 on success. Called with the lock held:
+static int bksq_stream_wait(BKSQ_STREAM *s, int i, int state){
+	while(s->buffer[i].state!=state && s->error==0)
+		pthread_cond_wait(&s->changed,&s->lock);
+	return s->error;
+}
+//Hands buffer |i| on to the next thread, or records an error:
+static void bksq_stream_set(BKSQ_STREAM *s, int i, int state, uint8_t error){
+	pthread_mutex_lock(&s->lock);
+	if(error!=0 && s->error==0)
+		s->error=error;
+	else
+		s->buffer[i].state=state;
+	pthread_cond_broadcast(&s->changed);
+	pthread_mutex_unlock(&s->lock);
+}
+//Reader thread: fills the buffers in ring order with whole chunks, only the last one may be shorter:
+static void *bksq_stream_reader(void *arg){
+	BKSQ_STREAM *s=(BKSQ_STREAM *)arg;
+	BKSQ_STREAM_BUFFER *b;
+	ssize_t n;
+	int i=0;
+	int last=0;
+	uint8_t error;
+	while(!last){
+		pthread_mutex_lock(&s->lock);
+		error=bksq_stream_wait(s,i,BKSQ_STREAM_EMPTY);
+		pthread_mutex_unlock(&s->lock);
+		if(error!=0)
+			break;
+		b=&s->buffer[i];
+		b->length=0;
+		while(b->length<BKSQ_STREAM_CHUNK){
+			n=read(s->in_fd,b->data+b->length,BKSQ_STREAM_CHUNK-b->length);
+			if(n<0 && errno==EINTR)
+				continue;
+			if(n<=0)
+				break;
+			b->length+=(size_t)n;
+		}
+		last=b->length<BKSQ_STREAM_CHUNK;
+		b->last=last;
+		bksq_stream_set(s,i,BKSQ_STREAM_FILLED,n<0 ? FILE_ERROR : 0);
+		if(n<0)
+			break;
+		i=(i+1)%BKSQ_STREAM_BUFFERS;
+	}
+	return NULL;
+}
+//Writes all |length| bytes of |data|; returns 0 on success:
+static int bksq_stream_write_all(int fd, uint8_t const *data, size_t length){
+	ssize_t n;
+	while(length>0){
+		n=write(fd,data,length);
+		if(n<0 && errno==EINTR)
+			continue;
+		if(n<=0)
+			return 1;
+		data+=n;
+		length-=(size_t)n;
+	}
+	return 0;
+}
+//Writer thread: writes the encrypted buffers in ring order and reports the throughput:
+static void *bksq_stream_writer(void *arg){
+	BKSQ_STREAM *s=(BKSQ_STREAM *)arg;
+	BKSQ_STREAM_BUFFER *b;
+	BKSQ_STREAM_STATS stats;
+	double next_report=s->report_interval;
+	int i=0;
+	int last=0;
+	uint8_t error;
+	while(!last){
+		pthread_mutex_lock(&s->lock);
+		error=bksq_stream_wait(s,i,BKSQ_STREAM_DONE);
+		pthread_mutex_unlock(&s->lock);
+		if(error!=0)
+			break;
+		b=&s->buffer[i];
+		last=b->last;
+		error=bksq_stream_write_all(s->out_fd,b->data,b->length)!=0 ? FILE_ERROR : 0;
+		pthread_mutex_lock(&s->lock);
+		s->bytes+=b->length;
+		pthread_mutex_unlock(&s->lock);
+		bksq_stream_set(s,i,BKSQ_STREAM_EMPTY,error);
+		if(error!=0)
+			break;
+		if(s->report!=NULL && s->report_interval>0){
+			stats.seconds=bksq_stream_elapsed(s);
+			if(stats.seconds>=next_report){
+				stats.bytes=s->bytes;
+				s->report(&stats);
+				next_report=stats.seconds+s->report_interval;
+			}
+		}
+		i=(i+1)%BKSQ_STREAM_BUFFERS;
+	}
+	return NULL;
+}
+
+/**
+ * Encrypts everything from |in_fd| until the end of the input to |out_fd|, pipelined over a ring of buffers.
+ * BKSQ_STREAM_CTR gives the output of a CTR_STREAM (decryption is the same operation); BKSQ_STREAM_AE_ENC gives the
+ * output of ae_enc() followed by the 12 byte tag, and needs an input length that is a multiple of the blocklength.
+ * @param in_fd the input, e.g. a pipe or a socket
+ * @param out_fd the output
+ * @param mode BKSQ_STREAM_CTR or BKSQ_STREAM_AE_ENC
+ * @param key the 96 bit (12 byte) key
+ * @param nonce the 48 bit (6 byte) nonce
+ * @param report_interval the time in seconds between two calls of |report|
+ * @param report called by the writer thread with the throughput so far; may be NULL
+ * @param stats receives the throughput of the whole stream, zero if it could not be started; may be NULL
+ * @return Returns 0, if successful; FILE_ERROR if reading or writing failed; INVALID_DATA_LENGTH if the input of
+ *         BKSQ_STREAM_AE_ENC ended within a block (then no tag is written); THREAD_ERROR or OUT_OF_MEMORY
+ */
+uint8_t bksq_stream(int const in_fd, int const out_fd, int const mode, uint8_t const *key, uint8_t const *nonce, double const report_interval, void (*report)(BKSQ_STREAM_STATS const *stats), BKSQ_STREAM_STATS *stats) {
+    BKSQ_STREAM s;
+    CTR_STREAM ctr_stream;
+    HMAC_KEY_SCHEDULE hks;
+    HMAC_CTX mac;
+    BKSQ_STREAM_BUFFER *b;
+    pthread_t reader;
+    pthread_t writer;
+    uint8_t nonce_counter[12];
+    uint8_t tag[12];
+    uint64_t total=0;
+    uint8_t ret;
+    int i;
+    int last=0;
+
+    if (stats != NULL) {
+        stats->bytes=0;
+        stats->seconds=0;
+    }
+    s.in_fd=in_fd;
+    s.out_fd=out_fd;
+    s.error=0;
+    s.bytes=0;
+    s.report_interval=report_interval;
+    s.report=report;
+    clock_gettime(CLOCK_MONOTONIC,&s.start);
+    for(i=0;i<BKSQ_STREAM_BUFFERS;i++){
+    	s.buffer[i].data=(uint8_t *)malloc(BKSQ_STREAM_CHUNK);
+    	s.buffer[i].state=BKSQ_STREAM_EMPTY;
+    	if(s.buffer[i].data==NULL)
+    		s.error=OUT_OF_MEMORY;
+    }
+    if (s.error != 0) {
+        for(i=0;i<BKSQ_STREAM_BUFFERS;i++)
+        	free(s.buffer[i].data);
+        return OUT_OF_MEMORY;
+    }
+    pthread_mutex_init(&s.lock,NULL);
+    pthread_cond_init(&s.changed,NULL);
+
+    ctr_stream_init(&ctr_stream,key,nonce,BLOCKSIZE/2);
+    if (mode == BKSQ_STREAM_AE_ENC) {
+        for(i=0;i<6;i++)
+        	nonce_counter[i]=nonce[i];
+        for(i=6;i<12;i++)
+        	nonce_counter[i]=0;
+        hmac_key_expand(key,BLOCKSIZE,&hks);
+        hmac_init(&mac,&hks);
+        hmac_update(&mac,nonce_counter,12);
+    }
+
+    if (pthread_create(&reader,NULL,bksq_stream_reader,&s) != 0) {
+        ret=THREAD_ERROR;
+    } else {
+        if (pthread_create(&writer,NULL,bksq_stream_writer,&s) != 0)
+            bksq_stream_set(&s,0,BKSQ_STREAM_EMPTY,THREAD_ERROR);
+        //The calling thread encrypts the buffers in ring order, between the reader and the writer:
+        for(i=0;!last;i=(i+1)%BKSQ_STREAM_BUFFERS){
+        	pthread_mutex_lock(&s.lock);
+        	ret=bksq_stream_wait(&s,i,BKSQ_STREAM_FILLED);
+        	pthread_mutex_unlock(&s.lock);
+        	if(ret!=0)
+        		break;
+        	b=&s.buffer[i];
+        	last=b->last;
+        	total+=b->length;
+        	ctr_stream_update(&ctr_stream,b->data,b->length);
+        	if(mode==BKSQ_STREAM_AE_ENC)
+        		hmac_update(&mac,b->data,b->length);
+        	bksq_stream_set(&s,i,BKSQ_STREAM_DONE,0);
+        }
+        pthread_join(reader,NULL);
+        if (s.error != THREAD_ERROR) pthread_join(writer,NULL);
+        ret=s.error;
+    }
+
+    if (ret == 0 && mode == BKSQ_STREAM_AE_ENC) {
+        if (hmac_final(&mac,tag) != HMAC_OK || (total % 12) != 0) ret=INVALID_DATA_LENGTH;
+        else if (bksq_stream_write_all(out_fd,tag,12) != 0) ret=FILE_ERROR;
+    }
+    if (stats != NULL) {
+        stats->bytes=s.bytes;
+        stats->seconds=bksq_stream_elapsed(&s);
+    }
+    ctr_stream_final(&ctr_stream);
+    pthread_cond_destroy(&s.changed);
+    pthread_mutex_destroy(&s.lock);
+    for(i=0;i<BKSQ_STREAM_BUFFERS;i++)
+    	free(s.buffer[i].data);
+    return ret;
+}
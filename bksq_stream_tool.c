@@ -0,0 +1,97 @@
+/** \file bksq_stream_tool.c */
+
+/**
+ * bksq-stream: encrypts from stdin to stdout with bksq_stream(), e.g. between pipes and sockets.
+ *
+ * Usage: bksq-stream ctr|enc -k KEY -n NONCE [-r SECONDS]
+ *
+ * KEY (12 bytes) and NONCE (6 bytes) are given in hex. ctr en- and decrypts in counter mode, enc appends the
+ * authentication tag; a stream cannot be verified before it is decrypted, so decryption is left to bksq-file dec.
+ * The throughput is reported on stderr every SECONDS seconds (default: 1, 0 for the total only).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "abgabe.c"
+#include "bksq_stream.c"
+
+//Parses exactly |length| bytes of hex; returns 0 on success:
+static int parse_hex(char const *hex, uint8_t *res, size_t length) {
+    size_t i;
+    unsigned int byte;
+    if (strlen(hex) != 2 * length) return 1;
+    for (i = 0; i < length; i++) {
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return 1;
+        res[i] = (uint8_t) byte;
+    }
+    return 0;
+}
+
+static int usage(char const *name) {
+    fprintf(stderr, "usage: %s ctr|enc -k KEY -n NONCE [-r SECONDS]\n", name);
+    return EXIT_FAILURE;
+}
+
+static void report(BKSQ_STREAM_STATS const *stats) {
+    fprintf(stderr, "%10.1f MiB %8.1f s %10.1f MB/s\n", stats->bytes / 1048576.0, stats->seconds,
+            stats->seconds > 0 ? stats->bytes / stats->seconds / 1e6 : 0.0);
+}
+
+/**
+ *  Parses the arguments and runs bksq_stream() on stdin and stdout
+ */
+int main(int argc, char** argv) {
+    uint8_t key[12];
+    uint8_t nonce[6];
+    int have_key = 0;
+    int have_nonce = 0;
+    double interval = 1.0;
+    int mode;
+    BKSQ_STREAM_STATS stats;
+    uint8_t ret;
+    int i;
+
+    if (argc < 2) return usage(argv[0]);
+    if (strcmp(argv[1], "ctr") == 0) mode = BKSQ_STREAM_CTR;
+    else if (strcmp(argv[1], "enc") == 0) mode = BKSQ_STREAM_AE_ENC;
+    else return usage(argv[0]);
+
+    for (i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            if (parse_hex(argv[++i], key, 12) != 0) return usage(argv[0]);
+            have_key = 1;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            if (parse_hex(argv[++i], nonce, 6) != 0) return usage(argv[0]);
+            have_nonce = 1;
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            interval = atof(argv[++i]);
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (!have_key || !have_nonce) return usage(argv[0]);
+
+    ret = bksq_stream(STDIN_FILENO, STDOUT_FILENO, mode, key, nonce, interval, report, &stats);
+    report(&stats);
+
+    switch (ret) {
+        case CTR_OK:
+            return (EXIT_SUCCESS);
+        case INVALID_DATA_LENGTH:
+            fprintf(stderr, "%s: the length must be a multiple of 12 bytes for enc, no tag was written\n", argv[0]);
+            break;
+        case FILE_ERROR:
+            fprintf(stderr, "%s: reading stdin or writing stdout failed\n", argv[0]);
+            break;
+        case OUT_OF_MEMORY:
+            fprintf(stderr, "%s: cannot allocate the stream buffers\n", argv[0]);
+            break;
+        default:
+            fprintf(stderr, "%s: cannot start the threads\n", argv[0]);
+            break;
+    }
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+/** \file bksq_test.cpp */
+
+/**
+ * Tests the header-only C++ engine bksq.hpp bit by bit against the C reference in abgabe.c:
+ * the known answer of main.c at compile time, then pseudo random keys, blocks and messages of all modes.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "abgabe.c"
+#include "bksq.hpp"
+
+#define ERRMSG "das stimmt noch nicht" ///< the error message of main.c, shortened
+
+//The known answer of "Teste BKSQ" in main.c, checked by the compiler:
+static_assert(bksq::Cipher<>(bksq::Key{0xFF, 0xFE, 0xFD, 0xFC, 0xFB, 0xFA, 0xF9, 0xF8, 0xF7, 0xF6, 0xF5, 0xF4}).encrypt(bksq::Block{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11})
+              == bksq::Block{0x89, 0xf3, 0x73, 0x81, 0x95, 0x6f, 0xc5, 0xb5, 0xa7, 0xed, 0x1f, 0xa7}, "BKSQ");
+
+//Blocks and keys only convert explicitly:
+static_assert(!std::is_convertible_v<bksq::Key, bksq::Block> && !std::is_convertible_v<bksq::Block, bksq::Key>, "Block/Key");
+static_assert(static_cast<bksq::Key>(bksq::Block{1, 2, 3}) == bksq::Key{1, 2, 3}, "Block/Key");
+
+static uint64_t random_state = 0x0123456789abcdefULL;
+
+//xorshift64, so that every run tests the same values:
+static uint8_t random_byte(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (uint8_t) random_state;
+}
+
+template <typename T>
+static void random_fill(T &val) {
+    for (auto &byte : val) byte = random_byte();
+}
+
+/**
+ *  Runs all tests
+ */
+int main() {
+    char const *msg;
+    bksq::Key key;
+    bksq::Block block;
+    bksq::Nonce nonce;
+    std::array<uint8_t, 12 * 40 + 7> data;
+    std::array<uint8_t, 12 * 40 + 7> reference;
+    uint8_t out[12];
+    int i;
+
+    printf("Teste C++ BKSQ...  ");
+    msg = "OK!";
+    for (i = 0; i < 1000; i++) {
+        random_fill(key);
+        random_fill(block);
+        bksq_encrypt(block.data(), out, key.data());
+        if (memcmp(bksq::Cipher<>(key).encrypt(block).data(), out, 12) != 0) msg = ERRMSG;
+    }
+    printf("%s\n", msg);
+
+    printf("Teste C++ CTR-Mode...  ");
+    msg = "OK!";
+    for (i = 0; i < 50; i++) {
+        size_t length = random_byte() % (data.size() + 1);
+        CTR_STREAM stream;
+        random_fill(key);
+        random_fill(nonce);
+        random_fill(data);
+        reference = data;
+        bksq::ctr(std::span(data).first(length), key, nonce);
+        ctr_stream_init(&stream, key.data(), nonce.data(), 6 * 8);
+        ctr_stream_update(&stream, reference.data(), length);
+        ctr_stream_final(&stream);
+        if (data != reference) msg = ERRMSG;
+    }
+    printf("%s\n", msg);
+
+    printf("Teste C++ Davies-Meyer und HMAC...  ");
+    msg = "OK!";
+    for (i = 0; i <= 40; i++) {
+        random_fill(key);
+        random_fill(data);
+        std::span<uint8_t const> message = std::span(data).first(12 * i);
+        dmhash(message.data(), (uint32_t) message.size() * 8, out);
+        std::optional<bksq::Block> hash = bksq::dmhash(message);
+        if (!hash || memcmp(hash->data(), out, 12) != 0) msg = ERRMSG;
+        hmac(message.data(), (uint32_t) message.size() * 8, key.data(), BLOCKSIZE, out, NULL, 0);
+        std::optional<bksq::Block> tag = bksq::hmac(message, key);
+        if (!tag || memcmp(tag->data(), out, 12) != 0) msg = ERRMSG;
+    }
+    if (bksq::dmhash(std::span(data).first(13)) || bksq::hmac(std::span(data).first(13), key)) msg = ERRMSG;
+    printf("%s\n", msg);
+
+    printf("Teste C++ Authenticated Encryption...  ");
+    msg = "OK!";
+    for (i = 0; i <= 40; i++) {
+        random_fill(key);
+        random_fill(nonce);
+        random_fill(data);
+        reference = data;
+        std::span<uint8_t> message = std::span(data).first(12 * i);
+        CONTEXT ctx = {.data = reference.data(), .data_length = (uint32_t) message.size() * 8, .key = key.data(), .nonce = nonce.data(), .nonce_length = 6 * 8};
+        ae_enc(ctx, out);
+        std::optional<bksq::Block> tag = bksq::ae_enc(message, key, nonce);
+        if (!tag || memcmp(tag->data(), out, 12) != 0 || data != reference) msg = ERRMSG;
+        if (ae_dec(ctx, out) != AE_DEC_OK || !bksq::ae_dec(message, key, nonce, *tag) || data != reference) msg = ERRMSG;
+        (*tag)[i % 12] ^= 1;
+        if (bksq::ae_dec(message, key, nonce, *tag) || data != reference) msg = ERRMSG;
+    }
+    printf("%s\n", msg);
+
+    printf("Fertig!\n\n");
+    return (EXIT_SUCCESS);
+}
@@ -28,6 +28,11 @@
 
 
 #include "abgabe.c" ///< ja - das ist sehr haesslich, aber fuer moodle noetig!
+#include "bksq_file.c"
+#include "bksq_stream.c"
+#include "bksq_collision.c"
+#include "bksq_reservoir.c"
+#include "bksq_keycache.c"
 
 /**
  *  The main function, demonstrating the calling of our functions
@@ -35,6 +40,42 @@
 int main(int argc, char** argv) {
 
     
+    /* test of the precomputed S-Box tables against the reference S-Box
+     */
+    PRINTSTRING("Teste S-Box-Tabellen...  ");
+    PRINTSTRING(sbox_tables_check() == 0 ? "OK!" : ERRMSG);
+    PRINTSTRING("\n");
+
+    /* exhaustive test of the GF(2^8) module against the original multiply(), and of theta and theta_inverse built on it
+     */
+    PRINTSTRING("Teste GF(2^8)...  ");
+    int gferror = gf_tables_check();
+    int a, b, t;
+    uint8_t gfblock[12], gftheta[12], gfback[12];
+    for (a = 0; a < 256; a++) {
+        for (b = 0; b < 256; b++) {
+            if (gf_mul(a, b) != multiply(a, b) || gf_mul_table(a, b) != multiply(a, b)) gferror = 1;
+        }
+        if (xtime(a) != multiply(a, 2) || gf_mul3(a) != multiply(a, 3) || gf_mul247(a) != multiply(a, 247)) gferror = 1;
+        if (gf_inverse_table(a) != extended_gcd(a) || gf_pow(a, 254) != extended_gcd(a)) gferror = 1;
+    }
+    for (t = 1; t < 11; t++) {
+        if (gf_pow(2, t) != multiply(1, exponent(2, t))) gferror = 1;
+    }
+    for (a = 0; a < 256; a++) {
+        for (b = 0; b < 12; b++) gfblock[b] = (uint8_t) (a * 29 + b * b * 71 + 5);
+        theta(gfblock, gftheta);
+        theta_inverse(gftheta, gfback);
+        for (b = 0; b < 12; b += 3) {
+            if (gftheta[b] != (multiply(gfblock[b], 3) ^ multiply(gfblock[b + 1], 2) ^ multiply(gfblock[b + 2], 2))) gferror = 1;
+            if (gftheta[b + 1] != (multiply(gfblock[b], 2) ^ multiply(gfblock[b + 1], 3) ^ multiply(gfblock[b + 2], 2))) gferror = 1;
+            if (gftheta[b + 2] != (multiply(gfblock[b], 2) ^ multiply(gfblock[b + 1], 2) ^ multiply(gfblock[b + 2], 3))) gferror = 1;
+        }
+        if (memcmp(gfback, gfblock, 12) != 0) gferror = 1;
+    }
+    PRINTSTRING(gferror == 0 ? "OK!" : ERRMSG);
+    PRINTSTRING("\n");
+
     /* single test for the blockcipher
      */
     PRINTSTRING("Teste BKSQ...  ");
@@ -61,7 +102,128 @@ int main(int argc, char** argv) {
     PRINTSTRING(msg);
     PRINTSTRING("\n");
 
-  
+    /* test for the T-table engine
+     */
+    PRINTSTRINGINT("Teste T-Tabellen (Bytes: ", (int) ttable_footprint());
+    PRINTSTRING(")...  ");
+
+    msg = (ttable_check() == 0) ? "OK!" : ERRMSG;
+    bksq_encrypt_ttable(data, result, key);
+    for (i = 0; i < 12; i++) {
+        if (result[i] != check[i]) {
+            msg = ERRMSG;
+            break;
+        }
+    }
+
+    PRINTSTRING(msg);
+    PRINTSTRING("\n");
+
+    /* test for the expanded key
+     */
+    PRINTSTRING("Teste expandierten Schluessel...  ");
+
+    BKSQ_KEY_SCHEDULE ks;
+    bksq_key_expand(key, &ks);
+    msg = "OK!";
+    bksq_encrypt_expanded(data, result, &ks);
+    for (i = 0; i < 12; i++) {
+        if (result[i] != check[i]) {
+            msg = ERRMSG;
+            break;
+        }
+    }
+    bksq_encrypt_expanded_ttable(data, result, &ks);
+    for (i = 0; i < 12; i++) {
+        if (result[i] != check[i]) {
+            msg = ERRMSG;
+            break;
+        }
+    }
+
+    PRINTSTRING(msg);
+    PRINTSTRING("\n");
+
+    /* test for the bitsliced kernel and the long counter mode, against single block encryptions
+     */
+    PRINTSTRING("Teste Bitslice...  ");
+
+    uint8_t bsin[12 * 100];
+    uint8_t bsout[12 * 100];
+    uint8_t bsnonce[6] = {0x75, 0x6e, 0x69, 0x71, 0x75, 0x65};
+    uint8_t bscounter[12] = {0x75, 0x6e, 0x69, 0x71, 0x75, 0x65, 0, 0, 0, 0, 0, 0};
+    for (i = 0; i < 12 * 100; i++) bsin[i] = (uint8_t) (7 * i + 3);
+    msg = "OK!";
+    bksq_encrypt_blocks_bitslice(bsin, bsout, 100, &ks);
+    for (i = 0; i < 100; i++) {
+        bksq_encrypt(bsin + 12 * i, result, key);
+        if (memcmp(result, bsout + 12 * i, 12) != 0) {
+            msg = ERRMSG;
+            break;
+        }
+    }
+    uint64_t bsslices[96];
+    uint64_t bssbox[8];
+    for (t = 0; t < 4; t++) {
+        for (i = 0; i < 64; i++) bsout[12 * i] = (uint8_t) (64 * t + i);
+        bitslice_pack(bsout, 64, bsslices);
+        bitslice_S_box_single(bsslices, bssbox);
+        for (i = 0; i < 8; i++) bsslices[i] = bssbox[i];
+        bitslice_unpack(bsslices, 64, bsout);
+        for (i = 0; i < 64; i++) {
+            if (bsout[12 * i] != S_box_single((uint8_t) (64 * t + i))) msg = ERRMSG;
+        }
+    }
+    bitslice_pack(bsin, 37, bsslices);
+    bitslice_unpack(bsslices, 37, bsout);
+    if (memcmp(bsin, bsout, 12 * 37) != 0) msg = ERRMSG;
+    memset(bsout, 0, sizeof(bsout));
+    CONTEXT bsctx = {.data = bsout, .data_length = sizeof(bsout) * 8, .key = key, .nonce = bsnonce, .nonce_length = 6 * 8};
+    ctr(bsctx);
+    for (i = 0; i < 100; i++) {
+        bksq_encrypt(bscounter, result, key);
+        counter(bscounter);
+        if (memcmp(result, bsout + 12 * i, 12) != 0) {
+            msg = ERRMSG;
+            break;
+        }
+    }
+
+    PRINTSTRING(msg);
+    PRINTSTRING("\n");
+
+#ifdef BKSQ_X86_SIMD
+    /* test for the SIMD kernels the CPU supports, against single block encryptions
+     */
+    PRINTSTRING("Teste SIMD...  ");
+
+    msg = "OK!";
+    if (__builtin_cpu_supports("ssse3")) {
+        bksq_encrypt_blocks_ssse3(bsin, bsout, 99, &ks);
+        for (i = 0; i < 99; i++) {
+            bksq_encrypt(bsin + 12 * i, result, key);
+            if (memcmp(result, bsout + 12 * i, 12) != 0) {
+                msg = ERRMSG;
+                break;
+            }
+        }
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        bksq_encrypt_blocks_avx2(bsin, bsout, 99, &ks);
+        for (i = 0; i < 99; i++) {
+            bksq_encrypt(bsin + 12 * i, result, key);
+            if (memcmp(result, bsout + 12 * i, 12) != 0) {
+                msg = ERRMSG;
+                break;
+            }
+        }
+    }
+
+    PRINTSTRING(msg);
+    PRINTSTRING("\n");
+#endif
+
+
 
     /* test for counter mode
      */
@@ -88,6 +250,56 @@ int main(int argc, char** argv) {
     }
     PRINTSTRING(msg);
 
+    /* Testing the parallel counter mode against ctr()
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste parallelen CTR-Mode...  ");
+    msg = "OK!";
+    BKSQ_THREAD_POOL pool;
+    if (bksq_pool_create(&pool, 3) != 0) msg = ERRMSG;
+    uint8_t parallelout[12 * 100];
+    memcpy(ciphertext, test, 144);
+    CONTEXT parallelctx = {.data = ciphertext, .data_length = 144 * 8, .key = ctrkey, .nonce = nonce, .nonce_length = 6 * 8};
+    ret = ctr_parallel(parallelctx, &pool, 12 * 8);
+    if (ret != 0) PRINTSTRINGINT("Error: ", ret);
+    memcpy(bsout, test, 144);
+    bsctx.data_length = 144 * 8;
+    bsctx.key = ctrkey;
+    ctr(bsctx);
+    if (memcmp(ciphertext, bsout, 144) != 0) msg = ERRMSG;
+    memcpy(parallelout, bsin, sizeof(parallelout));
+    memcpy(bsout, bsin, sizeof(bsout));
+    parallelctx.data = parallelout;
+    parallelctx.data_length = sizeof(parallelout) * 8;
+    bsctx.data_length = sizeof(bsout) * 8;
+    ctr_parallel(parallelctx, &pool, 5 * 12 * 8);
+    ctr(bsctx);
+    if (memcmp(parallelout, bsout, sizeof(bsout)) != 0) msg = ERRMSG;
+    bksq_pool_destroy(&pool);
+    PRINTSTRING(msg);
+
+    /* Testing the counter mode stream with pieces of odd lengths and a seek into the middle
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste CTR-Stream...  ");
+    msg = "OK!";
+    CTR_STREAM stream;
+    memcpy(ciphertext, test, 144);
+    ctr_stream_init(&stream, ctrkey, nonce, 6 * 8);
+    ctr_stream_update(&stream, ciphertext, 1);
+    ctr_stream_update(&stream, ciphertext + 1, 5);
+    ctr_stream_update(&stream, ciphertext + 6, 25);
+    ctr_stream_update(&stream, ciphertext + 31, 113);
+    memcpy(parallelout, test, 144);
+    parallelctx.data_length = 144 * 8;
+    ctr(parallelctx);
+    if (memcmp(ciphertext, parallelout, 144) != 0) msg = ERRMSG;
+    ctr_stream_seek(&stream, 50);
+    ctr_stream_update(&stream, ciphertext + 50, 20);
+    if (memcmp(ciphertext + 50, test + 50, 20) != 0) msg = ERRMSG;
+    ctr_stream_final(&stream);
+    PRINTSTRING(msg);
+
     /* Testing the Davies-Meyer construction
      */
     PRINTSTRING("\n");
@@ -104,6 +316,67 @@ int main(int argc, char** argv) {
         }
     }
 
+    PRINTSTRING(msg);
+
+    /* Testing the incremental Davies-Meyer hash with pieces of odd lengths
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste inkrementellen Davies-Meyer...  ");
+    msg = "OK!";
+    DM_CTX dmctx;
+    dm_init(&dmctx);
+    dm_update(&dmctx, testdm, 7);
+    dm_update(&dmctx, testdm + 7, 30);
+    dm_update(&dmctx, testdm + 37, 107);
+    if (dm_final(&dmctx, hash) != DM_OK || memcmp(hash, checkdm, 12) != 0) msg = ERRMSG;
+    dm_init(&dmctx);
+    dm_update(&dmctx, testdm, 143);
+    if (dm_final(&dmctx, hash) != INVALID_DATA_LENGTH) msg = ERRMSG;
+    PRINTSTRING(msg);
+
+    /* Testing the multi-buffer Davies-Meyer against dmhash(): 20 messages of different lengths, some empty,
+     * and the kernels against each other
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Multi-Buffer Davies-Meyer...  ");
+    msg = "OK!";
+    uint8_t const *manymsgs[20];
+    uint32_t manylengths[20];
+    uint8_t manyhashes[20][12];
+    for (i = 0; i < 20; i++) {
+        manymsgs[i] = bsin + 12 * i;
+        manylengths[i] = (uint32_t) ((i * 7) % 13) * BLOCKSIZE;
+    }
+    manymsgs[5] = testdm;
+    manylengths[5] = 144 * 8;
+    if (dmhash_many(manymsgs, manylengths, manyhashes, 20) != DM_OK) msg = ERRMSG;
+    for (i = 0; i < 20; i++) {
+        dmhash(manymsgs[i], manylengths[i], hash);
+        if (memcmp(hash, manyhashes[i], 12) != 0) msg = ERRMSG;
+    }
+    if (memcmp(manyhashes[5], checkdm, 12) != 0) msg = ERRMSG;
+    manylengths[3] = 100;
+    if (dmhash_many(manymsgs, manylengths, manyhashes, 20) != INVALID_DATA_LENGTH) msg = ERRMSG;
+    uint8_t laneref[DM_MANY_LANES][16];
+    uint8_t lanehash[DM_MANY_LANES][16];
+    for (i = 0; i < DM_MANY_LANES; i++) memcpy(laneref[i], bsin + 500 + 16 * i, 16);
+    memcpy(lanehash, laneref, sizeof(lanehash));
+    dm_compress_lanes_scalar(laneref, manymsgs);
+#ifdef BKSQ_X86_SIMD
+    if (__builtin_cpu_supports("ssse3")) {
+        dm_compress_lanes_ssse3(lanehash, manymsgs);
+        for (i = 0; i < DM_MANY_LANES; i++) {
+            if (memcmp(lanehash[i], laneref[i], 12) != 0) msg = ERRMSG;
+            memcpy(lanehash[i], bsin + 500 + 16 * i, 16);
+        }
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        dm_compress_lanes_avx2(lanehash, manymsgs);
+        for (i = 0; i < DM_MANY_LANES; i++) {
+            if (memcmp(lanehash[i], laneref[i], 12) != 0) msg = ERRMSG;
+        }
+    }
+#endif
     PRINTSTRING(msg);
 
 	/* Testing the HMAC
@@ -136,6 +409,86 @@ int main(int argc, char** argv) {
             msg = ERRMSG; 
         break;}
     }
+    PRINTSTRING(msg);
+
+    /* Testing the incremental HMAC with an expanded key, used twice
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste inkrementellen HMAC...  ");
+    msg = "OK!";
+    HMAC_KEY_SCHEDULE hks;
+    HMAC_CTX hmacctx;
+    hmac_key_expand(hmackey, 12 * 8, &hks);
+    hmac_init(&hmacctx, &hks);
+    hmac_update(&hmacctx, testhmac, 100);
+    hmac_update(&hmacctx, testhmac + 100, 44);
+    if (hmac_final(&hmacctx, tag) != HMAC_OK || memcmp(tag, checkMAC, 12) != 0) msg = ERRMSG;
+    memset(tag, 0, 12);
+    hmac_expanded(testhmac + 12, 132 * 8, &hks, tag, testhmac, 12 * 8);
+    if (memcmp(tag, checkMAC, 12) != 0) msg = ERRMSG;
+    PRINTSTRING(msg);
+
+    /* Testing the scatter/gather variants against the contiguous functions: the 144 bytes of the HMAC test in six
+     * segments, cut within blocks, with an empty one in between
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Scatter/Gather...  ");
+    msg = "OK!";
+    uint8_t sgdata[144];
+    uint8_t sgref[144];
+    uint8_t sghash[12];
+    uint8_t sgcheck[12];
+    size_t sglengths[6] = {5, 0, 19, 12, 100, 8};
+    size_t sgoffset = 0;
+    struct iovec sgiov[6];
+    memcpy(sgdata, testhmac, 144);
+    for (i = 0; i < 6; sgoffset += sglengths[i], i++) {
+        sgiov[i].iov_base = sgdata + sgoffset;
+        sgiov[i].iov_len = sglengths[i];
+    }
+    if (hmacv(sgiov, 6, hmackey, 12 * 8, sghash) != HMAC_OK || memcmp(sghash, checkMAC, 12) != 0) msg = ERRMSG;
+    dmhash(testhmac, 144 * 8, sgcheck);
+    if (dmhashv(sgiov, 6, sghash) != DM_OK || memcmp(sghash, sgcheck, 12) != 0) msg = ERRMSG;
+    if (dmhashv(sgiov, 5, sghash) != INVALID_DATA_LENGTH || hmacv(sgiov, 5, hmackey, 12 * 8, sghash) != INVALID_DATA_LENGTH) msg = ERRMSG;
+    memcpy(sgref, testhmac, 144);
+    ctr_stream_init(&stream, ctrkey, nonce, 6 * 8);
+    ctr_stream_update(&stream, sgref, 144);
+    ctr_stream_final(&stream);
+    if (ctrv(sgiov, 6, ctrkey, nonce, 6 * 8) != CTR_OK || memcmp(sgdata, sgref, 144) != 0) msg = ERRMSG;
+    if (ctrv(sgiov, 5, ctrkey, nonce, 6 * 8) != CTR_OK || memcmp(sgdata, testhmac, 136) != 0 || memcmp(sgdata + 136, sgref + 136, 8) != 0) msg = ERRMSG;
+    PRINTSTRING(msg);
+
+    /* Testing the tree hash against dmhash() of the prefixed leaves and nodes: 10 leaves of 120 bytes, fanout 4,
+     * i.e. 3 nodes and the root; on the calling thread and on a pool, then the tree-HMAC
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Baum-Hash...  ");
+    msg = "OK!";
+    uint8_t treebuf[12 + 120];
+    uint8_t treelevel[10][12];
+    uint8_t treeroot[12];
+    memset(treebuf, 0, 12);
+    for (i = 0; i < 10; i++) {
+        treebuf[0] = DM_TREE_LEAF;
+        memcpy(treebuf + 12, bsin + 120 * i, 120);
+        dmhash(treebuf, (12 + 120) * 8, treelevel[i]);
+    }
+    treebuf[0] = DM_TREE_NODE;
+    for (i = 0; i < 3; i++) {
+        memcpy(treebuf + 12, treelevel[4 * i], i < 2 ? 48 : 24);
+        dmhash(treebuf, (i < 2 ? 60 : 36) * 8, treelevel[i]);
+    }
+    memcpy(treebuf + 12, treelevel[0], 36);
+    dmhash(treebuf, 48 * 8, hash);
+    if (dmhash_tree(bsin, 1200, 120, 4, treeroot, NULL) != DM_OK || memcmp(treeroot, hash, 12) != 0) msg = ERRMSG;
+    if (bksq_pool_create(&pool, 2) != 0) msg = ERRMSG;
+    memset(treeroot, 0, 12);
+    if (dmhash_tree(bsin, 1200, 120, 4, treeroot, &pool) != DM_OK || memcmp(treeroot, hash, 12) != 0) msg = ERRMSG;
+    if (hmac_tree(bsin, 1200, 120, 4, hmackey, 12 * 8, tag, &pool) != HMAC_OK) msg = ERRMSG;
+    bksq_pool_destroy(&pool);
+    hmac(hash, 12 * 8, hmackey, 12 * 8, treeroot, NULL, 0);
+    if (memcmp(tag, treeroot, 12) != 0) msg = ERRMSG;
+    if (dmhash_tree(bsin, 1199, 120, 4, treeroot, NULL) != INVALID_DATA_LENGTH || dmhash_tree(bsin, 1200, 120, 1, treeroot, NULL) != INVALID_DATA_LENGTH) msg = ERRMSG;
     PRINTSTRING(msg);
 
 	/* Testing Authenticated Encryption
@@ -174,6 +527,386 @@ int main(int argc, char** argv) {
 
     PRINTSTRING(msg);
 
+    /* Testing Authenticated Decryption: a forged tag is rejected without touching the data,
+     * the right tag gives back the plaintext; then the same as a batch
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Authenticated Decryption...  ");
+    msg = "OK!";
+    memcpy(ciphertext, aetest, 144);
+    aetag[0] ^= 1;
+    if (ae_dec(aectx, aetag) != INVALID_TAG || memcmp(aetest, ciphertext, 144) != 0) msg = ERRMSG;
+    aetag[0] ^= 1;
+    if (ae_dec(aectx, aetag) != AE_DEC_OK) msg = ERRMSG;
+    ae_enc(aectx, aetag);
+    if (memcmp(aetest, ciphertext, 144) != 0 || memcmp(aetag, aecheckMAC, 12) != 0) msg = ERRMSG;
+    CONTEXT batch[3] = {aectx, aectx, aectx};
+    uint8_t batchtags[3][12];
+    uint8_t batchresults[3];
+    uint8_t batchdata[3][144];
+    for (i = 0; i < 3; i++) {
+        memcpy(batchdata[i], testdm, 144);
+        batch[i].data = batchdata[i];
+        ae_enc(batch[i], batchtags[i]);
+    }
+    batchtags[1][11] ^= 0x80;
+    memcpy(ciphertext, batchdata[1], 144);
+    if (ae_dec_batch(batch, (uint8_t const (*)[12]) batchtags, batchresults, 3, NULL) != INVALID_TAG) msg = ERRMSG;
+    if (batchresults[0] != AE_DEC_OK || batchresults[1] != INVALID_TAG || batchresults[2] != AE_DEC_OK) msg = ERRMSG;
+    if (memcmp(batchdata[0], testdm, 144) != 0 || memcmp(batchdata[1], ciphertext, 144) != 0) msg = ERRMSG;
+    PRINTSTRING(msg);
+
+    /* Testing the batch encryption: 100 records of 0 to 20 blocks under three keys in runs, one of them of a bad
+     * length, against ae_enc() record by record and back with ae_dec_batch(), on the calling thread and on a pool;
+     * then 100 records with a key of their own but for every fifth, which share one
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Batch-Verschluesselung...  ");
+    msg = "OK!";
+    CONTEXT encbatch[100];
+    uint8_t encbatchdata[100][240];
+    uint8_t encbatchcheck[100][240];
+    uint8_t encbatchtags[100][12];
+    uint8_t encbatchresults[100];
+    uint8_t encbatchkeys[3][12];
+    uint8_t encbatchnonces[100][6];
+    int encbatchround;
+    int k;
+    for (t = 0; t < 3; t++) {
+        for (k = 0; k < 12; k++) encbatchkeys[t][k] = (uint8_t) (40 * t + k);
+    }
+    for (encbatchround = 0; encbatchround < 2; encbatchround++) {
+        if (encbatchround == 1 && bksq_pool_create(&pool, 2) != 0) msg = ERRMSG;
+        for (i = 0; i < 100; i++) {
+            for (k = 0; k < 240; k++) encbatchdata[i][k] = (uint8_t) (13 * i + k);
+            for (k = 0; k < 6; k++) encbatchnonces[i][k] = (uint8_t) (i + k);
+            encbatch[i].data = encbatchdata[i];
+            encbatch[i].data_length = (uint32_t) (i % 21) * BLOCKSIZE;
+            encbatch[i].key = encbatchkeys[(i / 7 + i / 30) % 3];
+            encbatch[i].nonce = encbatchnonces[i];
+            encbatch[i].nonce_length = 6 * 8;
+        }
+        encbatch[42].data_length = 100;
+        memcpy(encbatchcheck, encbatchdata, sizeof(encbatchdata));
+        if (ae_enc_batch(encbatch, encbatchtags, encbatchresults, 100, encbatchround == 1 ? &pool : NULL) != INVALID_DATA_LENGTH) msg = ERRMSG;
+        for (i = 0; i < 100; i++) {
+            encbatch[i].data = encbatchcheck[i];
+            if (i == 42) {
+                if (encbatchresults[i] != INVALID_DATA_LENGTH || memcmp(encbatchdata[i], encbatchcheck[i], 240) != 0) msg = ERRMSG;
+            } else {
+                ae_enc(encbatch[i], tag);
+                if (encbatchresults[i] != AE_ENC_OK || memcmp(tag, encbatchtags[i], 12) != 0 || memcmp(encbatchdata[i], encbatchcheck[i], 240) != 0) msg = ERRMSG;
+            }
+            encbatch[i].data = encbatchdata[i];
+        }
+        if (ae_dec_batch(encbatch, (uint8_t const (*)[12]) encbatchtags, encbatchresults, 40, encbatchround == 1 ? &pool : NULL) != AE_DEC_OK) msg = ERRMSG;
+        for (i = 0; i < 40; i++) {
+            for (k = 0; k < 240; k++) {
+                if (encbatchdata[i][k] != (uint8_t) (13 * i + k)) msg = ERRMSG;
+            }
+        }
+        if (encbatchround == 1) bksq_pool_destroy(&pool);
+    }
+    uint8_t encbatchmanykeys[100][12];
+    for (i = 0; i < 100; i++) {
+        for (k = 0; k < 12; k++) encbatchmanykeys[i][k] = (uint8_t) (i % 5 == 0 ? k : 3 * i + k);
+        encbatch[i].data_length = (uint32_t) (i % 5) * BLOCKSIZE;
+        encbatch[i].key = encbatchmanykeys[i];
+    }
+    memcpy(encbatchcheck, encbatchdata, sizeof(encbatchdata));
+    if (ae_enc_batch(encbatch, encbatchtags, encbatchresults, 100, NULL) != AE_ENC_OK) msg = ERRMSG;
+    for (i = 0; i < 100; i++) {
+        encbatch[i].data = encbatchcheck[i];
+        ae_enc(encbatch[i], tag);
+        if (memcmp(tag, encbatchtags[i], 12) != 0 || memcmp(encbatchdata[i], encbatchcheck[i], 240) != 0) msg = ERRMSG;
+        encbatch[i].data = encbatchdata[i];
+    }
+    PRINTSTRING(msg);
+
+    /* Testing the file encryption against the counter mode stream and ae_enc(): a large file of odd length in place
+     * on two threads, then authenticated en- and decryption between two files, with a forged tag, and the input
+     * as its own output, which must be rejected untouched
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Datei-Verschluesselung...  ");
+    msg = "OK!";
+    char filein[] = "/tmp/bksq_in_XXXXXX";
+    char fileout[] = "/tmp/bksq_out_XXXXXX";
+    size_t filelength = 12 * 20000 + 5;
+    uint8_t *filedata = (uint8_t *) malloc(filelength);
+    uint8_t *fileref = (uint8_t *) malloc(filelength + 12);
+    FILE *file;
+    for (i = 0; i < (int) filelength; i++) filedata[i] = (uint8_t) (7 * i);
+    close(mkstemp(filein));
+    close(mkstemp(fileout));
+    file = fopen(filein, "wb");
+    fwrite(filedata, 1, filelength, file);
+    fclose(file);
+    if (bksq_pool_create(&pool, 2) != 0) msg = ERRMSG;
+    if (bksq_file(filein, NULL, BKSQ_FILE_CTR, ctrkey, nonce, &pool) != CTR_OK) msg = ERRMSG;
+    bksq_pool_destroy(&pool);
+    ctr_stream_init(&stream, ctrkey, nonce, 6 * 8);
+    ctr_stream_update(&stream, filedata, filelength);
+    ctr_stream_final(&stream);
+    file = fopen(filein, "rb");
+    if (fread(fileref, 1, filelength + 12, file) != filelength || memcmp(fileref, filedata, filelength) != 0) msg = ERRMSG;
+    fclose(file);
+    file = fopen(filein, "wb");
+    fwrite(testdm, 1, 144, file);
+    fclose(file);
+    memcpy(ciphertext, testdm, 144);
+    aectx.data = ciphertext;
+    ae_enc(aectx, aetag);
+    if (bksq_file(filein, fileout, BKSQ_FILE_AE_ENC, aekey, aenonce, NULL) != AE_ENC_OK) msg = ERRMSG;
+    file = fopen(fileout, "rb");
+    if (fread(fileref, 1, 157, file) != 156 || memcmp(fileref, ciphertext, 144) != 0 || memcmp(fileref + 144, aetag, 12) != 0) msg = ERRMSG;
+    fclose(file);
+    if (bksq_file(fileout, NULL, BKSQ_FILE_AE_DEC, aekey, aenonce, NULL) != AE_DEC_OK) msg = ERRMSG;
+    file = fopen(fileout, "rb");
+    if (fread(fileref, 1, 157, file) != 144 || memcmp(fileref, testdm, 144) != 0) msg = ERRMSG;
+    fclose(file);
+    bksq_file(filein, fileout, BKSQ_FILE_AE_ENC, aekey, aenonce, NULL);
+    file = fopen(fileout, "r+b");
+    fseek(file, 100, SEEK_SET);
+    fputc(ciphertext[100] ^ 1, file);
+    fclose(file);
+    if (bksq_file(fileout, filein, BKSQ_FILE_AE_DEC, aekey, aenonce, NULL) != INVALID_TAG) msg = ERRMSG;
+    file = fopen(filein, "rb");
+    if (fread(fileref, 1, 157, file) != 144 || memcmp(fileref, testdm, 144) != 0) msg = ERRMSG;
+    fclose(file);
+    if (bksq_file(filein, filein, BKSQ_FILE_AE_ENC, aekey, aenonce, NULL) != SAME_FILE) msg = ERRMSG;
+    if (bksq_file(filein, "/nonexistent/bksq_out", BKSQ_FILE_AE_ENC, aekey, aenonce, NULL) != OUTPUT_FILE_ERROR) msg = ERRMSG;
+    file = fopen(filein, "rb");
+    if (fread(fileref, 1, 157, file) != 144 || memcmp(fileref, testdm, 144) != 0) msg = ERRMSG;
+    fclose(file);
+    remove(filein);
+    remove(fileout);
+    free(filedata);
+    free(fileref);
+    PRINTSTRING(msg);
+
+    /* Testing the pipelined stream encryption against the counter mode stream and ae_enc(): a stream of several
+     * buffers and odd length in counter mode, then authenticated encryption, and an input that ends within a block
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Stream-Verschluesselung...  ");
+    msg = "OK!";
+    char streaminpath[] = "/tmp/bksq_in_XXXXXX";
+    char streamoutpath[] = "/tmp/bksq_out_XXXXXX";
+    int streamin;
+    int streamout;
+    BKSQ_STREAM_STATS streamstats;
+    filelength = 2 * BKSQ_STREAM_CHUNK + 12 * 1000 + 7;
+    filedata = (uint8_t *) malloc(filelength);
+    fileref = (uint8_t *) malloc(filelength + 12);
+    for (i = 0; i < (int) filelength; i++) filedata[i] = (uint8_t) (11 * i);
+    streamin = mkstemp(streaminpath);
+    streamout = mkstemp(streamoutpath);
+    if (write(streamin, filedata, filelength) != (ssize_t) filelength) msg = ERRMSG;
+    lseek(streamin, 0, SEEK_SET);
+    if (bksq_stream(streamin, streamout, BKSQ_STREAM_CTR, ctrkey, nonce, 0, NULL, &streamstats) != CTR_OK) msg = ERRMSG;
+    if (streamstats.bytes != filelength) msg = ERRMSG;
+    ctr_stream_init(&stream, ctrkey, nonce, 6 * 8);
+    ctr_stream_update(&stream, filedata, filelength);
+    ctr_stream_final(&stream);
+    if (pread(streamout, fileref, filelength + 12, 0) != (ssize_t) filelength || memcmp(fileref, filedata, filelength) != 0) msg = ERRMSG;
+    if (ftruncate(streamin, 0) != 0 || ftruncate(streamout, 0) != 0 || pwrite(streamin, testdm, 144, 0) != 144) msg = ERRMSG;
+    lseek(streamin, 0, SEEK_SET);
+    lseek(streamout, 0, SEEK_SET);
+    if (bksq_stream(streamin, streamout, BKSQ_STREAM_AE_ENC, aekey, aenonce, 0, NULL, NULL) != AE_ENC_OK) msg = ERRMSG;
+    memcpy(ciphertext, testdm, 144);
+    aectx.data = ciphertext;
+    ae_enc(aectx, aetag);
+    if (pread(streamout, fileref, 157, 0) != 156 || memcmp(fileref, ciphertext, 144) != 0 || memcmp(fileref + 144, aetag, 12) != 0) msg = ERRMSG;
+    if (ftruncate(streamin, 143) != 0) msg = ERRMSG;
+    lseek(streamin, 0, SEEK_SET);
+    if (bksq_stream(streamin, streamout, BKSQ_STREAM_AE_ENC, aekey, aenonce, 0, NULL, NULL) != INVALID_DATA_LENGTH) msg = ERRMSG;
+    close(streamin);
+    close(streamout);
+    remove(streaminpath);
+    remove(streamoutpath);
+    free(filedata);
+    free(fileref);
+    PRINTSTRING(msg);
+
+    /* Testing the collision search: a 24 bit collision on two threads, checked with dmhash(); then a 32 bit search
+     * stopped early with a checkpoint and resumed from it, and a checkpoint that belongs to other parameters
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Kollisionssuche...  ");
+    msg = "OK!";
+    char collisionpath[] = "/tmp/bksq_dp_XXXXXX";
+    BKSQ_COLLISION_PARAMS collisionparams = {.bits = 24, .dp_bits = 4, .salt = 0x42, .nthreads = 2};
+    BKSQ_COLLISION collision;
+    uint8_t collisionhash[2][12];
+    if (bksq_collision_search(&collisionparams, &collision) != DM_OK || memcmp(collision.block[0], collision.block[1], 12) == 0) msg = ERRMSG;
+    dmhash(collision.block[0], BLOCKSIZE, collisionhash[0]);
+    dmhash(collision.block[1], BLOCKSIZE, collisionhash[1]);
+    if (memcmp(collisionhash[0], collisionhash[1], 3) != 0 || collision.hash != bksq_collision_truncate(collisionhash[0], 24)) msg = ERRMSG;
+    close(mkstemp(collisionpath));
+    remove(collisionpath);
+    collisionparams.bits = 32;
+    collisionparams.dp_bits = 8;
+    collisionparams.max_evaluations = 2000;
+    collisionparams.checkpoint_path = collisionpath;
+    if (bksq_collision_search(&collisionparams, &collision) != BKSQ_COLLISION_NOT_FOUND || collision.distinguished_points == 0) msg = ERRMSG;
+    collisionparams.max_evaluations = 0;
+    if (bksq_collision_search(&collisionparams, &collision) != DM_OK || collision.resumed_evaluations < 2000) msg = ERRMSG;
+    dmhash(collision.block[0], BLOCKSIZE, collisionhash[0]);
+    dmhash(collision.block[1], BLOCKSIZE, collisionhash[1]);
+    if (memcmp(collisionhash[0], collisionhash[1], 4) != 0 || memcmp(collision.block[0], collision.block[1], 12) == 0) msg = ERRMSG;
+    collisionparams.dp_bits = 7;
+    if (bksq_collision_search(&collisionparams, &collision) != FILE_ERROR) msg = ERRMSG;
+    remove(collisionpath);
+    PRINTSTRING(msg);
+
+    /* Testing the keystream reservoir against the counter mode stream: records of 1 to 40 bytes, first from a full
+     * ring, then as fast as possible (with misses), then under a new nonce after the invalidation
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Keystream-Reservoir...  ");
+    msg = "OK!";
+    KEYSTREAM_RESERVOIR reservoir;
+    RESERVOIR_STATS reservoirstats;
+    uint8_t reservoirdata[12000];
+    uint8_t reservoirref[12000];
+    uint8_t reservoirnonce[6] = {1, 2, 3, 4, 5, 6};
+    struct timespec reservoirwait = {0, 1000000};
+    size_t reservoiroffset;
+    size_t reservoirlength;
+    if (reservoir_init(&reservoir, ctrkey, nonce, 6 * 8, 64, 32, 16) != INVALID_DATA_LENGTH) msg = ERRMSG;
+    if (reservoir_init(&reservoir, ctrkey, nonce, 6 * 8, 256, 64, 192) != CTR_OK) msg = ERRMSG;
+    for (i = 0; i < 1000; i++) {
+        reservoir_stats(&reservoir, &reservoirstats);
+        if (reservoirstats.produced_blocks >= 192) break;
+        nanosleep(&reservoirwait, NULL);
+    }
+    for (t = 0; t < 2; t++) {
+        for (i = 0; i < 12000; i++) reservoirdata[i] = reservoirref[i] = (uint8_t) (i * 13 + t);
+        ctr_stream_init(&stream, ctrkey, t == 0 ? nonce : reservoirnonce, 6 * 8);
+        ctr_stream_update(&stream, reservoirref, 12000);
+        ctr_stream_final(&stream);
+        for (reservoiroffset = 0; reservoiroffset < 12000; reservoiroffset += reservoirlength) {
+            reservoirlength = 1 + (reservoiroffset * 7) % 40;
+            if (reservoirlength > 12000 - reservoiroffset) reservoirlength = 12000 - reservoiroffset;
+            reservoir_xor(&reservoir, reservoirdata + reservoiroffset, reservoirlength);
+            if (t == 0 && reservoiroffset == 0) {
+                reservoir_stats(&reservoir, &reservoirstats);
+                if (reservoirstats.hits != 1) msg = ERRMSG;
+            }
+        }
+        if (memcmp(reservoirdata, reservoirref, 12000) != 0) msg = ERRMSG;
+        if (t == 0 && reservoir_invalidate(&reservoir, ctrkey, reservoirnonce, 6 * 8) != CTR_OK) msg = ERRMSG;
+    }
+    reservoir_stats(&reservoir, &reservoirstats);
+    if (reservoirstats.bytes != 24000 || reservoirstats.hits + reservoirstats.misses != reservoirstats.requests) msg = ERRMSG;
+    if (reservoirstats.p50_ns == 0 || reservoirstats.p99_ns < reservoirstats.p50_ns || reservoirstats.max_ns < reservoirstats.p50_ns / 2) msg = ERRMSG;
+    reservoir_final(&reservoir);
+    PRINTSTRING(msg);
+
+    /* Testing the key cache: 200 keys through 32 entries against the expanded keys computed directly, a hit on a
+     * repeated key, the cached ae_enc(), ae_dec() and hmac() under one key, and the removal of that key
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Schluessel-Cache...  ");
+    msg = "OK!";
+    BKSQ_KEY_CACHE keycache;
+    KEY_CACHE_STATS keycachestats;
+    BKSQ_KEY_SCHEDULE cachedks;
+    BKSQ_KEY_SCHEDULE directks;
+    HMAC_KEY_SCHEDULE cachedhks;
+    HMAC_KEY_SCHEDULE directhks;
+    uint8_t cachekey[12];
+    if (key_cache_create(&keycache, 8) != INVALID_DATA_LENGTH || key_cache_create(&keycache, 32) != CTR_OK) msg = ERRMSG;
+    for (i = 0; i < 400; i++) {
+        for (t = 0; t < 12; t++) cachekey[t] = (uint8_t) ((i % 200) * 31 + t);
+        key_cache_get(&keycache, cachekey, &cachedks, &cachedhks);
+        bksq_key_expand(cachekey, &directks);
+        hmac_key_expand(cachekey, BLOCKSIZE, &directhks);
+        if (memcmp(&cachedks, &directks, sizeof(directks)) != 0 || memcmp(&cachedhks, &directhks, sizeof(directhks)) != 0) msg = ERRMSG;
+    }
+    key_cache_get(&keycache, cachekey, NULL, NULL);
+    key_cache_stats(&keycache, &keycachestats);
+    if (keycachestats.capacity != 32 || keycachestats.entries != 32 || keycachestats.hits != 1 || keycachestats.misses != 400) msg = ERRMSG;
+    if (keycachestats.evictions != keycachestats.misses - keycachestats.entries) msg = ERRMSG;
+    memcpy(ciphertext, testdm, 144);
+    aectx.data = ciphertext;
+    ae_enc(aectx, aetag);
+    memcpy(ciphertext, testdm, 144);
+    if (ae_enc_cached(&keycache, aectx, tag) != AE_ENC_OK || memcmp(tag, aetag, 12) != 0) msg = ERRMSG;
+    if (ae_dec_cached(&keycache, aectx, tag) != AE_DEC_OK || memcmp(ciphertext, testdm, 144) != 0) msg = ERRMSG;
+    if (hmac_cached(&keycache, testhmac, 144 * 8, hmackey, tag) != HMAC_OK || memcmp(tag, checkMAC, 12) != 0) msg = ERRMSG;
+    key_cache_remove(&keycache, aekey);
+    key_cache_get(&keycache, aekey, NULL, NULL);
+    key_cache_get(&keycache, aekey, NULL, NULL);
+    key_cache_stats(&keycache, &keycachestats);
+    if (keycachestats.hits != 4 || keycachestats.misses != 402) msg = ERRMSG;
+    key_cache_destroy(&keycache);
+    PRINTSTRING(msg);
+
+    /* Testing the backends: every one the CPU has must give the test vectors above through bksq_encrypt(), dmhash(),
+     * dmhash_many() and hmac(), and the counter mode of the reference backend;
+     * only ssse3-ct and avx2-ct are constant-time, the others use the tables for the key schedule and single blocks
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Backends...  ");
+    msg = "OK!";
+    char const *backendnames[] = {"reference", "ttable", "bitslice", "ssse3", "avx2", "ssse3-ct", "avx2-ct"};
+    char const *defaultbackend = bksq_backend_name();
+    uint8_t backendref[12 * 100];
+    if (bksq_backend_select("sse9") != BACKEND_UNAVAILABLE || strcmp(bksq_backend_name(), defaultbackend) != 0) msg = ERRMSG;
+    for (t = 0; t < 7; t++) {
+        if (bksq_backend_select(backendnames[t]) != CTR_OK) {
+            if (t < 3) msg = ERRMSG;
+            continue;
+        }
+        if (strcmp(bksq_backend_name(), backendnames[t]) != 0) msg = ERRMSG;
+        bksq_encrypt(data, result, key);
+        if (memcmp(result, check, 12) != 0) msg = ERRMSG;
+        dmhash(testdm, 144 * 8, hash);
+        if (memcmp(hash, checkdm, 12) != 0) msg = ERRMSG;
+        manylengths[3] = 3 * BLOCKSIZE;
+        if (dmhash_many(manymsgs, manylengths, manyhashes, 20) != DM_OK || memcmp(manyhashes[5], checkdm, 12) != 0) msg = ERRMSG;
+        hmac(testhmac, 144 * 8, hmackey, 12 * 8, tag, NULL, 0);
+        if (memcmp(tag, checkMAC, 12) != 0) msg = ERRMSG;
+        memcpy(bsout, bsin, sizeof(bsin));
+        ctr(bsctx);
+        if (t == 0) memcpy(backendref, bsout, sizeof(backendref));
+        if (memcmp(bsout, backendref, sizeof(backendref)) != 0) msg = ERRMSG;
+    }
+    if (bksq_backend_select("ttable") != CTR_OK || bksq_backend_constant_time()) msg = ERRMSG;
+    if (bksq_backend_select("bitslice") != CTR_OK || bksq_backend_constant_time()) msg = ERRMSG;
+    if (bksq_backend_select("avx2") == CTR_OK && bksq_backend_constant_time()) msg = ERRMSG;
+    if (bksq_backend_select_constant_time() == CTR_OK ? !bksq_backend_constant_time() : bksq_backend_select("ssse3-ct") == CTR_OK) msg = ERRMSG;
+    if (bksq_backend_select(NULL) != CTR_OK) msg = ERRMSG;
+    PRINTSTRING(msg);
+
+#ifdef BKSQ_INSTRUMENT
+    /* Testing the instrumentation counters: one ctr() and one dmhash() over 12 blocks each, all 24 in the kernels of the current backend
+     */
+    PRINTSTRING("\n");
+    PRINTSTRING("Teste Instrumentierung...  ");
+    msg = "OK!";
+    BKSQ_STAGE_COUNTERS counters[BKSQ_STAGES];
+    bksq_instrument_reset();
+    parallelctx.data = parallelout;
+    parallelctx.data_length = 144 * 8;
+    ctr(parallelctx);
+    dmhash(testdm, 144 * 8, hash);
+    bksq_instrument_snapshot(counters);
+    if (counters[BKSQ_STAGE_CTR].calls != 1 || counters[BKSQ_STAGE_CTR].blocks != 12 || counters[BKSQ_STAGE_CTR].bytes != 144) msg = ERRMSG;
+    if (counters[BKSQ_STAGE_ENCRYPT_BLOCKS].blocks != 24 || counters[BKSQ_STAGE_KEY_EXPAND].calls != 13) msg = ERRMSG;
+    if (counters[BKSQ_STAGE_DMHASH].calls != 1 || counters[BKSQ_STAGE_DMHASH].blocks != 12 || counters[BKSQ_STAGE_ROUND_KEY_EVOLUTION].calls != 130) msg = ERRMSG;
+    if (counters[BKSQ_STAGE_KERNEL + bksq_backend_index(bksq_backend_current())].blocks != 24) msg = ERRMSG;
+    if (memcmp(hash, checkdm, 12) != 0) msg = ERRMSG;
+    bksq_instrument_reset();
+    bksq_instrument_snapshot(counters);
+    for (i = 0; i < BKSQ_STAGES; i++) {
+        if (counters[i].calls != 0 || counters[i].time != 0) msg = ERRMSG;
+    }
+    PRINTSTRING(msg);
+#endif
+
     PRINTSTRING("\n");
     PRINTSTRING("Fertig!");
     PRINTSTRING("\n\n");